@@ -0,0 +1,122 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+Hand-off throughput between producer and consumer threads, for
+queue.Queue against values.Channel item by item and in batches
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from queue import Queue
+from threading import Thread
+from time import perf_counter
+
+from values import values, Channel
+
+
+MESSAGES = 200000
+CAPACITY = 1024
+BATCH = 64
+
+
+def single(chan, producers, consumers):
+    share = MESSAGES // producers
+
+    def produce():
+        v = values(1, name="msg")
+        put = chan.put
+        for _ in range(share):
+            put(v)
+
+    def consume():
+        get = chan.get
+        while get() is not None:
+            pass
+
+    return produce, consume
+
+
+def batched(chan, producers, consumers):
+    share = MESSAGES // producers
+
+    def produce():
+        batch = [values(1, name="msg")] * BATCH
+        put_many = chan.put_many
+        for _ in range(share // BATCH):
+            put_many(batch)
+
+    def consume():
+        get_many = chan.get_many
+        while True:
+            got = get_many(BATCH)
+            if got[-1] is None:
+                # leave any other sentinels for the other consumers
+                chan.put_many(got[got.index(None) + 1:])
+                return
+
+    return produce, consume
+
+
+def run(make, workers, chan):
+    producers, consumers = workers
+    produce, consume = make(chan, producers, consumers)
+
+    pthreads = [Thread(target=produce) for _ in range(producers)]
+    cthreads = [Thread(target=consume) for _ in range(consumers)]
+
+    start = perf_counter()
+    for t in pthreads + cthreads:
+        t.start()
+    for t in pthreads:
+        t.join()
+    for _ in range(consumers):
+        chan.put(None)
+    for t in cthreads:
+        t.join()
+
+    return perf_counter() - start
+
+
+def bench(name, make, workers, factory):
+    best = min(run(make, workers, factory()) for _ in range(3))
+    print("%-26s %ix%i %8.3fs %12.0f msgs/s" %
+          (name, workers[0], workers[1], best, MESSAGES / best))
+    return best
+
+
+def main():
+    for workers in ((1, 1), (2, 2), (4, 4)):
+        base = bench("queue.Queue", single, workers,
+                     lambda: Queue(CAPACITY))
+        fast = bench("Channel put/get", single, workers,
+                     lambda: Channel(CAPACITY))
+        many = bench("Channel put_many/get_many", batched, workers,
+                     lambda: Channel(CAPACITY))
+        print("speedup %.2fx single, %.2fx batched" %
+              (base / fast, base / many))
+        print()
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
@@ -0,0 +1,86 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+CSV ingest throughput, values.csv_reader against the csv.DictReader
+path it replaces (a dict per row, then copied into a values)
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+import csv
+
+from io import StringIO
+from time import perf_counter
+
+from values import values, csv_reader
+
+
+ROWS = 200000
+
+
+def sample():
+    out = StringIO()
+    out.write("host,status,bytes,latency,path\n")
+    for i in range(ROWS):
+        out.write("host%i.example.com,%i,%i,%f,\"/index,%i.html\"\n" %
+                  (i % 40, (200, 404, 500)[i % 3], i * 13, i / 7.0, i))
+    return out.getvalue()
+
+
+def dictreader(text):
+    for row in csv.DictReader(StringIO(text)):
+        row["status"] = int(row["status"])
+        row["bytes"] = int(row["bytes"])
+        row["latency"] = float(row["latency"])
+        yield values(**row)
+
+
+def native(text):
+    types = {"status": int, "bytes": int, "latency": float}
+    return csv_reader(StringIO(text), types=types)
+
+
+def bench(name, reader, text):
+    best = None
+    for _ in range(3):
+        start = perf_counter()
+        for _row in reader(text):
+            pass
+        took = perf_counter() - start
+        best = took if best is None else min(best, took)
+
+    print("%-20s %8.3fs %12.0f rows/s %8.1f MB/s" %
+          (name, best, ROWS / best, len(text) / best / 1e6))
+    return best
+
+
+def main():
+    text = sample()
+    base = bench("csv.DictReader", dictreader, text)
+    fast = bench("values.csv_reader", native, text)
+    print("speedup %.2fx" % (base / fast))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
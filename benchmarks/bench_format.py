@@ -0,0 +1,90 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The cost of rendering values as text. Repeated reprs of the same
+records with and without repr_cache, and a log line template applied
+through str.format against a compiled values.formatter.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from time import perf_counter
+
+from values import values, formatter, repr_cache
+
+
+RECORDS = 100000
+ROUNDS = 5
+
+
+def bench(name, apply, recs):
+    best = None
+    for _ in range(5):
+        start = perf_counter()
+        for v in recs:
+            apply(v)
+        took = perf_counter() - start
+        best = took if best is None else min(best, took)
+
+    print("%-28s %8.3fs %8.0f ns/call" %
+          (name, best, best / len(recs) * 1e9))
+    return best
+
+
+def records():
+    return [values(i, "GET", path="/item/%i" % (i % 1000),
+                   status=200, bytes=i * 7 % 65536, took=i / 7.0)
+            for i in range(RECORDS)]
+
+
+def main():
+    # each record is rendered several times, as a log or cache key
+    # might be
+    recs = records() * ROUNDS
+
+    repr_cache(0)
+    base = bench("repr", repr, recs)
+
+    repr_cache(256)
+    recs = records() * ROUNDS
+    cached = bench("repr, cached", repr, recs)
+    repr_cache(0)
+
+    print("speedup %.2fx" % (base / cached))
+
+    template = "{0:>6} {1} {path} {status} {bytes:>5} {took:.3f}"
+    fmt = formatter(template)
+    recs = records()
+
+    def splat(v):
+        return v(template.format)
+
+    base = bench("str.format via call", splat, recs)
+    comp = bench("formatter", fmt, recs)
+
+    print("speedup %.2fx" % (base / comp))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
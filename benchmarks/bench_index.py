@@ -0,0 +1,105 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The cost of looking records up by a pair of their fields, through a
+dict of tuple keys to lists of records against values.Index. Reports
+the time to build each, the time per lookup, and the memory each
+holds beyond the records themselves.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from time import perf_counter
+from tracemalloc import get_traced_memory, start, stop
+
+from values import values, Index
+
+
+RECORDS = 200000
+
+
+def timed(func):
+    best = None
+    for _ in range(5):
+        start_at = perf_counter()
+        func()
+        took = perf_counter() - start_at
+        best = took if best is None else min(best, took)
+    return best
+
+
+def held(build):
+    start()
+    before = get_traced_memory()[0]
+    built = build()
+    after = get_traced_memory()[0]
+    stop()
+
+    del built
+    return after - before
+
+
+def records():
+    return [values(i, host="host%i" % (i % 5000), port=8000 + (i % 7),
+                   ok=bool(i % 3))
+            for i in range(RECORDS)]
+
+
+def main():
+    recs = records()
+    keys = [(rec["host"], rec["port"]) for rec in recs]
+
+    def build_dict():
+        groups = {}
+        for rec in recs:
+            groups.setdefault((rec["host"], rec["port"]), []).append(rec)
+        return groups
+
+    def build_index():
+        return Index(recs, on=("host", "port"))
+
+    groups = build_dict()
+    idx = build_index()
+
+    def get_dict():
+        for key in keys:
+            groups[key][0]
+
+    def get_index():
+        get = idx.get
+        for key in keys:
+            get(key)
+
+    for name, build, get in (("dict of tuples", build_dict, get_dict),
+                             ("Index", build_index, get_index)):
+
+        took = timed(build)
+        looked = timed(get)
+        print("%-16s build %6.3fs  get %4.0f ns  %6.1f MB held" %
+              (name, took, looked / len(keys) * 1e9,
+               held(build) / 1e6))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
@@ -0,0 +1,88 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The cost of enriching a stream of records with another by a common
+field, as a dict built in Python and merged with +, against
+values.join. Each hit is joined to its host, and then to its host and
+port by a composite key.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from time import perf_counter
+
+from values import values, join
+
+
+HITS = 200000
+HOSTS = 5000
+
+
+def timed(name, func):
+    best = None
+    for _ in range(5):
+        start = perf_counter()
+        func()
+        took = perf_counter() - start
+        best = took if best is None else min(best, took)
+
+    print("%-28s %8.3fs %8.0f ns/record" % (name, best, best / HITS * 1e9))
+    return best
+
+
+def python_join(left, right, on):
+    if len(on) == 1:
+        field, = on
+        table = {}
+        for rec in right:
+            table.setdefault(rec[field], []).append(rec)
+        return [rec + match for rec in left
+                for match in table.get(rec[field], ())]
+
+    table = {}
+    for rec in right:
+        table.setdefault(tuple(rec[f] for f in on), []).append(rec)
+    return [rec + match for rec in left
+            for match in table.get(tuple(rec[f] for f in on), ())]
+
+
+def main():
+    hits = [values(i, host="host%i" % (i % HOSTS), port=8000 + (i % 3),
+                   status=200, took=i / 7.0)
+            for i in range(HITS)]
+    hosts = [values(host="host%i" % i, port=8000 + p, dc="dc%i" % (i % 4))
+             for i in range(HOSTS) for p in range(3)]
+
+    for on in (("host", ), ("host", "port")):
+        assert python_join(hits, hosts, on) == join(hits, hosts, on)
+
+        name = ", ".join(on)
+        base = timed(name + ", dict and +",
+                     lambda: python_join(hits, hosts, on))
+        comp = timed(name + ", join", lambda: join(hits, hosts, on))
+        print("speedup %.2fx" % (base / comp))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
@@ -0,0 +1,90 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The cost of chaining transformations over values, as a lambda around
+the values call against a values.pipe of the same stages. A chain of
+trivial stages shows the overhead per stage alone.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from time import perf_counter
+
+from values import values, pipe
+
+
+CALLS = 500000
+
+
+def parse(host, port="80"):
+    return values(host, port=int(port))
+
+
+def url(host, port):
+    return "http://%s:%i/" % (host, port)
+
+
+def bench(name, apply, recs):
+    best = None
+    for _ in range(5):
+        start = perf_counter()
+        for v in recs:
+            apply(v)
+        took = perf_counter() - start
+        best = took if best is None else min(best, took)
+
+    print("%-24s %8.3fs %8.0f ns/call" % (name, best, best / CALLS * 1e9))
+    return best
+
+
+def main():
+    recs = [values("host%i.example.com" % (i % 100), port=str(i % 9000))
+            for i in range(CALLS)]
+
+    def chained(*a, **k):
+        return len(parse(*a, **k)(url))
+
+    composed = pipe(parse, url, len)
+
+    base = bench("lambda around values", lambda v: v(chained), recs)
+    fast = bench("values(pipe)", lambda v: v(composed), recs)
+    direct = bench("pipe(values)", composed, recs)
+
+    print("speedup %.2fx through the values, %.2fx direct" %
+          (base / fast, base / direct))
+
+    def trivial(*a, **k):
+        return abs(abs(abs(abs(a[0]))))
+
+    small = [values(i) for i in range(CALLS)]
+    stages = pipe(abs, abs, abs, abs)
+
+    base = bench("lambda, 4 trivial stages", lambda v: v(trivial), small)
+    direct = bench("pipe, 4 trivial stages", stages, small)
+
+    print("speedup %.2fx" % (base / direct))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
@@ -0,0 +1,95 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The overhead values.profile adds to each call, measured around a
+builtin which does next to nothing, both called directly and
+dispatched through a values. A Python wrapper timing the same calls
+is shown for comparison.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from functools import wraps
+from time import perf_counter, perf_counter_ns
+
+from values import values, profile
+
+
+CALLS = 1000000
+
+
+def bench(name, apply, recs):
+    best = None
+    for _ in range(5):
+        start = perf_counter()
+        for v in recs:
+            apply(v)
+        took = perf_counter() - start
+        best = took if best is None else min(best, took)
+
+    print("%-28s %8.3fs %8.1f ns/call" % (name, best, best / CALLS * 1e9))
+    return best
+
+
+def timed(func):
+    times = []
+
+    @wraps(func)
+    def wrapper(*args, **kwds):
+        start = perf_counter_ns()
+        try:
+            return func(*args, **kwds)
+        finally:
+            times.append(perf_counter_ns() - start)
+
+    return wrapper
+
+
+def main():
+    nums = list(range(CALLS))
+    recs = [values(i) for i in nums]
+
+    prof = profile(abs)
+    wrapped = timed(abs)
+
+    base = bench("abs", abs, nums)
+    native = bench("profile(abs)", prof, nums)
+    python = bench("python wrapper", wrapped, nums)
+
+    print("overhead %.1f ns/call native, %.1f ns/call python" %
+          ((native - base) / CALLS * 1e9, (python - base) / CALLS * 1e9))
+
+    base = bench("values(abs)", lambda v: v(abs), recs)
+    native = bench("values(profile(abs))", lambda v: v(prof), recs)
+
+    print("overhead %.1f ns/call through a values" %
+          ((native - base) / CALLS * 1e9))
+
+    snap = prof.snapshot()
+    print("recorded %i calls, p50 %ins p99 %ins max %ins" %
+          (snap["count"], snap["p50"], snap["p99"], snap["max"]))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
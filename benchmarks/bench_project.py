@@ -0,0 +1,87 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The cost of reshaping records. Picking, dropping and renaming
+keywords over many same-shaped records, by rebuilding each through a
+dict comprehension against select, without and rename.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from time import perf_counter
+
+from values import values
+
+
+RECORDS = 200000
+
+
+def bench(name, apply, recs):
+    best = None
+    for _ in range(5):
+        start = perf_counter()
+        for v in recs:
+            apply(v)
+        took = perf_counter() - start
+        best = took if best is None else min(best, took)
+
+    print("%-28s %8.3fs %8.0f ns/call" %
+          (name, best, best / len(recs) * 1e9))
+    return best
+
+
+def records():
+    return [values(i, host="host%i" % (i % 50), port=8000 + (i % 7),
+                   ok=bool(i % 3), took=i / 3.0, path="/item")
+            for i in range(RECORDS)]
+
+
+def main():
+    recs = records()
+
+    def rebuild_select(v):
+        return values(*v, **{k: v[k] for k in ("host", "port")})
+
+    def rebuild_without(v):
+        return values(*v, **{k: v[k] for k in v.keys()
+                             if k not in ("took", "path")})
+
+    def rebuild_rename(v):
+        return values(*v, **{("addr" if k == "host" else k): v[k]
+                             for k in v.keys()})
+
+    pairs = (
+        ("select", rebuild_select, lambda v: v.select("host", "port")),
+        ("without", rebuild_without, lambda v: v.without("took", "path")),
+        ("rename", rebuild_rename, lambda v: v.rename(host="addr")),
+    )
+
+    for name, rebuild, native in pairs:
+        base = bench(name + ", rebuilt", rebuild, recs)
+        comp = bench(name, native, recs)
+        print("speedup %.2fx" % (base / comp))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
@@ -0,0 +1,112 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The cost per record of handing values between interpreters. A pickle
+round trip of their parts is what crossing an interpreter boundary
+costs without registration; the canonical flat copy is what replaces
+it. On 3.11, where values are registered with the subinterpreter
+channels, the cost of a send and receive is measured as well.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+import pickle
+
+from time import perf_counter
+
+from values import values, from_canonical
+
+
+RECORDS = 100000
+
+
+def sample():
+    return [values(i, "host%i.example.com" % (i % 40),
+                   status=(200, 404, 500)[i % 3], bytes=i * 13,
+                   latency=i / 7.0, path="/index/%i.html" % i)
+            for i in range(RECORDS)]
+
+
+def pickled(recs):
+    # values don't pickle themselves, so this is the manual route of
+    # pickling the parts and building a new values on the other side
+    for v in recs:
+        data = pickle.dumps((tuple(v), dict(v)), pickle.HIGHEST_PROTOCOL)
+        args, kwds = pickle.loads(data)
+        values(*args, **kwds)
+
+
+def flat(recs):
+    for v in recs:
+        from_canonical(v.canonical_bytes())
+
+
+def channel(recs):
+    import _xxsubinterpreters as interpreters
+
+    chan = interpreters.channel_create()
+    send = interpreters.channel_send
+    recv = interpreters.channel_recv
+
+    try:
+        for v in recs:
+            send(chan, v)
+            recv(chan)
+    finally:
+        interpreters.channel_destroy(chan)
+
+
+def bench(name, transfer, recs):
+    best = None
+    for _ in range(3):
+        start = perf_counter()
+        transfer(recs)
+        took = perf_counter() - start
+        best = took if best is None else min(best, took)
+
+    print("%-24s %8.3fs %10.0f ns/record" %
+          (name, best, best / RECORDS * 1e9))
+    return best
+
+
+def main():
+    recs = sample()
+    print("%i bytes per record, canonically encoded" %
+          len(recs[0].canonical_bytes()))
+
+    base = bench("pickle round trip", pickled, recs)
+    fast = bench("canonical flat copy", flat, recs)
+    print("speedup %.2fx" % (base / fast))
+
+    try:
+        import _xxsubinterpreters as interpreters
+    except ImportError:
+        return
+
+    if interpreters.is_shareable(recs[0]):
+        bench("channel send and recv", channel, recs)
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
@@ -0,0 +1,83 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The cost of sorting records by their fields, through sorted with an
+itemgetter key against values.sort_by. Sorts by an int field, by a
+float field, by two int fields, and by a str and an int field.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from operator import itemgetter
+from random import Random
+from time import perf_counter
+
+from values import values, sort_by
+
+
+RECORDS = 200000
+
+
+def bench(name, sort, recs):
+    best = None
+    for _ in range(5):
+        start = perf_counter()
+        sort(recs)
+        took = perf_counter() - start
+        best = took if best is None else min(best, took)
+
+    print("%-28s %8.3fs %8.0f ns/record" %
+          (name, best, best / len(recs) * 1e9))
+    return best
+
+
+def records():
+    rand = Random(0)
+    return [values(i, host="host%i" % rand.randrange(50),
+                   port=8000 + rand.randrange(7),
+                   status=rand.choice((200, 200, 200, 404, 500)),
+                   took=rand.random())
+            for i in range(RECORDS)]
+
+
+def main():
+    recs = records()
+
+    for keys in (("port", ), ("took", ), ("port", "status"),
+                 ("host", "status")):
+
+        name = ", ".join(keys)
+        getter = itemgetter(*keys)
+
+        assert sorted(recs, key=getter) == sort_by(recs, *keys)
+
+        base = bench(name + ", itemgetter",
+                     lambda r: sorted(r, key=getter), recs)
+        comp = bench(name + ", sort_by",
+                     lambda r: sort_by(r, *keys), recs)
+        print("speedup %.2fx" % (base / comp))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
@@ -0,0 +1,77 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+Compares the native values type against a __slots__ subclass of it,
+over construction, addition, equality, invocation and hashing. The
+subclass should lose nothing in the operations themselves. Anything
+that creates a new instance (construct, add) still pays for CPython's
+heap type allocation and subtype_dealloc, which we cannot avoid.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from timeit import repeat
+
+from values import values
+
+
+class Record(values):
+    __slots__ = ()
+
+
+def gather(*args, **kwds):
+    return args
+
+
+CASES = (
+    ("construct", "V(1, 2, 3, foo=4, bar=5)"),
+    ("add", "a + b"),
+    ("eq", "a == c"),
+    ("call", "a(gather)"),
+    ("hash", "hash(V(1, 2, 3, foo=4, bar=5))"),
+)
+
+
+def bench(kind, stmt, number=200000):
+    env = {
+        "V": kind,
+        "a": kind(1, 2, 3, foo=4, bar=5),
+        "b": kind(6, baz=7),
+        "c": kind(1, 2, 3, foo=4, bar=5),
+        "gather": gather,
+    }
+    best = min(repeat(stmt, globals=env, number=number, repeat=5))
+    return best / number * 1e9
+
+
+def main():
+    print("%-10s %12s %12s %8s" % ("op", "values ns", "subclass ns", "ratio"))
+    for name, stmt in CASES:
+        base = bench(values, stmt)
+        sub = bench(Record, stmt)
+        print("%-10s %12.1f %12.1f %8.2f" % (name, base, sub, sub / base))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
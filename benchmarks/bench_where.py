@@ -0,0 +1,89 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The cost of filtering and counting records by three of their fields,
+through a list comprehension against values.where. Reports the best
+time per record for each, over a collection small enough to stay in
+cache and over one that isn't.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from time import perf_counter
+
+from values import values, where
+
+
+SIZES = (2000, 200000)
+
+
+def timed(func):
+    best = None
+    for _ in range(5):
+        start_at = perf_counter()
+        func()
+        took = perf_counter() - start_at
+        best = took if best is None else min(best, took)
+    return best
+
+
+def records(count):
+    return [values(i, host="host%i" % (i % 50), port=8000 + (i % 7),
+                   took=(i % 1000) / 10.0)
+            for i in range(count)]
+
+
+def compare(recs):
+    pred = where(port=8003, took__lt=50.0, host__in=("host1", "host2"))
+
+    def comp_filter():
+        return [rec for rec in recs
+                if rec["port"] == 8003 and rec["took"] < 50.0
+                and rec["host"] in ("host1", "host2")]
+
+    def comp_count():
+        return sum(1 for rec in recs
+                   if rec["port"] == 8003 and rec["took"] < 50.0
+                   and rec["host"] in ("host1", "host2"))
+
+    assert comp_filter() == pred.filter(recs)
+    assert comp_count() == pred.count(recs)
+
+    for name, func in (("comprehension", comp_filter),
+                       ("where.filter", lambda: pred.filter(recs)),
+                       ("generator sum", comp_count),
+                       ("where.count", lambda: pred.count(recs))):
+
+        print("%-16s %6.1f ns/record" %
+              (name, timed(func) / len(recs) * 1e9))
+
+
+def main():
+    for count in SIZES:
+        print("%i records" % count)
+        compare(records(count))
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
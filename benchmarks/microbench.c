@@ -0,0 +1,444 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   microbench
+
+   Times the hot paths of the native values type in tight C loops,
+   without the interpreter's dispatch between each operation, so that
+   changes to values_hash or values_call aren't lost in the noise of
+   a Python-level benchmark.
+
+   The interpreter is embedded, and values._values imported from the
+   current directory (so build_ext --inplace first), then sib_values
+   is found in the loaded extension. Each operation is repeated in a
+   loop several times over, and the best pass is reported as
+   nanoseconds per operation, time stamp counter ticks per operation
+   where there is one, and CPU cycles and instructions per operation
+   where perf counters can be opened. The collector is disabled while
+   timing, so that it is the values code being measured.
+
+   Build it with: python3 setup.py build_microbench
+   Then run: ./build/microbench [iterations]
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include <Python.h>
+#include "py3-values.h"
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define HAVE_PERF 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+
+#define PASSES 5
+
+
+typedef PyObject *(*sib_values_fn)(PyObject *args, PyObject *kwds);
+
+
+typedef struct timing {
+  uint64_t ns;
+  uint64_t tsc;
+  uint64_t cycles;
+  uint64_t instructions;
+} timing;
+
+
+static int perf_cycles = -1;
+static int perf_instructions = -1;
+
+static sib_values_fn make_values = NULL;
+static PyObject *values_type = NULL;
+
+
+/* === clocks and counters === */
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static uint64_t now_tsc(void) {
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+
+#ifdef HAVE_PERF
+static int perf_open(uint64_t config) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+
+static void perf_init(void) {
+#ifdef HAVE_PERF
+  perf_cycles = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+  perf_instructions = perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+#endif
+}
+
+
+static void perf_start(int fd) {
+#ifdef HAVE_PERF
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+}
+
+
+static uint64_t perf_stop(int fd) {
+  uint64_t count = 0;
+
+#ifdef HAVE_PERF
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+      count = 0;
+  }
+#endif
+
+  return count;
+}
+
+
+static void timing_start(timing *t) {
+  perf_start(perf_cycles);
+  perf_start(perf_instructions);
+  t->tsc = now_tsc();
+  t->ns = now_ns();
+}
+
+
+static void timing_stop(timing *t) {
+  t->ns = now_ns() - t->ns;
+  t->tsc = now_tsc() - t->tsc;
+  t->cycles = perf_stop(perf_cycles);
+  t->instructions = perf_stop(perf_instructions);
+}
+
+
+/* === the operations === */
+
+
+static PyObject *args_12 = NULL;
+static PyObject *kwds_ab = NULL;
+static PyObject *noop = NULL;
+static PyObject **objs = NULL;
+
+
+static PyObject *new_values(void) {
+  if (make_values)
+    return make_values(args_12, kwds_ab);
+  else
+    return PyObject_Call(values_type, args_12, kwds_ab);
+}
+
+
+static PyObject *noop_call(PyObject *self, PyObject *args, PyObject *kwds) {
+  Py_RETURN_NONE;
+}
+
+
+static PyMethodDef noop_def = {
+  "noop", (PyCFunction) noop_call, METH_VARARGS|METH_KEYWORDS, NULL,
+};
+
+
+static void op_construct(timing *t, Py_ssize_t n) {
+  Py_ssize_t i;
+
+  timing_start(t);
+  for (i = 0; i < n; i++)
+    objs[i] = new_values();
+  timing_stop(t);
+
+  for (i = 0; i < n; i++)
+    Py_DECREF(objs[i]);
+}
+
+
+static void op_dealloc(timing *t, Py_ssize_t n) {
+  Py_ssize_t i;
+
+  for (i = 0; i < n; i++)
+    objs[i] = new_values();
+
+  timing_start(t);
+  for (i = 0; i < n; i++)
+    Py_DECREF(objs[i]);
+  timing_stop(t);
+}
+
+
+static void op_hash(timing *t, Py_ssize_t n) {
+  PyObject *v = new_values();
+  Py_ssize_t i;
+
+  timing_start(t);
+  for (i = 0; i < n; i++) {
+    // forget the cached hash, so that it is computed every time
+    ((PyValues *) v)->hashed = 0;
+    if (PyObject_Hash(v) == -1)
+      PyErr_Clear();
+  }
+  timing_stop(t);
+
+  Py_DECREF(v);
+}
+
+
+static void op_hash_cached(timing *t, Py_ssize_t n) {
+  PyObject *v = new_values();
+  Py_ssize_t i;
+
+  PyObject_Hash(v);
+
+  timing_start(t);
+  for (i = 0; i < n; i++)
+    PyObject_Hash(v);
+  timing_stop(t);
+
+  Py_DECREF(v);
+}
+
+
+static void op_eq(timing *t, Py_ssize_t n) {
+  PyObject *a = new_values();
+  PyObject *b = new_values();
+  Py_ssize_t i;
+
+  timing_start(t);
+  for (i = 0; i < n; i++)
+    PyObject_RichCompareBool(a, b, Py_EQ);
+  timing_stop(t);
+
+  Py_DECREF(a);
+  Py_DECREF(b);
+}
+
+
+static void op_call(timing *t, Py_ssize_t n) {
+  PyObject *v = new_values();
+  PyObject *result;
+  Py_ssize_t i;
+
+  timing_start(t);
+  for (i = 0; i < n; i++) {
+    result = PyObject_CallOneArg(v, noop);
+    Py_XDECREF(result);
+  }
+  timing_stop(t);
+
+  Py_DECREF(v);
+}
+
+
+static void op_add(timing *t, Py_ssize_t n) {
+  PyObject *a = new_values();
+  PyObject *b = new_values();
+  PyObject *result;
+  Py_ssize_t i;
+
+  timing_start(t);
+  for (i = 0; i < n; i++) {
+    result = PyNumber_Add(a, b);
+    Py_XDECREF(result);
+  }
+  timing_stop(t);
+
+  Py_DECREF(a);
+  Py_DECREF(b);
+}
+
+
+typedef struct bench {
+  const char *name;
+  void (*run)(timing *t, Py_ssize_t n);
+} bench;
+
+
+static bench benches[] = {
+  { "construct", op_construct },
+  { "dealloc", op_dealloc },
+  { "hash", op_hash },
+  { "hash (cached)", op_hash_cached },
+  { "eq", op_eq },
+  { "call", op_call },
+  { "add (and dealloc)", op_add },
+  { NULL, NULL },
+};
+
+
+/* === driver === */
+
+
+static int setup_values(void) {
+  PyObject *mod, *file;
+  const char *path;
+  void *handle;
+
+  PyRun_SimpleString("import sys; sys.path.insert(0, '')");
+
+  mod = PyImport_ImportModule("values._values");
+  if (! mod)
+    return -1;
+
+  values_type = PyObject_GetAttrString(mod, "cvalues");
+  file = PyObject_GetAttrString(mod, "__file__");
+  Py_DECREF(mod);
+
+  if (! (values_type && file))
+    return -1;
+
+  // the extension is already loaded, we only want its symbols
+  path = PyUnicode_AsUTF8(file);
+  handle = path? dlopen(path, RTLD_NOW | RTLD_NOLOAD): NULL;
+  if (handle)
+    make_values = (sib_values_fn) dlsym(handle, "sib_values");
+  Py_DECREF(file);
+
+  if (! make_values)
+    fprintf(stderr, "sib_values not found, constructing via the type\n");
+
+  args_12 = Py_BuildValue("(ii)", 1, 2);
+  kwds_ab = Py_BuildValue("{sisi}", "a", 3, "b", 4);
+  noop = PyCFunction_New(&noop_def, NULL);
+
+  return (args_12 && kwds_ab && noop)? 0: -1;
+}
+
+
+int main(int argc, char **argv) {
+  Py_ssize_t n = 200000;
+  timing best, pass;
+  bench *b;
+  int i;
+
+  if (argc > 1)
+    n = (Py_ssize_t) strtol(argv[1], NULL, 10);
+  if (n < 1) {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return 2;
+  }
+
+  Py_Initialize();
+
+  if (setup_values()) {
+    PyErr_Print();
+    return 1;
+  }
+
+  objs = calloc(n, sizeof(PyObject *));
+  if (! objs) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  perf_init();
+  PyGC_Disable();
+
+  printf("%-20s %10s %10s %10s %10s\n", "operation", "ns/op",
+#ifdef HAVE_TSC
+	 "tsc/op",
+#else
+	 "-",
+#endif
+	 perf_cycles >= 0? "cycles/op": "-",
+	 perf_instructions >= 0? "insns/op": "-");
+
+  for (b = benches; b->name; b++) {
+    memset(&best, 0, sizeof(best));
+
+    for (i = 0; i < PASSES; i++) {
+      b->run(&pass, n);
+      if (! i || pass.ns < best.ns)
+	best = pass;
+    }
+
+    printf("%-20s %10.1f", b->name, (double) best.ns / n);
+
+#ifdef HAVE_TSC
+    printf(" %10.1f", (double) best.tsc / n);
+#else
+    printf(" %10s", "-");
+#endif
+
+    if (perf_cycles >= 0)
+      printf(" %10.1f", (double) best.cycles / n);
+    else
+      printf(" %10s", "-");
+
+    if (perf_instructions >= 0)
+      printf(" %10.1f", (double) best.instructions / n);
+    else
+      printf(" %10s", "-");
+
+    printf("\n");
+  }
+
+  PyGC_Enable();
+  free(objs);
+
+  Py_DECREF(args_12);
+  Py_DECREF(kwds_ab);
+  Py_DECREF(noop);
+  Py_DECREF(values_type);
+
+  return Py_FinalizeEx() < 0? 1: 0;
+}
+
+
+/* The end. */
@@ -0,0 +1,142 @@
+#! /usr/bin/env python3
+
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+The workload an instrumented build is trained on by build_pgo.
+
+It should look like real use of values, weighted the way real use is.
+So it is mostly construction, calls, hashing, equality and addition
+of small records, with positional, keyword and mixed shapes, plus
+lighter use of the kernels and encoders. The rarer paths (errors,
+lazy fields, subclasses) get a little traffic so that the optimizer
+knows they are cold, rather than having no profile for them at all.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+from io import StringIO
+
+from values import values, partition, groupby, aggregate, csv_reader, \
+    from_canonical, pipe, formatter
+
+
+ROUNDS = 200
+RECORDS = 1000
+
+
+class Record(values):
+    __slots__ = ()
+
+
+def gather(*args, **kwds):
+    return len(args) + len(kwds)
+
+
+def records():
+    return [values(i, "host%i" % (i % 50), port=8000 + (i % 7),
+                   ok=bool(i % 3), took=i / 3.0)
+            for i in range(RECORDS)]
+
+
+def core(recs):
+    # the hot paths: construction, call, hash, eq and add
+    seen = set()
+    total = 0
+
+    for rec in recs:
+        pos = values(rec[0], rec[1])
+        kwd = values(port=rec["port"], ok=rec["ok"])
+        mixed = pos + kwd
+
+        total += mixed(gather)
+        total += rec(gather, 1, extra=2)
+
+        seen.add(mixed)
+        seen.add(values(rec[0], rec[1], port=rec["port"], ok=rec["ok"]))
+
+        if mixed == rec or mixed != kwd:
+            total += 1
+
+        total += hash(rec) & 1
+        total += len(rec.keys())
+        total += bool(values())
+
+    return total, len(seen)
+
+
+def kernels(recs):
+    partition(recs, 8, key=lambda r: r["port"])
+    groupby(recs, "port", "ok")
+    aggregate(recs, by=("port", ), sum=("took", ), max=("took", ))
+
+    for rec in recs[:100]:
+        from_canonical(rec.canonical_bytes())
+        rec.stable_hash()
+        repr(rec)
+
+    text = "a,b,c\n" + "".join("%i,x%i,%f\n" % (i, i, i / 2.0)
+                                for i in range(200))
+    list(csv_reader(StringIO(text), types={"a": int, "c": float}))
+
+    p = pipe(values, gather)
+    f = formatter("{0} {1} {port}")
+    for rec in recs[:200]:
+        p(rec)
+        f(rec)
+
+
+def cold():
+    # a taste of the rarer paths, so they're known to be rare
+    for i in range(50):
+        lazy = values.lazy(i, x=lambda: 1)
+        lazy["x"]
+        hash(lazy)
+
+        sub = Record(i, y=i)
+        sub + values(1)
+        sub == values(i, y=i)
+
+        try:
+            values(1)(None)
+        except TypeError:
+            pass
+
+        try:
+            hash(values([]))
+        except TypeError:
+            pass
+
+
+def main():
+    recs = records()
+    for _ in range(ROUNDS):
+        core(recs)
+
+    for _ in range(ROUNDS // 20):
+        kernels(recs)
+
+    cold()
+
+
+if __name__ == "__main__":
+    main()
+
+
+#
+# The end.
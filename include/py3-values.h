@@ -28,19 +28,28 @@ typedef struct PyValues {
   PyObject *kwds;
   PyObject *weakrefs;
   Py_uhash_t hashed;
+
+  /* non-zero while any keyword may still be an unforced lazy field */
+  int lazy;
+
+  /* the repr, when it has been cached. See repr_cache */
+  PyObject *repr;
 } PyValues;
 
-PyTypeObject PyValuesType;
+extern PyTypeObject PyValuesType;
 
 
 PyObject *sib_values(PyObject *args, PyObject *kwds);
 
 
-#define PyValues_Check(obj)					\
-  ((obj) && PyType_IsSubtype((obj)->ob_type, &PyValuesType))
-
 #define PyValues_CheckExact(obj)			\
-  ((obj) && ((obj)->ob_type == &PyValuesType))
+  ((obj) && (Py_TYPE(obj) == &PyValuesType))
+
+/* the exact check is tried first so that the base type never pays
+   for the subtype walk */
+#define PyValues_Check(obj)					\
+  ((obj) && ((Py_TYPE(obj) == &PyValuesType) ||			\
+	     PyType_IsSubtype(Py_TYPE(obj), &PyValuesType)))
 
 
 #endif
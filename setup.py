@@ -24,7 +24,13 @@ license: LGPL v.3
 """
 
 
-from setuptools import setup, Extension
+import os
+import shutil
+import subprocess
+import sys
+import sysconfig
+
+from setuptools import setup, Command, Extension
 
 
 TROVE_CLASSIFIERS = (
@@ -43,12 +49,157 @@ TROVE_CLASSIFIERS = (
 
 ext_values = Extension(
     name = "values._values",
-    sources = ["values/_values.c"],
+    sources = [
+        "values/_values.c",
+        "values/_canonical.c",
+        "values/_kernels.c",
+        "values/_csv.c",
+        "values/_shmemo.c",
+        "values/_channel.c",
+        "values/_pipe.c",
+        "values/_lazy.c",
+        "values/_format.c",
+        "values/_profile.c",
+        "values/_shapes.c",
+        "values/_memory.c",
+        "values/_index.c",
+        "values/_where.c",
+    ],
     include_dirs = ["include"],
+    libraries = ["rt"] if sys.platform.startswith("linux") else [],
     extra_compile_args=["--std=c99"],
 )
 
 
+class build_microbench(Command):
+    """
+    Builds benchmarks/microbench.c, the C driver timing the native
+    values hot paths under an embedded interpreter
+    """
+
+    description = "build the native microbenchmark driver"
+
+    user_options = [
+        ("build-dir=", "b",
+         "directory to write the microbench executable into"
+         " [default: build]"),
+    ]
+
+
+    def initialize_options(self):
+        self.build_dir = None
+
+
+    def finalize_options(self):
+        if self.build_dir is None:
+            self.build_dir = "build"
+
+
+    def run(self):
+        from distutils.ccompiler import new_compiler
+        from distutils.sysconfig import customize_compiler
+
+        def config(name):
+            return sysconfig.get_config_var(name) or ""
+
+        compiler = new_compiler(verbose=self.verbose, dry_run=self.dry_run)
+        customize_compiler(compiler)
+
+        objects = compiler.compile(
+            ["benchmarks/microbench.c"],
+            output_dir=os.path.join(self.build_dir, "microbench.tmp"),
+            include_dirs=[sysconfig.get_paths()["include"], "include"],
+            extra_preargs=["--std=c99"])
+
+        libdirs = [config("LIBDIR"), config("LIBPL")]
+        shared = bool(config("Py_ENABLE_SHARED"))
+
+        compiler.link_executable(
+            objects, "microbench",
+            output_dir=self.build_dir,
+            libraries=["python" + config("VERSION") + config("ABIFLAGS")],
+            library_dirs=libdirs,
+            runtime_library_dirs=libdirs[:1] if shared else [],
+            extra_postargs=(config("LIBS").split() +
+                            config("SYSLIBS").split() +
+                            config("LINKFORSHARED").split() + ["-ldl"]))
+
+
+class build_pgo(Command):
+    """
+    Builds the extension in place with profile-guided optimization.
+    First an instrumented build, then a run of the training workload
+    under it, then a rebuild optimized by the recorded profile, with
+    link-time optimization. Works with GCC, and with clang given
+    llvm-profdata
+    """
+
+    description = "build the extension in place with PGO and LTO"
+
+    user_options = [
+        ("training=", "t",
+         "workload script to train the profile on"
+         " [default: benchmarks/pgo_training.py]"),
+        ("no-lto", None, "skip link-time optimization"),
+    ]
+
+    boolean_options = ["no-lto"]
+
+
+    def initialize_options(self):
+        self.training = None
+        self.no_lto = False
+
+
+    def finalize_options(self):
+        if self.training is None:
+            self.training = os.path.join("benchmarks", "pgo_training.py")
+
+
+    def run(self):
+        clang = "clang" in (sysconfig.get_config_var("CC") or "")
+
+        build_temp = self.get_finalized_command("build_ext").build_temp
+        profdir = os.path.abspath(os.path.join(build_temp, "pgo"))
+
+        # stale profiles from an older build would only mislead
+        shutil.rmtree(profdir, ignore_errors=True)
+        os.makedirs(profdir)
+
+        gen = ["-fprofile-generate=" + profdir]
+        self._build_ext(gen, gen)
+
+        env = dict(os.environ)
+        env["PYTHONPATH"] = os.pathsep.join(
+            filter(None, (os.getcwd(), env.get("PYTHONPATH"))))
+        subprocess.check_call([sys.executable, self.training], env=env)
+
+        if clang:
+            profile = os.path.join(profdir, "values.profdata")
+            raw = [os.path.join(profdir, f) for f in os.listdir(profdir)
+                   if f.endswith(".profraw")]
+            subprocess.check_call(["llvm-profdata", "merge",
+                                   "-output=" + profile] + raw)
+            use = ["-fprofile-use=" + profile]
+        else:
+            use = ["-fprofile-use=" + profdir, "-fprofile-correction",
+                   "-Wno-missing-profile"]
+
+        lto = [] if self.no_lto else ["-flto"]
+        self._build_ext(use + lto, lto)
+
+
+    def _build_ext(self, cflags, ldflags):
+        ext_values.extra_compile_args = _base_compile_args + cflags
+        ext_values.extra_link_args = ldflags
+
+        self.reinitialize_command("build_ext", inplace=1, force=1)
+        self.run_command("build_ext")
+
+
+_base_compile_args = list(ext_values.extra_compile_args)
+
+
 setup(
     name = "values",
     version = "0.9.0",
@@ -59,6 +210,11 @@ setup(
 
     test_suite = "tests",
 
+    cmdclass = {
+        "build_microbench": build_microbench,
+        "build_pgo": build_pgo,
+    },
+
     ext_modules = [
         ext_values,
     ],
@@ -21,6 +21,8 @@ license: LGPL v.3
 """
 
 
+import os
+
 from functools import partial
 from unittest import TestCase
 
@@ -442,6 +444,270 @@ class ValuesTestBase():
         self.assertRaises(KeyError, getter, self.values(bar=None))
 
 
+    def test_subclass(self):
+        """
+        Test that values can be subclassed, including with __slots__,
+        and that the subclass survives addition
+        """
+
+        class Record(self.values):
+            __slots__ = ("note", )
+
+        a = Record(1, 2, foo=3)
+        a.note = "hello"
+        self.assertTrue(isinstance(a, self.values))
+        self.assertEqual(a.note, "hello")
+        self.assertRaises(AttributeError, setattr, a, "other", 1)
+
+        b = self.values(1, 2, foo=3)
+        self.assertEqual(a, b)
+        self.assertEqual(b, a)
+        self.assertEqual(hash(a), hash(b))
+        self.assertEqual(a(lambda *x, **k: (x, k)), ((1, 2), {"foo": 3}))
+
+        c = a + self.values(3, bar=4)
+        self.assertEqual(type(c), Record)
+        self.assertEqual(c, self.values(1, 2, 3, foo=3, bar=4))
+
+        d = a + (3, )
+        self.assertEqual(type(d), Record)
+        self.assertEqual(d, (1, 2, 3, ) + self.values(foo=3))
+
+        e = dict(bar=4) + a
+        self.assertEqual(type(e), Record)
+        self.assertEqual(e, self.values(1, 2, foo=3, bar=4))
+
+        f = b + a
+        self.assertEqual(type(f), self.values)
+
+
+    def test_lazy(self):
+        """
+        Lazy keywords are computed once, on first need
+        """
+
+        values = self.values
+        calls = []
+
+        def thunk(name, result):
+            def compute():
+                calls.append(name)
+                return result
+            return compute
+
+        a = values.lazy(1, x=thunk("x", 10), y=thunk("y", 20))
+        self.assertEqual(type(a), values)
+        self.assertEqual(calls, [])
+        self.assertEqual(list(a.keys()), ["x", "y"])
+
+        self.assertEqual(a["x"], 10)
+        self.assertEqual(a["x"], 10)
+        self.assertEqual(calls, ["x"])
+
+        # hashing, equality, repr and calls force whatever is left
+        b = values(1, x=10, y=20)
+        self.assertEqual(a, b)
+        self.assertEqual(hash(a), hash(b))
+        self.assertEqual(repr(a), repr(b))
+        self.assertEqual(calls, ["x", "y"])
+
+        c = values.lazy(z=thunk("z", 30))
+        self.assertEqual(repr(c), "values(z=30)")
+        d = values.lazy(z=thunk("z", 30))
+        self.assertEqual(hash(d), hash(values(z=30)))
+        e = values.lazy(2, z=thunk("z", 30))
+        self.assertEqual(e(lambda n, z: n + z), 32)
+        self.assertEqual(e.stable_hash(), values(2, z=30).stable_hash())
+        self.assertEqual(calls, ["x", "y", "z", "z", "z"])
+
+        # a sum shares the unforced fields, they still run just once
+        del calls[:]
+        f = values.lazy(w=thunk("w", 40))
+        g = f + values(1)
+        self.assertEqual(g, values(1, w=40))
+        self.assertEqual(f["w"], 40)
+        self.assertEqual(calls, ["w"])
+
+        # a failing thunk leaves the field to try again
+        attempts = []
+
+        def flaky():
+            attempts.append(1)
+            if len(attempts) < 2:
+                raise ValueError("not yet")
+            return "ok"
+
+        h = values.lazy(k=flaky)
+        self.assertRaises(ValueError, h.__getitem__, "k")
+        self.assertEqual(h["k"], "ok")
+        self.assertEqual(len(attempts), 2)
+
+        i = values.lazy(k=lambda: i["k"])
+        self.assertRaises(RecursionError, i.__getitem__, "k")
+        self.assertRaises(TypeError, values.lazy, k=5)
+        self.assertEqual(values.lazy(1, 2), values(1, 2))
+
+
+    def test_lazy_threads(self):
+        from threading import Barrier, Thread
+        from time import sleep
+
+        calls = []
+
+        def slow():
+            calls.append(1)
+            sleep(0.05)
+            return "done"
+
+        v = self.values.lazy(k=slow)
+        barrier = Barrier(4)
+        seen = []
+
+        def read():
+            barrier.wait()
+            seen.append(v["k"])
+
+        threads = [Thread(target=read) for _ in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        self.assertEqual(calls, [1])
+        self.assertEqual(seen, ["done"] * 4)
+
+
+    def test_projection(self):
+        """
+        select, without and rename keep the positionals and reshape
+        the keywords
+        """
+
+        values = self.values
+        a = values(1, 2, x=10, y=20, z=30)
+
+        b = a.select("z", "x")
+        self.assertEqual(b, values(1, 2, z=30, x=10))
+        self.assertEqual(list(b.keys()), ["z", "x"])
+        self.assertEqual(a.select(), values(1, 2))
+        self.assertEqual(hash(a.select()), hash(values(1, 2)))
+        self.assertRaises(KeyError, a.select, "x", "nope")
+        self.assertRaises(KeyError, values(1).select, "x")
+
+        # the same KeyError as a["nope"] would raise
+        with self.assertRaises(KeyError) as missing:
+            a["nope"]
+        with self.assertRaises(KeyError) as selected:
+            a.select("x", "nope")
+        with self.assertRaises(KeyError) as renamed:
+            a.rename(nope="x")
+        self.assertEqual(selected.exception.args, missing.exception.args)
+        self.assertEqual(renamed.exception.args, missing.exception.args)
+
+        c = a.without("y", "nope")
+        self.assertEqual(c, values(1, 2, x=10, z=30))
+        self.assertEqual(list(c.keys()), ["x", "z"])
+        self.assertEqual(a.without("x", "y", "z"), values(1, 2))
+        self.assertTrue(a.without() is a)
+        self.assertTrue(values(1).without("x") == values(1))
+
+        d = a.rename(x="ex", z="y2")
+        self.assertEqual(d, values(1, 2, ex=10, y=20, y2=30))
+        self.assertEqual(list(d.keys()), ["ex", "y", "y2"])
+        self.assertEqual(a.rename(x="y", y="x"), values(1, 2, y=10, x=20, z=30))
+        self.assertTrue(a.rename() is a)
+        self.assertRaises(KeyError, a.rename, nope="x")
+        self.assertRaises(ValueError, a.rename, x="y")
+        self.assertRaises(TypeError, a.rename, x=1)
+        self.assertRaises(TypeError, a.rename, "x")
+
+        # subclasses stay subclasses, and lazy fields stay unforced
+        class Record(values):
+            __slots__ = ()
+
+        self.assertEqual(type(Record(a=1, b=2).select("a")), Record)
+
+        calls = []
+
+        def thunk():
+            calls.append(1)
+            return 5
+
+        e = values.lazy(1, k=thunk, j=lambda: 6)
+        f = e.select("k").rename(k="kay")
+        self.assertEqual(calls, [])
+        self.assertEqual(f, values(1, kay=5))
+        self.assertEqual(e["k"], 5)
+        self.assertEqual(calls, [1])
+
+
+    def test_stable_hash(self):
+        """
+        Test the process-independent stable hash
+        """
+
+        a = self.values(1, 2, 3, foo=4, bar="five")
+        b = self.values(1, 2, 3, bar="five", foo=4)
+
+        self.assertEqual(a.stable_hash(), b.stable_hash())
+        self.assertEqual(a.stable_hash(99), b.stable_hash(99))
+        self.assertNotEqual(a.stable_hash(), a.stable_hash(99))
+        self.assertTrue(0 <= a.stable_hash() < 2 ** 64)
+
+        # scalars are tagged by type
+        c = self.values(1)
+        self.assertNotEqual(c.stable_hash(), self.values(1.0).stable_hash())
+        self.assertNotEqual(c.stable_hash(), self.values(True).stable_hash())
+        self.assertNotEqual(c.stable_hash(), self.values("1").stable_hash())
+        self.assertNotEqual(c.stable_hash(), self.values((1, )).stable_hash())
+
+        # nested values, and the big scalars
+        d = self.values(self.values(2 ** 100, x=None), b"raw", -2 ** 70)
+        e = self.values(self.values(2 ** 100, x=None), b"raw", -2 ** 70)
+        self.assertEqual(d.stable_hash(), e.stable_hash())
+
+        # positionals and keywords don't collide
+        self.assertNotEqual(self.values(1).stable_hash(),
+                            self.values(a=1).stable_hash())
+
+        self.assertRaises(TypeError, self.values([1]).stable_hash)
+        self.assertRaises(TypeError, self.values(a={}).stable_hash)
+
+
+    def test_canonical_bytes(self):
+        """
+        Test the canonical encoding, and the digests over it
+        """
+
+        from hashlib import blake2b, sha256
+
+        a = self.values(1, "two", foo=3.0, bar=None)
+        b = self.values(1, "two", bar=None, foo=3.0)
+
+        data = a.canonical_bytes()
+        self.assertEqual(type(data), bytes)
+        self.assertEqual(data, b.canonical_bytes())
+
+        self.assertEqual(self.values().canonical_bytes(),
+                         b"v" + bytes(16))
+        self.assertEqual(self.values(True, b"x").canonical_bytes(),
+                         b"v\x02" + bytes(7) + b"T" +
+                         b"b\x01" + bytes(7) + b"x" + bytes(8))
+
+        self.assertEqual(a.digest(), blake2b(data).digest())
+        self.assertEqual(a.digest("sha256"), sha256(data).digest())
+        self.assertEqual(a.digest(), b.digest())
+        self.assertNotEqual(a.digest(), self.values(1, "two").digest())
+        self.assertRaises(ValueError, a.digest, "no-such-hash")
+
+        # big enough to be streamed through several buffers
+        c = self.values(*range(1000), blob=b"z" * 10000,
+                        nested=self.values("x" * 600))
+        data = c.canonical_bytes()
+        self.assertTrue(len(data) > 15000)
+        self.assertEqual(c.digest(), blake2b(data).digest())
+
+
 try:
     class PyValuesTest(TestCase, ValuesTestBase):
         from values import pyvalues as values
@@ -458,5 +724,1432 @@ except ImportError:
     pass
 
 
+class KernelsTestBase():
+
+
+    def test_partition(self):
+        """
+        Test hash-partitioning a sequence of records
+        """
+
+        recs = [self.values(i, name="n%i" % (i % 7)) for i in range(200)]
+
+        parts = self.partition(recs, 4)
+        self.assertEqual(len(parts), 4)
+        self.assertEqual(sum(map(len, parts)), 200)
+        for index, part in enumerate(parts):
+            for rec in part:
+                self.assertEqual(hash(rec) % 4, index)
+
+        # input order is kept inside each part
+        for part in parts:
+            self.assertEqual(part, sorted(part, key=lambda v: v[0]))
+
+        parts = self.partition(recs, 3, key=lambda v: v["name"])
+        for part in parts:
+            names = set(v["name"] for v in part)
+            for other in parts:
+                if other is not part:
+                    self.assertFalse(names & set(v["name"] for v in other))
+
+        parts = self.partition(iter(recs), 5, stable=True)
+        for index, part in enumerate(parts):
+            for rec in part:
+                self.assertEqual(rec.stable_hash() % 5, index)
+
+        self.assertEqual(self.partition([], 2), [[], []])
+        self.assertEqual(self.partition(recs, 1), [recs])
+        self.assertRaises(ValueError, self.partition, recs, 0)
+        self.assertRaises(TypeError, self.partition, [[1]], 2)
+
+
+    def test_groupby(self):
+        """
+        Test grouping records by one or more of their fields
+        """
+
+        recs = [self.values(i, region=("east", "west")[i % 2],
+                            code=200 + (i % 3))
+                for i in range(12)]
+
+        groups = self.groupby(recs, "region")
+        self.assertEqual(set(groups), set(("east", "west")))
+        self.assertEqual(groups["east"], recs[0::2])
+        self.assertEqual(groups["west"], recs[1::2])
+
+        groups = self.groupby(iter(recs), "region", "code")
+        self.assertEqual(len(groups), 6)
+        self.assertEqual(groups[("east", 200)], [recs[0], recs[6]])
+
+        # positionals by index
+        groups = self.groupby(recs, 0)
+        self.assertEqual(groups[5], [recs[5]])
+
+        # plain mappings work as records too
+        groups = self.groupby([{"a": 1}, {"a": 2}, {"a": 1}], "a")
+        self.assertEqual(groups, {1: [{"a": 1}, {"a": 1}], 2: [{"a": 2}]})
+
+        self.assertEqual(self.groupby([], "a"), {})
+        self.assertRaises(TypeError, self.groupby, recs)
+        self.assertRaises(KeyError, self.groupby, recs, "missing")
+
+
+    def test_sort_by(self):
+        """
+        Test stable sorting of records by one or more of their fields
+        """
+
+        recs = [self.values(i, region=("east", "west")[i % 2],
+                            code=200 + (i % 3), took=(i * 7 % 5) / 2.0)
+                for i in range(12)]
+
+        def expect(*keys, reverse=False):
+            return sorted(recs, reverse=reverse,
+                          key=lambda r: tuple(r[k] for k in keys))
+
+        # ints, floats, strs, and a mix of them, either way around
+        for keys in (("code", ), ("took", ), ("region", ), (0, ),
+                     ("region", "code"), ("code", "took", 0)):
+            self.assertEqual(self.sort_by(recs, *keys), expect(*keys))
+            self.assertEqual(self.sort_by(iter(recs), *keys, reverse=True),
+                             expect(*keys, reverse=True))
+
+        # equal keys keep their input order, even reversed
+        ordered = self.sort_by(recs, "region", reverse=True)
+        self.assertEqual(ordered, recs[1::2] + recs[0::2])
+
+        mixed = [{"a": 2.5}, {"a": 1}, {"a": 2 ** 70}, {"a": True}]
+        self.assertEqual(self.sort_by(mixed, "a"),
+                         [mixed[1], mixed[3], mixed[0], mixed[2]])
+
+        # NaNs go last in a column of floats, whichever way around
+        nan = float("nan")
+        floats = [self.values(a=val, b=i) for i, val in
+                  enumerate((2.0, nan, -1.0, nan, 0.5))]
+        self.assertEqual(self.sort_by(floats, "a"),
+                         [floats[2], floats[4], floats[0],
+                          floats[1], floats[3]])
+        self.assertEqual(self.sort_by(floats, "a", reverse=True),
+                         [floats[0], floats[4], floats[2],
+                          floats[1], floats[3]])
+        self.assertEqual(self.sort_by(floats, "a", "b", reverse=True),
+                         [floats[0], floats[4], floats[2],
+                          floats[3], floats[1]])
+
+        self.assertEqual(self.sort_by([], "a"), [])
+        self.assertRaises(TypeError, self.sort_by, recs)
+        self.assertRaises(KeyError, self.sort_by, recs, "missing")
+        self.assertRaises(TypeError, self.sort_by,
+                          [self.values(a=1), self.values(a="x")], "a")
+
+
+    def test_index(self):
+        """
+        Test looking records up by one or more of their fields
+        """
+
+        Index = self.Index
+        recs = [self.values(i, region=("east", "west")[i % 2],
+                            code=200 + (i % 3))
+                for i in range(12)]
+
+        idx = Index(recs, on=("region", "code"))
+        self.assertEqual(idx.on, ("region", "code"))
+        self.assertEqual(len(idx), 12)
+        self.assertEqual(idx.get(("east", 200)), recs[0])
+        self.assertEqual(idx.get_all(("east", 200)), [recs[0], recs[6]])
+        self.assertEqual(idx.get_all(("east", 201)), [recs[4], recs[10]])
+        self.assertTrue(("west", 202) in idx)
+        self.assertFalse(("north", 200) in idx)
+        self.assertEqual(idx.get(("north", 200)), None)
+        self.assertEqual(idx.get(("north", 200), 5), 5)
+        self.assertEqual(idx.get_all(("north", 200)), [])
+        self.assertRaises(TypeError, idx.get, "east")
+        self.assertRaises(TypeError, idx.get_all, ("east", 200, 1))
+
+        # later records come after, even once the table is rebuilt
+        added = [self.values(i, region="east", code=200)
+                 for i in range(100, 150)]
+        for rec in added:
+            idx.add(rec)
+        self.assertEqual(len(idx), 62)
+        self.assertEqual(idx.get_all(("east", 200)),
+                         [recs[0], recs[6]] + added)
+
+        idx.discard(recs[0])
+        idx.discard(recs[0])
+        idx.discard(self.values(region="nowhere"))
+        self.assertEqual(len(idx), 61)
+        self.assertEqual(idx.get(("east", 200)), recs[6])
+        self.assertRaises(KeyError, idx.add, self.values(region="east"))
+
+        for rec in recs[1:] + added:
+            idx.discard(rec)
+        self.assertEqual(len(idx), 0)
+        self.assertFalse(("east", 200) in idx)
+
+        # a single field is looked up by its value, and positionals
+        # and plain mappings work as well
+        single = Index(recs, on="code")
+        self.assertEqual(single.on, ("code", ))
+        self.assertEqual(single.get_all(202), recs[2::3])
+        self.assertEqual(Index(recs, on=0).get(5), recs[5])
+        self.assertEqual(Index([{"a": 1}], on="a").get(1), {"a": 1})
+        self.assertEqual(len(Index(on="a")), 0)
+
+        self.assertRaises(TypeError, Index, recs)
+        self.assertRaises(ValueError, Index, recs, on=())
+        self.assertRaises(KeyError, Index, recs, on="missing")
+
+
+    def test_join(self):
+        """
+        Test joining two collections of records on their fields
+        """
+
+        values = self.values
+        join = self.join
+
+        hosts = [values(host="a", dc="east"), values(host="b", dc="west"),
+                 values(host="c", dc="east")]
+        hits = [values(i, host="abd"[i % 3], code=200 + i)
+                for i in range(6)]
+
+        # in the order of left, then right, whichever side is smaller
+        joined = join(hits, hosts, "host")
+        self.assertEqual(joined, [hits[0] + hosts[0], hits[1] + hosts[1],
+                                  hits[3] + hosts[0], hits[4] + hosts[1]])
+        self.assertEqual(joined[0], values(0, host="a", code=200,
+                                           dc="east"))
+
+        joined = join(hosts, hits, "host")
+        self.assertEqual(joined, [hosts[0] + hits[0], hosts[0] + hits[3],
+                                  hosts[1] + hits[1], hosts[1] + hits[4]])
+
+        joined = join(hits, hosts, "host", how="left")
+        self.assertEqual(joined, [hits[0] + hosts[0], hits[1] + hosts[1],
+                                  hits[2], hits[3] + hosts[0],
+                                  hits[4] + hosts[1], hits[5]])
+
+        joined = join(hosts, hits, on="host", how="left")
+        self.assertEqual(joined[-1], hosts[2])
+
+        # several fields, with the right winning where both have one
+        left = [values(a=1, b=2, x="left"), values(a=1, b=3, x="left")]
+        right = [values(a=1, b=3, x="right"), values(a=2, b=3)]
+        self.assertEqual(join(left, right, ("a", "b")),
+                         [values(a=1, b=3, x="right")])
+
+        self.assertEqual(join([], hosts, "host"), [])
+        self.assertEqual(join(hosts, [], "host", how="left"), hosts)
+        self.assertRaises(ValueError, join, hits, hosts, "host", how="outer")
+        self.assertRaises(ValueError, join, hits, hosts, ())
+        self.assertRaises(KeyError, join, hits, hosts, "dc")
+
+
+    def test_where(self):
+        """
+        Test predicates compiled from keyword conditions
+        """
+
+        values = self.values
+        where = self.where
+
+        recs = [values(i, host="abc"[i % 3], code=200 + (i % 4) * 100,
+                       took=i / 2.0)
+                for i in range(12)]
+
+        pred = where(host="a", code__lt=400)
+        self.assertTrue(pred(recs[0]))
+        self.assertFalse(pred(recs[3]))
+        self.assertEqual(pred.filter(recs), [recs[0], recs[9]])
+        self.assertEqual(pred.count(recs), 2)
+        self.assertEqual(pred.filter(iter(recs)), [recs[0], recs[9]])
+        self.assertEqual(repr(pred), "where(host='a', code__lt=400)")
+
+        # each operator, and equality across numeric types
+        self.assertEqual(where(code=300.0).count(recs), 3)
+        self.assertEqual(where(code__ne=300).count(recs), 9)
+        self.assertEqual(where(took__le=1.0).count(recs), 3)
+        self.assertEqual(where(took__gt=5).count(recs), 1)
+        self.assertEqual(where(took__ge=5).count(recs), 2)
+        self.assertEqual(where(host__in=["b", "c"]).count(recs), 8)
+        self.assertEqual(where(host__in="bc").count(recs), 8)
+        self.assertEqual(where(host__in=[[1]]).count(recs), 0)
+
+        # unhashable fields are still looked for among the operand
+        self.assertFalse(where(x__in=[1, 2])(values(x=[3])))
+        self.assertTrue(where(x__in=[1, [3]])(values(x=[3])))
+
+        # no conditions holds of everything, and mappings work too
+        self.assertEqual(where().count(recs), 12)
+        self.assertTrue(where(a=1)({"a": 1}))
+
+        nan = float("nan")
+        self.assertFalse(where(x=nan)(values(x=nan)))
+        self.assertTrue(where(x__ne=nan)(values(x=nan)))
+
+        self.assertRaises(TypeError, where, 1)
+        self.assertRaises(KeyError, where(missing=1), recs[0])
+        self.assertRaises(KeyError, where(missing=1).count, recs)
+        self.assertRaises(TypeError, where(host__lt=1), recs[0])
+
+
+    def test_aggregate(self):
+        """
+        Test streaming aggregation over groups of records
+        """
+
+        recs = [self.values(i, region=("east", "west")[i % 2],
+                            bytes=i * 10, latency=i * 0.5)
+                for i in range(10)]
+
+        result = self.aggregate(iter(recs), by=("region", ), sum=("bytes", ),
+                                max=("latency", ), min="bytes",
+                                mean="bytes")
+        self.assertEqual(result, [
+            self.values(region="east", count=5, sum_bytes=200,
+                        min_bytes=0, max_latency=4.0, mean_bytes=40.0),
+            self.values(region="west", count=5, sum_bytes=250,
+                        min_bytes=10, max_latency=4.5, mean_bytes=50.0),
+        ])
+
+        # no grouping gives a single total
+        result = self.aggregate(recs, sum=("bytes", "latency"), count=False)
+        self.assertEqual(result, [self.values(sum_bytes=450,
+                                              sum_latency=22.5)])
+        self.assertEqual(type(result[0]["sum_bytes"]), int)
+
+        # positional grouping fields stay positional
+        result = self.aggregate(recs[:2], by=0)
+        self.assertEqual(result, [self.values(0, count=1),
+                                  self.values(1, count=1)])
+
+        # sums survive overflowing a native integer, and mixing types
+        big = [self.values(a=2 ** 62), self.values(a=2 ** 62),
+               self.values(a=2 ** 62)]
+        self.assertEqual(self.aggregate(big, sum="a", count=False),
+                         [self.values(sum_a=3 * 2 ** 62)])
+        mixed = [self.values(a=1), self.values(a=0.5), self.values(a=2)]
+        self.assertEqual(self.aggregate(mixed, sum="a", count=False),
+                         [self.values(sum_a=3.5)])
+
+        # sums start from the first value, so anything that adds will do
+        words = [self.values(k=1, s="a"), self.values(k=1, s="b"),
+                 self.values(k=2, s="c")]
+        self.assertEqual(self.aggregate(words, by="k", sum="s", count=False),
+                         [self.values(k=1, sum_s="ab"),
+                          self.values(k=2, sum_s="c")])
+        self.assertEqual(repr(self.aggregate([self.values(a=-0.0)], sum="a",
+                                             count=False)[0]["sum_a"]),
+                         "-0.0")
+
+        self.assertEqual(self.aggregate([], by="region"), [])
+        self.assertRaises(KeyError, self.aggregate, recs, sum="missing")
+        self.assertRaises(TypeError, self.aggregate,
+                          [self.values(a="x"), self.values(a=1)], sum="a")
+
+
+
+    def test_csv_reader(self):
+        """
+        Test reading CSV text into values
+        """
+
+        from io import StringIO
+
+        text = ('name,n,x\n'
+                'a,1,1.5\n'
+                '"b,c",2," 2.5"\n'
+                '\n'
+                '"multi\nline ""q""",3,nan\n'
+                'last,-4,1e3')
+
+        rows = list(self.csv_reader(StringIO(text),
+                                    types={"n": int, "x": float}))
+        self.assertEqual(len(rows), 4)
+        self.assertEqual(rows[0], self.values(name="a", n=1, x=1.5))
+        self.assertEqual(rows[1], self.values(name="b,c", n=2, x=2.5))
+        self.assertEqual(rows[2]["name"], 'multi\nline "q"')
+        self.assertNotEqual(rows[2]["x"], rows[2]["x"])
+        self.assertEqual(rows[3], self.values(name="last", n=-4, x=1000.0))
+
+        # rows all share the very same key objects
+        keys = [list(row.keys()) for row in rows]
+        for key in zip(*keys):
+            self.assertTrue(all(k is key[0] for k in key))
+
+        # no header gives positionals, and types by column
+        rows = list(self.csv_reader(["1,2\n", "3,4"], header=False,
+                                    types=[int]))
+        self.assertEqual(rows, [self.values(1, "2"), self.values(3, "4")])
+
+        rows = list(self.csv_reader(["1;2", "3;4"], header=["a", "b"],
+                                    delimiter=";", types={1: float}))
+        self.assertEqual(rows, [self.values(a="1", b=2.0),
+                                self.values(a="3", b=4.0)])
+
+        self.assertEqual(list(self.csv_reader(StringIO(""))), [])
+        self.assertEqual(list(self.csv_reader(StringIO("a,b\r\n"))), [])
+
+        bad = self.csv_reader(StringIO("a,b\n1,2,3\n"))
+        self.assertRaises(ValueError, list, bad)
+
+        bad = self.csv_reader(StringIO("a\nxyz\n"), types={"a": int})
+        self.assertRaises(ValueError, list, bad)
+
+        # a bare \r ends nothing mid-line, so what follows is refused
+        self.assertEqual(list(self.csv_reader(["1,2\r"], header=False)),
+                         [self.values("1", "2")])
+        bad = self.csv_reader(["a,b\rc,d\n"], header=False)
+        self.assertRaises(ValueError, list, bad)
+
+
+    def test_pipe(self):
+        values = self.values
+        pipe = self.pipe
+
+        def parse(host, port="80"):
+            return values(host, port=int(port))
+
+        def url(host, port):
+            return "http://%s:%i/" % (host, port)
+
+        p = pipe(parse, url, len)
+        self.assertEqual(p("example.com"), 22)
+        self.assertEqual(p("example.com", port="8080"), 24)
+
+        # a values is splatted into the first stage too
+        self.assertEqual(p(values("example.com", port="8080")), 24)
+        self.assertEqual(values("example.com")(p), 22)
+
+        # anything else is passed along whole
+        self.assertEqual(pipe(list, sorted, tuple)("cba"), ("a", "b", "c"))
+        self.assertEqual(pipe(str)(values), str(values))
+
+        # nesting flattens
+        inner = pipe(parse, url)
+        outer = pipe(inner, len, pipe(str, len))
+        self.assertEqual(outer.funcs, (parse, url, len, str, len))
+        self.assertEqual(outer("example.com"), 2)
+        self.assertEqual(repr(pipe(len)), "pipe(%r)" % len)
+
+        self.assertRaises(TypeError, pipe)
+        self.assertRaises(TypeError, pipe, len, 5)
+        self.assertRaises(ValueError, pipe(parse), "x", port="http")
+
+
+    def test_repr_cache(self):
+        values = self.values
+        repr_cache = self.repr_cache
+
+        previous = repr_cache(60)
+        try:
+            a = values(1, "two", x=(3.0, None), y=values(b"4"))
+            self.assertEqual(repr(a), "values(1, 'two', x=(3.0, None),"
+                             " y=values(b'4'))")
+            self.assertIs(repr(a), repr(a))
+
+            # too long, or holding something which could change
+            b = values("x" * 60)
+            self.assertIsNot(repr(b), repr(b))
+
+            c = values(1, x=[2])
+            self.assertIsNot(repr(c), repr(c))
+            d = values(c)
+            self.assertIsNot(repr(d), repr(d))
+
+            e = values.lazy(z=lambda: 5)
+            self.assertEqual(repr(e), "values(z=5)")
+            self.assertIs(repr(e), repr(e))
+
+            self.assertEqual(repr_cache(0), 60)
+            f = values(1)
+            self.assertIsNot(repr(f), repr(f))
+
+        finally:
+            repr_cache(previous)
+
+        self.assertRaises(ValueError, repr_cache, -1)
+
+
+    def test_formatter(self):
+        values = self.values
+        formatter = self.formatter
+
+        v = values("web", 8080, host="example.com", tags=("a", "b"),
+                   width=8)
+
+        f = formatter("{0}://{host}:{1} [{tags[1]}]")
+        self.assertEqual(f.template, "{0}://{host}:{1} [{tags[1]}]")
+        self.assertEqual(repr(f), "formatter(%r)" % f.template)
+        self.assertEqual(f(v), "web://example.com:8080 [b]")
+
+        # nested specs, conversions, attributes and escapes
+        f = formatter("{host!r:>{width}.5} {1.real:,} {{{0!s}}}")
+        self.assertEqual(f(v), "   'exam 8,080 {web}")
+
+        # automatic numbering carries into the specs
+        self.assertEqual(formatter("{}{:>{}}")("a", "b", 3), "a  b")
+
+        # anything other than a single values is an ordinary format
+        self.assertEqual(formatter("{0}-{x}")(1, x=2), "1-2")
+        self.assertEqual(formatter("{0}")(v, 1), repr(v))
+
+        lazy = values.lazy(1, name=lambda: "late")
+        self.assertEqual(formatter("{0} {name}")(lazy), "1 late")
+
+        self.assertRaises(IndexError, formatter("{5}"), v)
+        self.assertRaises(KeyError, formatter("{port}"), v)
+        self.assertRaises(ValueError, formatter, "{} {0}")
+        self.assertRaises(ValueError, formatter, "{0} {}")
+        self.assertRaises(ValueError, formatter, "{0!x}")
+        self.assertRaises(ValueError, formatter, "{")
+        self.assertRaises(TypeError, formatter, 5)
+
+
+    def test_profile(self):
+        from time import sleep
+
+        values = self.values
+        profile = self.profile
+
+        def work(delay, fail=False):
+            sleep(delay)
+            if fail:
+                raise ValueError(delay)
+            return delay
+
+        p = profile(work)
+        self.assertIs(p.func, work)
+        self.assertEqual(repr(p), "profile(%r)" % work)
+
+        for _ in range(9):
+            self.assertEqual(p(0), 0)
+        self.assertEqual(values(0.02)(p), 0.02)
+        self.assertRaises(ValueError, p, 0, fail=True)
+
+        self.assertEqual(p.count, 11)
+        self.assertEqual(p.errors, 1)
+
+        snap = p.snapshot()
+        self.assertEqual(snap["count"], 11)
+        self.assertEqual(snap["errors"], 1)
+        self.assertLessEqual(snap["min"], snap["p50"])
+        self.assertLessEqual(snap["p50"], snap["p90"])
+        self.assertLessEqual(snap["p99"], snap["max"])
+        self.assertEqual(snap["max"], snap["p999"])
+        self.assertGreaterEqual(snap["max"], 20000000)
+        self.assertLess(snap["p90"], 20000000)
+        self.assertEqual(sum(c for _l, _h, c in snap["buckets"]), 11)
+        for low, high, count in snap["buckets"]:
+            self.assertLessEqual(low, high)
+            self.assertLessEqual(high - low, low // 32 + 1)
+
+        self.assertEqual(p.percentile(100), snap["max"])
+        self.assertRaises(ValueError, p.percentile, 101)
+
+        # taking a reset snapshot hands over the counts, and clears them
+        self.assertEqual(p.snapshot(reset=True)["count"], 11)
+        self.assertEqual(p.count, 0)
+        self.assertEqual(p.snapshot()["buckets"], ())
+        self.assertEqual(p.percentile(50), 0)
+
+        p(0)
+        p.reset()
+        self.assertEqual(p.count, 0)
+
+        class Thing(object):
+            @profile
+            def method(self, n):
+                return n + 1
+
+        self.assertEqual(Thing().method(1), 2)
+        self.assertEqual(Thing.method.count, 1)
+        self.assertRaises(TypeError, profile, 5)
+
+
+    def test_shapes(self):
+        values = self.values
+        shape_sample = self.shape_sample
+        shape_report = self.shape_report
+
+        self.assertEqual(shape_sample(1, capacity=3), 0)
+        try:
+            for i in range(100):
+                values(i, a=1, b=2)
+                values(b=1, a=2)
+            for i in range(10):
+                values(1, 2, 3)
+            for i in range(5):
+                values(**{"k%i" % i: i})
+
+            report = shape_report(reset=True)
+            self.assertEqual(report["every"], 1)
+            self.assertEqual(report["constructed"], 215)
+            self.assertEqual(report["sampled"], 215)
+            self.assertEqual(report["arities"], ((0, 105), (1, 100), (3, 10)))
+
+            # the heavy hitters are exact, and the tail swapped through
+            # the last slot, carrying its count forward as error
+            shapes = report["shapes"]
+            self.assertEqual(shapes[:2], ((("a", "b"), 200, 0), ((), 10, 0)))
+            self.assertEqual(shapes[2], (("k4", ), 5, 4))
+
+            report = shape_report()
+            self.assertEqual(report["constructed"], 0)
+            self.assertEqual(report["shapes"], ())
+
+            self.assertEqual(shape_sample(4), 1)
+            for i in range(10):
+                values(i)
+            report = shape_report()
+            self.assertEqual(report["constructed"], 10)
+            self.assertEqual(report["sampled"], 2)
+
+        finally:
+            shape_sample(0)
+
+        values(1)
+        self.assertEqual(shape_report()["constructed"], 0)
+        self.assertRaises(ValueError, shape_sample, -1)
+
+
+    def test_shapes_built(self):
+        from io import StringIO
+
+        values = self.values
+        shape_sample = self.shape_sample
+        shape_report = self.shape_report
+
+        recs = [values(k=1, v=2), values(k=1, v=3)]
+        extra = values(x=1)
+
+        # records built by the kernels are sampled with their keywords
+        shape_sample(1)
+        try:
+            rows = list(self.csv_reader(StringIO("a,b\n1,2\n3,4\n")))
+            self.assertEqual(len(rows), 2)
+            self.assertEqual(shape_report(reset=True)["shapes"],
+                             ((("a", "b"), 2, 0), ))
+
+            self.aggregate(recs, by="k", sum="v")
+            self.assertEqual(shape_report(reset=True)["shapes"],
+                             ((("count", "k", "sum_v"), 1, 0), ))
+
+            recs[0] + extra
+            self.assertEqual(shape_report(reset=True)["shapes"],
+                             ((("k", "v", "x"), 1, 0), ))
+
+        finally:
+            shape_sample(0)
+
+
+    def test_memory_report(self):
+        from sys import getsizeof
+
+        values = self.values
+        memory_report = self.memory_report
+
+        before = memory_report()["count"]
+
+        keep = [values(i, "x", memory_a=i, memory_b=2) for i in range(100)]
+        keep.append(keep[0] + values(1))
+
+        after = memory_report(limit=100)
+        self.assertEqual(after["count"] - before, 101)
+        self.assertEqual(after["total"], sum(after[kind] for kind in
+                                             ("struct", "args", "kwds",
+                                              "repr")))
+
+        shapes = dict(((arity, keys), (count, nbytes))
+                      for arity, keys, count, nbytes in after["shapes"])
+        count, nbytes = shapes[(2, ("memory_a", "memory_b"))]
+        self.assertEqual(count, 100)
+        count, summed = shapes[(3, ("memory_a", "memory_b"))]
+        self.assertEqual(count, 1)
+
+        # the native sum shares its keyword dict with keep[0], and
+        # then the dict is only counted once, against whichever of
+        # the two the collector happens to list first
+        kwds = getsizeof({"memory_a": 1, "memory_b": 2})
+        expected = (100 * (getsizeof(keep[0]) + getsizeof((1, "x")) + kwds) +
+                    getsizeof(keep[-1]) + getsizeof((0, "x", 1)))
+        self.assertIn(nbytes + summed, (expected, expected + kwds))
+
+        self.assertEqual(len(memory_report(limit=1)["shapes"]), 1)
+
+
+    def test_compact(self):
+        from sys import getsizeof
+
+        values = self.values
+        compact = self.compact
+
+        def records():
+            # built at runtime, so that the equal members are distinct
+            return [values(int("7000%i" % (i % 2)), "-".join(("a", "b")),
+                           host="".join(("host", str(i % 3))),
+                           took=float("%i.5" % (i % 2)),
+                           zero=-0.0 if i % 2 else 0.0, ok=True)
+                    for i in range(12)]
+
+        recs = records()
+        reprs = list(map(repr, recs))
+        hashes = list(map(hash, recs))
+        held = recs[5]["host"]
+
+        report = compact(recs)
+        self.assertEqual(report["count"], 12)
+
+        # 10 ints, 11 strs, 9 hosts and 10 floats were duplicates
+        self.assertEqual(report["replaced"], 40)
+        self.assertEqual(report["reclaimed"],
+                         10 * getsizeof(70001) + 11 * getsizeof("a-b") +
+                         8 * getsizeof(held) + 10 * getsizeof(1.5))
+
+        self.assertEqual(list(map(repr, recs)), reprs)
+        self.assertEqual(list(map(hash, recs)), hashes)
+        self.assertIs(recs[0][0], recs[2][0])
+        self.assertIs(recs[0][1], recs[11][1])
+        self.assertIs(recs[2]["host"], recs[11]["host"])
+        self.assertIs(recs[1]["took"], recs[3]["took"])
+        self.assertIsNot(recs[5]["host"], held)
+        self.assertEqual(repr(recs[1]["zero"]), "-0.0")
+
+        self.assertEqual(compact(recs)["replaced"], 0)
+
+        # only the given fields, and those a record lacks are skipped
+        recs = records()
+        self.assertEqual(compact(recs, "host")["replaced"], 9)
+        self.assertEqual(compact(recs, (-1, "missing", 9))["replaced"], 11)
+        self.assertIs(recs[0][1], recs[1][1])
+        self.assertIsNot(recs[0][0], recs[2][0])
+
+        # a positional tuple another holds is copied, not rewritten
+        first = ("".join(("a", "bc")), 1)
+        second = ("".join(("ab", "c")), 2)
+        recs = [values(*first), values(*second)]
+        self.assertEqual(compact(recs)["replaced"], 1)
+        self.assertIs(recs[0][0], recs[1][0])
+        self.assertIsNot(first[0], second[0])
+
+        summed = recs[0] + values(x=1)
+        recs.append(values("".join(("a", "bc")), 3))
+        compact([recs[2], recs[0], summed])
+        self.assertIs(recs[0][0], recs[2][0])
+        self.assertIs(summed[0], recs[2][0])
+
+        self.assertEqual(compact([])["count"], 0)
+        self.assertRaises(TypeError, compact, [values(1), {"a": 1}])
+
+
+try:
+    class PyKernelsTest(TestCase, KernelsTestBase):
+        from values import pyvalues as values
+        from values import pypartition as _partition
+        partition = staticmethod(_partition)
+        from values import pygroupby as _groupby
+        groupby = staticmethod(_groupby)
+        from values import pysort_by as _sort_by
+        sort_by = staticmethod(_sort_by)
+        from values import pyaggregate as _aggregate
+        aggregate = staticmethod(_aggregate)
+        from values import pycsv_reader as _csv_reader
+        csv_reader = staticmethod(_csv_reader)
+        from values import pypipe as _pipe
+        pipe = staticmethod(_pipe)
+        from values import pyformatter as _formatter
+        formatter = staticmethod(_formatter)
+        from values import pyrepr_cache as _repr_cache
+        repr_cache = staticmethod(_repr_cache)
+        from values import pyprofile as _profile
+        profile = staticmethod(_profile)
+        from values import _pyshape_sample, _pyshape_report
+        shape_sample = staticmethod(_pyshape_sample)
+        shape_report = staticmethod(_pyshape_report)
+        from values import _pymemory_report
+        memory_report = staticmethod(_pymemory_report)
+        from values import pycompact as _compact
+        compact = staticmethod(_compact)
+        from values import pyIndex as Index
+        from values import pyjoin as _join
+        join = staticmethod(_join)
+        from values import pywhere as where
+
+except ImportError:
+    pass
+
+
+try:
+    class CKernelsTest(TestCase, KernelsTestBase):
+        from values import cvalues as values
+        from values._values import partition, groupby, sort_by, aggregate
+        from values._values import csv_reader, pipe, formatter, repr_cache
+        from values._values import profile
+        from values._values import _shape_sample as shape_sample
+        from values._values import _shape_report as shape_report
+        from values._values import _memory_report as memory_report
+        from values._values import compact
+        from values._values import Index, join, where
+
+except ImportError:
+    pass
+
+
+class SharedMemoTest(TestCase):
+
+
+    def setUp(self):
+        try:
+            from values import SharedMemo
+        except ImportError:
+            self.skipTest("SharedMemo unavailable")
+
+        self.name = "values-test-%i" % os.getpid()
+        self.memo = SharedMemo(self.name, 64, slot_size=256)
+
+
+    def tearDown(self):
+        self.memo.close()
+        self.memo.unlink()
+
+
+    def test_get_put(self):
+        from values import SharedMemo, values
+
+        memo = self.memo
+        key = values(1, "two", three=3.0)
+
+        self.assertEqual(memo.name, "/" + self.name)
+        self.assertEqual(memo.capacity, 64)
+        self.assertEqual(memo.slot_size, 256)
+
+        self.assertEqual(memo.get(key), None)
+        self.assertEqual(memo.get(key, "nope"), "nope")
+        self.assertFalse(key in memo)
+
+        self.assertTrue(memo.put(key, {"result": [1, 2, 3]}))
+        self.assertTrue(key in memo)
+        self.assertEqual(memo.get(key), {"result": [1, 2, 3]})
+
+        # the keyword order of the key doesn't matter
+        self.assertEqual(memo.get(values(1, "two", three=3.0)),
+                         {"result": [1, 2, 3]})
+        self.assertEqual(memo.get(values(1, "two", three=3)), None)
+
+        # too large for a slot is simply not kept
+        self.assertFalse(memo.put(values(2), "x" * 1000))
+        self.assertFalse(values(2) in memo)
+
+        # a second handle on the same name sees the same table
+        other = SharedMemo(self.name, 64, slot_size=256)
+        self.assertEqual(other.get(key), {"result": [1, 2, 3]})
+        other.close()
+        self.assertRaises(ValueError, other.get, key)
+
+        self.assertRaises(ValueError, SharedMemo, self.name, 32,
+                          slot_size=256)
+
+        # overfill it, which evicts but never fails
+        for i in range(500):
+            memo.put(values(i), i)
+        self.assertTrue(0 < len(memo) <= 64)
+        self.assertEqual(memo.get(values(499)), 499)
+
+        memo.clear()
+        self.assertEqual(len(memo), 0)
+        self.assertRaises(TypeError, memo.put, values([]), 1)
+
+
+    def test_across_processes(self):
+        from values import values
+
+        if not hasattr(os, "fork"):
+            self.skipTest("needs fork")
+
+        calls = []
+
+        @self.memo.memoize
+        def work(a, b=0):
+            calls.append((a, b))
+            return a * 10 + b
+
+        pid = os.fork()
+        if pid == 0:
+            # the child computes, and the parent should see it
+            try:
+                work(4, b=2)
+            finally:
+                os._exit(0)
+
+        os.waitpid(pid, 0)
+
+        self.assertEqual(work(4, b=2), 42)
+        self.assertEqual(calls, [])
+        self.assertEqual(work(5), 50)
+        self.assertEqual(work(5), 50)
+        self.assertEqual(calls, [(5, 0)])
+        self.assertTrue(values(work.__module__ + ".%s" % work.__qualname__,
+                               5) in self.memo)
+
+
+    def test_dead_owner(self):
+        from mmap import mmap
+        from struct import Struct
+        from values import values
+
+        path = "/dev/shm/" + self.name
+        if not (hasattr(os, "fork") and os.path.exists(path)):
+            self.skipTest("needs fork and /dev/shm")
+
+        pid = os.fork()
+        if pid == 0:
+            os._exit(0)
+        os.waitpid(pid, 0)
+
+        memo = self.memo
+        memo.put(values(1), "one")
+
+        # the seq and owner leading each slot, after the 64 byte header
+        slot = Struct("=Qq")
+
+        with open(path, "r+b") as fd:
+            shm = mmap(fd.fileno(), 0)
+
+        def hold(index, owner):
+            offset = 64 + index * 256
+            seq, _owner = slot.unpack_from(shm, offset)
+            slot.pack_into(shm, offset, seq | 1, owner)
+
+        held = [i for i in range(64)
+                if shm[64 + i * 256 + 16:64 + i * 256 + 24] != bytes(8)]
+        self.assertEqual(len(held), 1)
+
+        # a writer died halfway through writing that slot, so readers
+        # give up on it, and the next writer takes it over
+        hold(held[0], pid)
+        self.assertEqual(memo.get(values(1)), None)
+        self.assertTrue(memo.put(values(1), "uno"))
+        self.assertEqual(memo.get(values(1)), "uno")
+
+        # while the owner lives its slot stays held
+        hold(0, os.getpid())
+        self.assertRaises(TimeoutError, memo.clear)
+        hold(0, pid)
+        memo.clear()
+        self.assertEqual(len(memo), 0)
+
+        shm.close()
+
+
+class ChannelTest(TestCase):
+
+
+    def setUp(self):
+        try:
+            from values import Channel
+        except ImportError:
+            self.skipTest("Channel unavailable")
+
+        self.Channel = Channel
+
+
+    def test_put_get(self):
+        from queue import Empty, Full
+        from values import values
+
+        chan = self.Channel(3)
+        self.assertEqual(chan.capacity, 3)
+        self.assertEqual(len(chan), 0)
+        self.assertRaises(ValueError, self.Channel, 0)
+
+        chan.put(values(1))
+        chan.put(values(2), block=False)
+        chan.put(values(3), timeout=0.01)
+        self.assertEqual(len(chan), 3)
+
+        self.assertRaises(Full, chan.put, values(4), False)
+        self.assertRaises(Full, chan.put, values(4), timeout=0.01)
+        self.assertRaises(ValueError, chan.put, values(4), timeout=-1)
+
+        self.assertEqual(chan.get(), values(1))
+        self.assertEqual(chan.get(False), values(2))
+        self.assertEqual(chan.get(timeout=0.01), values(3))
+
+        self.assertRaises(Empty, chan.get, False)
+        self.assertRaises(Empty, chan.get, timeout=0.01)
+
+        # going around the ring a few times keeps the order
+        for i in range(10):
+            chan.put(i)
+            chan.put(i + 100)
+            self.assertEqual(chan.get(), i)
+            self.assertEqual(chan.get(), i + 100)
+
+
+    def test_many(self):
+        chan = self.Channel(4)
+
+        self.assertEqual(chan.put_many(range(3)), 3)
+        self.assertEqual(chan.put_many(range(3, 10), block=False), 1)
+        self.assertEqual(chan.put_many([10], timeout=0.01), 0)
+
+        self.assertEqual(chan.get_many(2), [0, 1])
+        self.assertEqual(chan.get_many(), [2, 3])
+        self.assertEqual(chan.get_many(block=False), [])
+        self.assertEqual(chan.get_many(timeout=0.01), [])
+        self.assertRaises(ValueError, chan.get_many, 0)
+
+        chan.put_many(range(3))
+        self.assertEqual(chan.get_many(None), [0, 1, 2])
+        chan.put_many(range(3))
+        self.assertEqual(chan.get_many(max=None, block=False), [0, 1, 2])
+
+
+    def test_bad_block(self):
+        class Bad(object):
+            def __bool__(self):
+                raise ZeroDivisionError()
+
+        chan = self.Channel(1)
+        chan.put(1)
+
+        # raised whether or not the block would have mattered
+        self.assertRaises(ZeroDivisionError, chan.put, 2, Bad())
+        self.assertRaises(ZeroDivisionError, chan.put_many, [2], Bad())
+        self.assertEqual(len(chan), 1)
+        self.assertRaises(ZeroDivisionError, chan.get, Bad())
+        self.assertRaises(ZeroDivisionError, chan.get_many, 1, Bad())
+        self.assertEqual(chan.get(), 1)
+        self.assertRaises(ZeroDivisionError, chan.get, Bad(), 0.01)
+        self.assertRaises(ZeroDivisionError, chan.get_many, None, Bad())
+
+
+    def test_threads(self):
+        from threading import Thread
+        from values import values
+
+        chan = self.Channel(16)
+        results = self.Channel(16)
+        producers, consumers, count = 3, 3, 2000
+
+        def produce(which):
+            items = [values(which, i) for i in range(count)]
+            for start in range(0, count, 100):
+                chan.put_many(items[start:start + 100])
+
+        def consume():
+            total = 0
+            while True:
+                batch = chan.get_many(32)
+                stops = batch.count(None)
+                total += sum(v[1] for v in batch if v is not None)
+                if stops:
+                    # a batch may have picked up other consumers'
+                    # sentinels as well, so hand those back
+                    chan.put_many([None] * (stops - 1))
+                    results.put(total)
+                    return
+
+        threads = [Thread(target=produce, args=(p, ))
+                   for p in range(producers)]
+        threads.extend(Thread(target=consume) for _ in range(consumers))
+        for t in threads:
+            t.start()
+
+        for t in threads[:producers]:
+            t.join()
+        for _ in range(consumers):
+            chan.put(None)
+        for t in threads:
+            t.join()
+
+        totals = [results.get() for _ in range(consumers)]
+        self.assertEqual(sum(totals), producers * sum(range(count)))
+        self.assertEqual(len(chan), 0)
+
+
+    def test_gc(self):
+        import gc
+        from weakref import ref
+
+        class Holder(object):
+            pass
+
+        chan = self.Channel(2)
+        holder = Holder()
+        holder.chan = chan
+        chan.put(holder)
+
+        watch = ref(holder)
+        del chan, holder
+        gc.collect()
+        self.assertEqual(watch(), None)
+
+
+class DiskMemoTest(TestCase):
+
+
+    def setUp(self):
+        from tempfile import mkdtemp
+        self.path = mkdtemp()
+
+
+    def tearDown(self):
+        from shutil import rmtree
+        rmtree(self.path)
+
+
+    def test_persistence(self):
+        from values import DiskMemo, values
+
+        key = values(1, "two", three=3)
+
+        with DiskMemo(self.path, capacity=4) as memo:
+            self.assertEqual(memo.get(key), None)
+            self.assertFalse(key in memo)
+
+            memo.put(key, {"result": 42})
+            self.assertTrue(key in memo)
+            self.assertEqual(memo.get(key), {"result": 42})
+            self.assertEqual(memo.get(values(1, "two", three=3.0)), None)
+
+            # enough to grow the index a few times
+            for i in range(100):
+                memo.put(values(i), [i] * i)
+            self.assertEqual(len(memo), 101)
+
+        # survives a reopen
+        with DiskMemo(self.path) as memo:
+            self.assertEqual(memo.get(values(1, "two", three=3)),
+                             {"result": 42})
+            self.assertEqual(memo.get(values(99)), [99] * 99)
+            self.assertEqual(len(memo), 101)
+
+
+    def test_recovery(self):
+        from values import DiskMemo, values
+
+        with DiskMemo(self.path) as memo:
+            memo.put(values(1), "one")
+            memo.put(values(2), "two")
+
+        # a lost index is rebuilt from the log
+        os.unlink(os.path.join(self.path, "data.idx"))
+        with DiskMemo(self.path) as memo:
+            self.assertEqual(memo.get(values(1)), "one")
+            self.assertEqual(memo.get(values(2)), "two")
+            size = memo.size()
+
+        # and a torn write at the end of the log is dropped
+        with open(os.path.join(self.path, "data.log"), "ab") as log:
+            log.write(b"VLDM" + bytes(10))
+
+        with DiskMemo(self.path) as memo:
+            self.assertEqual(memo.size(), size)
+            self.assertEqual(memo.get(values(2)), "two")
+            memo.put(values(3), "three")
+            self.assertEqual(memo.get(values(3)), "three")
+
+        # a record that doesn't match what the index expects is a miss,
+        # and never unpickled
+        with open(os.path.join(self.path, "data.log"), "r+b") as log:
+            log.write(b"XXXX")
+
+        with DiskMemo(self.path) as memo:
+            self.assertEqual(memo.get(values(1), "gone"), "gone")
+            self.assertEqual(memo.get(values(2)), "two")
+
+
+    def test_compact(self):
+        from values import DiskMemo, values
+
+        with DiskMemo(self.path) as memo:
+            for i in range(10):
+                memo.put(values("same"), i)
+            memo.put(values("other"), "x")
+
+            before = memo.size()
+            memo.compact()
+            self.assertTrue(memo.size() < before)
+            self.assertEqual(memo.get(values("same")), 9)
+            self.assertEqual(memo.get(values("other")), "x")
+            self.assertEqual(len(memo), 2)
+
+            memo.clear()
+            self.assertEqual(len(memo), 0)
+            self.assertEqual(memo.size(), 0)
+
+
+    def test_stale_reader(self):
+        from fcntl import flock, LOCK_EX
+        from sys import modules
+        from values import DiskMemo, values
+
+        # the module, as values.diskmemo is the decorator
+        module = modules["values.diskmemo"]
+        taken = []
+
+        def recording(fd, mode):
+            taken.append(mode)
+            flock(fd, mode)
+
+        with DiskMemo(self.path) as writer, DiskMemo(self.path) as reader:
+            writer.put(values(1), "one")
+            self.assertEqual(reader.get(values(1)), "one")
+
+            module.flock = recording
+            try:
+                reader.get(values(1))
+                self.assertNotIn(LOCK_EX, taken)
+
+                # replacing the files leaves the reader's index stale,
+                # and it only reopens while nobody else is reading
+                writer.compact()
+                del taken[:]
+                self.assertEqual(reader.get(values(1)), "one")
+                self.assertIn(LOCK_EX, taken)
+
+                del taken[:]
+                self.assertEqual(len(reader), 1)
+                self.assertNotIn(LOCK_EX, taken)
+
+            finally:
+                module.flock = flock
+
+
+    def test_threads(self):
+        from threading import Thread
+        from values import DiskMemo, values
+
+        failed = []
+
+        def work(memo, n):
+            try:
+                for i in range(400):
+                    key = values(n, i % 40)
+                    memo.put(key, (n, i % 40))
+                    found = memo.get(key)
+                    if found != (n, i % 40):
+                        failed.append(found)
+            except Exception as err:
+                failed.append(err)
+
+        # a small index rebuilds often, under the others' feet
+        with DiskMemo(self.path, capacity=16) as memo:
+            threads = [Thread(target=work, args=(memo, n))
+                       for n in range(4)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+
+            self.assertEqual(failed, [])
+            self.assertEqual(len(memo), 160)
+            self.assertEqual(memo.get(values(3, 39)), (3, 39))
+
+
+    def test_eviction(self):
+        from values import DiskMemo, values
+
+        with DiskMemo(self.path, max_bytes=4096) as memo:
+            for i in range(200):
+                memo.put(values(i), "x" * 100)
+                self.assertTrue(memo.size() <= 4096)
+
+            # the newest survive, the oldest were dropped
+            self.assertTrue(values(199) in memo)
+            self.assertFalse(values(0) in memo)
+
+
+    def test_decorator(self):
+        from values import diskmemo
+
+        calls = []
+
+        def work(a, b=0):
+            calls.append((a, b))
+            return a * 10 + b
+
+        first = diskmemo(self.path)(work)
+        self.assertEqual(first(4, b=2), 42)
+        self.assertEqual(first(4, b=2), 42)
+        self.assertEqual(calls, [(4, 2)])
+        first.memo.close()
+
+        # a new decorator over the same path, as after a restart
+        second = diskmemo(self.path)(work)
+        self.assertEqual(second(4, b=2), 42)
+        self.assertEqual(calls, [(4, 2)])
+
+        # passing by keyword is a different set of argument values
+        self.assertEqual(second(b=2, a=4), 42)
+        self.assertEqual(calls, [(4, 2), (4, 2)])
+        second.memo.close()
+
+
+    def test_without_fcntl(self):
+        from subprocess import check_output
+        from sys import executable
+
+        # values itself must still import where there is no flock
+        script = ("import sys; sys.modules['fcntl'] = None; "
+                  "import values; "
+                  "print(values.values(1), hasattr(values, 'DiskMemo'))")
+        here = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+        out = check_output([executable, "-c", script], cwd=here)
+        self.assertEqual(out.split(), [b"values(1)", b"False"])
+
+
+class CanonicalTest(TestCase):
+
+
+    def test_xxh64(self):
+        """
+        The stable hash is XXH64, check against its reference vectors
+        """
+
+        from values import _xxh64
+
+        self.assertEqual(_xxh64(b""), 0xEF46DB3751D8E999)
+        self.assertEqual(_xxh64(b"a"), 0xD24EC4F1A98C6E5B)
+        self.assertEqual(_xxh64(b"abc"), 0x44BC2CF5AD770999)
+
+
+    def test_agreement(self):
+        """
+        The native and pure-Python stable hashes must agree
+        """
+
+        try:
+            from values import cvalues, pyvalues
+        except ImportError:
+            self.skipTest("native values unavailable")
+
+        samples = (
+            ((), {}),
+            ((1, 2, 3), {}),
+            ((), {"foo": 4, "bar": 5}),
+            ((None, True, False, 1.5, float("nan"), -0.0), {"z": "zed"}),
+            ((2 ** 64, -2 ** 63, 2 ** 63 - 1, "x" * 1000), {"b": b"y"}),
+            ((("tuple", (1, )), ), {"\u00e9": 1, "e": 2, "ee": 3}),
+        )
+
+        for args, kwds in samples:
+            c = cvalues(*args, **kwds)
+            p = pyvalues(*args, **kwds)
+            self.assertEqual(c.stable_hash(), p.stable_hash())
+            self.assertEqual(c.stable_hash(7), p.stable_hash(7))
+            self.assertEqual(c.canonical_bytes(), p.canonical_bytes())
+
+        c = cvalues(cvalues(1, a=2), b=cvalues())
+        p = pyvalues(pyvalues(1, a=2), b=pyvalues())
+        self.assertEqual(c.stable_hash(), p.stable_hash())
+
+
+    def test_stable_hash_many(self):
+        from values import stable_hash_many, values
+
+        recs = [values(i, name="n%i" % i) for i in range(100)]
+        hashed = stable_hash_many(recs)
+
+        self.assertEqual(hashed.typecode, "Q")
+        self.assertEqual(list(hashed), [v.stable_hash() for v in recs])
+        self.assertEqual(list(stable_hash_many(recs, 3)),
+                         [v.stable_hash(3) for v in recs])
+        self.assertEqual(len(stable_hash_many([])), 0)
+
+
+    def test_from_canonical(self):
+        """
+        Decoding the canonical encoding, natively and in pure Python
+        """
+
+        from values import pyfrom_canonical, pyvalues, values
+        from values import from_canonical
+
+        samples = (
+            values(),
+            values(1, 2, 3),
+            values(None, True, False, 1.5, -0.0, foo="bar"),
+            values(2 ** 64, -2 ** 63, 2 ** 63 - 1, b=b"y", e="\u00e9"),
+            values(("tuple", (1, )), inner=values(1, a=2)),
+        )
+
+        for decode in (from_canonical, pyfrom_canonical):
+            for v in samples:
+                data = v.canonical_bytes()
+                self.assertEqual(decode(data).canonical_bytes(), data)
+                self.assertEqual(decode(memoryview(data)).canonical_bytes(),
+                                 data)
+
+            self.assertEqual(decode(b"t" + bytes(8)), ())
+            self.assertEqual(decode(b"N"), None)
+
+            data = samples[-1].canonical_bytes()
+            self.assertRaises(ValueError, decode, b"")
+            self.assertRaises(ValueError, decode, b"?")
+            self.assertRaises(ValueError, decode, data[:-1])
+            self.assertRaises(ValueError, decode, data + b"N")
+            self.assertRaises(ValueError, decode, b"s\xff" + bytes(7))
+
+        for v in samples:
+            self.assertEqual(from_canonical(v.canonical_bytes()), v)
+
+        self.assertEqual(type(pyfrom_canonical(samples[1].canonical_bytes())),
+                         pyvalues)
+
+
+    def test_interpreters(self):
+        """
+        On 3.11, values are sent through subinterpreter channels
+        directly, and decoded on the other side
+        """
+
+        try:
+            import _xxsubinterpreters as interpreters
+        except ImportError:
+            self.skipTest("no subinterpreter channels")
+
+        import values as root
+        from values import values
+
+        root = os.path.dirname(root.__file__)
+
+        v = values(1, "two", b"3", (4.0, None), big=2 ** 70,
+                   inner=values(x=1))
+        if not interpreters.is_shareable(v):
+            self.skipTest("values are not registered as shareable")
+
+        chan = interpreters.channel_create()
+        try:
+            interpreters.channel_send(chan, v)
+            got = interpreters.channel_recv(chan)
+            self.assertEqual(got, v)
+            self.assertIsNot(got, v)
+
+            interp = interpreters.create()
+            try:
+                # the new interpreter starts from the default sys.path
+                interpreters.run_string(interp, "\n".join((
+                    "import sys",
+                    "sys.path.insert(0, %r)" % os.path.dirname(root),
+                    "import _xxsubinterpreters as interpreters",
+                    "from values import values",
+                    "interpreters.channel_send(%i, values(1, name='sub'))"
+                    % int(chan),
+                )))
+
+                # the sent data belongs to the sender until received
+                self.assertEqual(interpreters.channel_recv(chan),
+                                 values(1, name="sub"))
+            finally:
+                interpreters.destroy(interp)
+        finally:
+            interpreters.channel_destroy(chan)
+
+
 #
 # The end.
@@ -21,7 +21,25 @@ license: LGPL v.3
 """
 
 
-__ALL__ = ("values", )
+__ALL__ = ("values", "stable_hash_many", "partition", "groupby",
+           "sort_by", "aggregate", "csv_reader", "from_canonical",
+           "SharedMemo", "Channel", "pipe", "formatter", "repr_cache",
+           "profile", "Index", "join", "where", "compact",
+           "DiskMemo", "diskmemo", )
+
+
+import csv
+
+from _string import formatter_parser, formatter_field_name_split
+
+from array import array
+from threading import Lock, get_ident
+from time import perf_counter_ns
+from types import MethodType
+from functools import wraps
+from operator import itemgetter, eq, ne, lt, le, gt, ge
+from hashlib import new as _new_hash
+from struct import Struct
 
 
 # we'll implement most of these features in pure Python first. Then
@@ -29,27 +47,154 @@ __ALL__ = ("values", )
 # we'll just use that instead.
 
 
+class _pylazy_field(object):
+    """
+    A placeholder for a lazily computed keyword of a values
+    """
+
+    __slots__ = ("thunk", "value", "lock", "owner")
+
+    _unforced = object()
+
+
+    def __init__(self, thunk):
+        self.thunk = thunk
+        self.value = self._unforced
+        self.lock = Lock()
+        self.owner = None
+
+
+    def force(self):
+        value = self.value
+        if value is not self._unforced:
+            return value
+
+        if not self.lock.acquire(False):
+            if self.owner == get_ident():
+                raise RecursionError("lazy field depends upon itself")
+            self.lock.acquire()
+
+        try:
+            value = self.value
+            if value is self._unforced:
+                self.owner = get_ident()
+                try:
+                    value = self.thunk()
+                finally:
+                    self.owner = None
+                self.value = value
+                self.thunk = None
+            return value
+
+        finally:
+            self.lock.release()
+
+
+_repr_cache_limit = [0]
+
+_repr_stable_types = (type(None), bool, int, float, complex, str, bytes)
+
+
+def _repr_stable(obj):
+    kind = type(obj)
+    if kind in _repr_stable_types:
+        return True
+    elif kind is tuple:
+        return all(map(_repr_stable, obj))
+    else:
+        # a nested values only qualifies if its own repr was kept
+        return kind is pyvalues and obj._pyvalues__repr is not None
+
+
+def pyrepr_cache(limit):
+    """
+    Sets the length of the longest repr a values will keep for reuse,
+    returning the previous limit. Zero, the default, keeps none. Only
+    reprs made entirely of None, bools, numbers, strs, bytes, and
+    tuples or values of those are kept
+    """
+
+    limit = int(limit)
+    if limit < 0:
+        raise ValueError("repr_cache limit must be >= 0")
+
+    previous = _repr_cache_limit[0]
+    _repr_cache_limit[0] = limit
+    return previous
+
+
 class pyvalues(object):
 
+    # mirror the native layout, so that subclasses declaring their own
+    # __slots__ behave the same under either implementation
+    __slots__ = ("__args", "__kwds", "__hashed", "__lazy", "__repr",
+                 "__weakref__")
+
+
     def __init__(self, *args, **kwds):
         self.__args = args
         self.__kwds = kwds
         self.__hashed = None
+        self.__lazy = False
+        self.__repr = None
+
+
+    @classmethod
+    def lazy(cls, *args, **thunks):
+        """
+        A values whose keywords are each computed by calling their
+        thunk with no arguments, once, the first time the keyword is
+        needed
+        """
+
+        for key, thunk in thunks.items():
+            if not callable(thunk):
+                raise TypeError("lazy field %r requires a callable, not %s" %
+                                (key, type(thunk).__name__))
+            thunks[key] = _pylazy_field(thunk)
+
+        result = cls(*args, **thunks)
+        result.__lazy = bool(thunks)
+        return result
+
+
+    def __force(self):
+        kwds = self.__kwds
+        for key, value in list(kwds.items()):
+            if type(value) is _pylazy_field:
+                kwds[key] = value.force()
+        self.__lazy = False
 
 
     def __repr__(self):
+        result = self.__repr
+        if result is not None:
+            return result
+
+        if self.__lazy:
+            self.__force()
 
         members = []
         members.extend(map(repr, self.__args))
         members.extend(map("%s=%r".__mod__, self.__kwds.items()))
         members = ", ".join(members)
 
-        return "values(" + members + ")"
+        result = "values(" + members + ")"
+
+        limit = _repr_cache_limit[0]
+        if limit and len(result) <= limit and \
+           _repr_stable(self.__args) and \
+           all(map(_repr_stable, self.__kwds.values())):
+            self.__repr = result
+
+        return result
 
 
     def __hash__(self):
         result = self.__hashed
         if result is None:
+            if self.__lazy:
+                self.__force()
             result = (hash((self.__args, frozenset(self.__kwds.items())))
                       if self.__kwds else hash(self.__args))
             self.__hashed = result
@@ -61,9 +206,12 @@ class pyvalues(object):
         if self is other:
             return True
 
-        _values = type(self)
+        if self.__lazy:
+            self.__force()
 
-        if isinstance(other, _values):
+        if isinstance(other, pyvalues):
+            if other.__lazy:
+                other.__force()
             return ((self.__args == other.__args) and
                     (self.__kwds == other.__kwds))
 
@@ -90,7 +238,7 @@ class pyvalues(object):
     def __add__(self, other):
         _values = type(self)
 
-        if isinstance(other, _values):
+        if isinstance(other, pyvalues):
             return self(_values, *other, **other)
 
         elif isinstance(other, dict):
@@ -103,7 +251,7 @@ class pyvalues(object):
     def __radd__(self, left):
         _values = type(self)
 
-        if isinstance(left, type(self)):
+        if isinstance(left, pyvalues):
             return left(_values, *self, **self)
 
         elif isinstance(left, dict):
@@ -124,15 +272,91 @@ class pyvalues(object):
     def __getitem__(self, key):
         if isinstance(key, (slice, int)):
             return self.__args[key]
-        else:
-            return self.__kwds[key]
+
+        value = self.__kwds[key]
+        if type(value) is _pylazy_field:
+            value = self.__kwds[key] = value.force()
+        return value
 
 
     def keys(self):
         return self.__kwds.keys()
 
 
+    def __project(self, kwds):
+        result = type(self)(*self.__args, **kwds)
+        result.__lazy = bool(kwds) and self.__lazy
+        return result
+
+
+    def select(self, *keys):
+        """
+        A values with these positionals and only the named keywords, in
+        the order named. Raises KeyError for a name not present
+        """
+
+        kwds = self.__kwds
+        return self.__project({key: kwds[key] for key in keys})
+
+
+    def without(self, *keys):
+        """
+        A values with these positionals and all of the keywords but the
+        named ones. Names not present are ignored
+        """
+
+        if not (keys and self.__kwds):
+            return self
+
+        return self.__project({key: value for key, value
+                               in self.__kwds.items() if key not in keys})
+
+
+    def rename(self, **names):
+        """
+        A values with these positionals and keywords, where each keyword
+        given as old="new" is renamed in place. Raises KeyError for an
+        old name not present, and ValueError if a new name would
+        overwrite another keyword
+        """
+
+        if not names:
+            return self
+
+        for key, name in names.items():
+            if not isinstance(name, str):
+                raise TypeError("rename() new name for %r must be a str,"
+                                " not %s" % (key, type(name).__name__))
+            if key not in self.__kwds:
+                raise KeyError(key)
+
+        kwds = {}
+        for key, value in self.__kwds.items():
+            name = names.get(key, key)
+            if name in kwds:
+                raise ValueError("rename() would overwrite keyword %r" %
+                                 name)
+            kwds[name] = value
+
+        return self.__project(kwds)
+
+
+    def stable_hash(self, seed=0):
+        return _xxh64(canonical_encode(self), seed)
+
+
+    def canonical_bytes(self):
+        return canonical_encode(self)
+
+
+    def digest(self, algorithm="blake2b"):
+        return _new_hash(algorithm, canonical_encode(self)).digest()
+
+
     def __call__(self, function, *args, **kwds):
+        if self.__lazy:
+            self.__force()
+
         if args:
             if self.__args:
                 args = self.__args + args
@@ -150,6 +374,1157 @@ class pyvalues(object):
         return function(*args, **kwds)
 
 
+# canonical encoding, see values/_canonical.c for the format. These
+# two implementations must produce identical bytes.
+
+_u64 = Struct("<Q")
+_u64x4 = Struct("<4Q")
+_i64 = Struct("<q")
+_f64 = Struct("<d")
+
+_NAN = _f64.pack(float("nan"))
+_INT64_MIN = -(1 << 63)
+_INT64_MAX = (1 << 63) - 1
+
+
+def _canonical(obj, out):
+
+    if obj is None:
+        out.append(b"N")
+
+    elif obj is True:
+        out.append(b"T")
+
+    elif obj is False:
+        out.append(b"F")
+
+    elif isinstance(obj, int):
+        if _INT64_MIN <= obj <= _INT64_MAX:
+            out.append(b"i")
+            out.append(_i64.pack(obj))
+        else:
+            data = int.to_bytes(obj, (int.bit_length(obj) + 8) // 8,
+                                "little", signed=True)
+            out.append(b"I")
+            out.append(_u64.pack(len(data)))
+            out.append(data)
+
+    elif isinstance(obj, float):
+        out.append(b"f")
+        out.append(_NAN if obj != obj else _f64.pack(obj))
+
+    elif isinstance(obj, str):
+        data = obj.encode("utf-8")
+        out.append(b"s")
+        out.append(_u64.pack(len(data)))
+        out.append(data)
+
+    elif isinstance(obj, bytes):
+        out.append(b"b")
+        out.append(_u64.pack(len(obj)))
+        out.append(obj)
+
+    elif isinstance(obj, _values_types):
+        args = tuple(obj)
+        out.append(b"v")
+        out.append(_u64.pack(len(args)))
+        for item in args:
+            _canonical(item, out)
+
+        keys = []
+        for key in obj.keys():
+            if not isinstance(key, str):
+                raise TypeError("cannot canonically encode a values"
+                                " with a non-str keyword %r" % (key, ))
+            keys.append((key.encode("utf-8"), key))
+        keys.sort()
+
+        out.append(_u64.pack(len(keys)))
+        for data, key in keys:
+            out.append(_u64.pack(len(data)))
+            out.append(data)
+            _canonical(obj[key], out)
+
+    elif isinstance(obj, tuple):
+        out.append(b"t")
+        out.append(_u64.pack(len(obj)))
+        for item in obj:
+            _canonical(item, out)
+
+    else:
+        raise TypeError("cannot canonically encode an object of type %s" %
+                        type(obj).__name__)
+
+
+def canonical_encode(obj):
+    out = []
+    _canonical(obj, out)
+    return b"".join(out)
+
+
+def _decode_len(data, pos):
+    (count, ) = _u64.unpack_from(data, pos)
+    if count > len(data) - pos - 8:
+        raise ValueError("truncated canonical encoding")
+    return count, pos + 8
+
+
+def _decode(data, pos):
+    if pos >= len(data):
+        raise ValueError("truncated canonical encoding")
+
+    tag = data[pos:pos + 1]
+    pos += 1
+
+    if tag == b"N":
+        return None, pos
+    elif tag == b"T":
+        return True, pos
+    elif tag == b"F":
+        return False, pos
+
+    elif tag == b"i" or tag == b"f":
+        if pos + 8 > len(data):
+            raise ValueError("truncated canonical encoding")
+        packer = _i64 if tag == b"i" else _f64
+        return packer.unpack_from(data, pos)[0], pos + 8
+
+    elif tag == b"I" or tag == b"s" or tag == b"b":
+        count, pos = _decode_len(data, pos)
+        chunk = bytes(data[pos:pos + count])
+        pos += count
+        if tag == b"I":
+            return int.from_bytes(chunk, "little", signed=True), pos
+        elif tag == b"s":
+            return chunk.decode("utf-8"), pos
+        else:
+            return chunk, pos
+
+    elif tag == b"t":
+        count, pos = _decode_len(data, pos)
+        items = []
+        for _ in range(count):
+            item, pos = _decode(data, pos)
+            items.append(item)
+        return tuple(items), pos
+
+    elif tag == b"v":
+        count, pos = _decode_len(data, pos)
+        args = []
+        for _ in range(count):
+            item, pos = _decode(data, pos)
+            args.append(item)
+
+        count, pos = _decode_len(data, pos)
+        kwds = {}
+        for _ in range(count):
+            keylen, pos = _decode_len(data, pos)
+            key = bytes(data[pos:pos + keylen]).decode("utf-8")
+            kwds[key], pos = _decode(data, pos + keylen)
+
+        return pyvalues(*args, **kwds), pos
+
+    else:
+        raise ValueError("unknown canonical encoding tag 0x%02x" % tag[0])
+
+
+def pyfrom_canonical(data):
+    """
+    Decodes the canonical encoding in data, as produced by
+    canonical_bytes, back into values, tuples and scalars
+    """
+
+    data = memoryview(data).cast("B")
+    result, pos = _decode(data, 0)
+    if pos != len(data):
+        raise ValueError("trailing data after canonical encoding")
+    return result
+
+
+_P1 = 0x9E3779B185EBCA87
+_P2 = 0xC2B2AE3D27D4EB4F
+_P3 = 0x165667B19E3779F9
+_P4 = 0x85EBCA77C2B2AE63
+_P5 = 0x27D4EB2F165667C5
+_M64 = 0xFFFFFFFFFFFFFFFF
+
+
+def _rotl(x, r):
+    return ((x << r) | (x >> (64 - r))) & _M64
+
+
+def _round(acc, lane):
+    return (_rotl((acc + lane * _P2) & _M64, 31) * _P1) & _M64
+
+
+def _xxh64(data, seed=0):
+    seed &= _M64
+    length = len(data)
+    offset = 0
+
+    if length >= 32:
+        v1 = (seed + _P1 + _P2) & _M64
+        v2 = (seed + _P2) & _M64
+        v3 = seed
+        v4 = (seed - _P1) & _M64
+
+        while offset + 32 <= length:
+            a, b, c, d = _u64x4.unpack_from(data, offset)
+            v1 = _round(v1, a)
+            v2 = _round(v2, b)
+            v3 = _round(v3, c)
+            v4 = _round(v4, d)
+            offset += 32
+
+        h = (_rotl(v1, 1) + _rotl(v2, 7) +
+             _rotl(v3, 12) + _rotl(v4, 18)) & _M64
+        for v in (v1, v2, v3, v4):
+            h = (((h ^ _round(0, v)) * _P1) + _P4) & _M64
+    else:
+        h = (seed + _P5) & _M64
+
+    h = (h + length) & _M64
+
+    while offset + 8 <= length:
+        h ^= _round(0, _u64.unpack_from(data, offset)[0])
+        h = (_rotl(h, 27) * _P1 + _P4) & _M64
+        offset += 8
+
+    if offset + 4 <= length:
+        h ^= (int.from_bytes(data[offset:offset + 4], "little") * _P1) & _M64
+        h = (_rotl(h, 23) * _P2 + _P3) & _M64
+        offset += 4
+
+    while offset < length:
+        h ^= (data[offset] * _P5) & _M64
+        h = (_rotl(h, 11) * _P1) & _M64
+        offset += 1
+
+    h ^= h >> 33
+    h = (h * _P2) & _M64
+    h ^= h >> 29
+    h = (h * _P3) & _M64
+    h ^= h >> 32
+
+    return h
+
+
+def pystable_hash_many(seq, seed=0):
+    return array("Q", (_xxh64(canonical_encode(v), seed) for v in seq))
+
+
+def pypartition(seq, n, key=None, stable=False):
+    if n < 1:
+        raise ValueError("partition requires n >= 1")
+
+    parts = [[] for _ in range(n)]
+    for item in seq:
+        k = item if key is None else key(item)
+        h = _xxh64(canonical_encode(k)) if stable else hash(k)
+        parts[h % n].append(item)
+
+    return parts
+
+
+def pygroupby(records, *keys):
+    if not keys:
+        raise TypeError("groupby requires records and at least one key")
+
+    groups = {}
+    if len(keys) == 1:
+        key, = keys
+        for rec in records:
+            groups.setdefault(rec[key], []).append(rec)
+    else:
+        for rec in records:
+            groups.setdefault(tuple(rec[k] for k in keys), []).append(rec)
+
+    return groups
+
+
+def pysort_by(records, *keys, reverse=False):
+    if not keys:
+        raise TypeError("sort_by requires records and at least one key")
+
+    # a stable pass per key, from the last to the first, so that a key
+    # of floats can put its NaNs last whichever way it is sorted
+    result = list(records)
+    for key in reversed(keys):
+        field = itemgetter(key)
+        column = list(map(field, result))
+
+        nans = []
+        if column and all(type(val) is float for val in column):
+            nans = [rec for rec, val in zip(result, column) if val != val]
+            result = [rec for rec, val in zip(result, column) if val == val]
+
+        result.sort(key=field, reverse=reverse)
+        result.extend(nans)
+
+    return result
+
+
+def _fields(given):
+    if given is None:
+        return ()
+    elif isinstance(given, (str, int)):
+        return (given, )
+    else:
+        return tuple(given)
+
+
+def pyaggregate(records, by=(), count=True,
+                sum=(), min=(), max=(), mean=()):
+
+    by = _fields(by)
+    specs = []
+    for op, given in (("sum", sum), ("min", min),
+                      ("max", max), ("mean", mean)):
+        specs.extend((op, field, "%s_%s" % (op, field))
+                     for field in _fields(given))
+
+    groups = {}
+    for rec in records:
+        if not by:
+            key = None
+        elif len(by) == 1:
+            key = rec[by[0]]
+        else:
+            key = tuple(rec[k] for k in by)
+
+        group = groups.get(key)
+        if group is None:
+            group = groups[key] = [0] + [None] * len(specs)
+
+        group[0] += 1
+        for index, (op, field, _name) in enumerate(specs, 1):
+            val = rec[field]
+            best = group[index]
+            if best is None:
+                group[index] = val
+            elif op == "min":
+                if val < best:
+                    group[index] = val
+            elif op == "max":
+                if val > best:
+                    group[index] = val
+            else:
+                group[index] = best + val
+
+    results = []
+    for key, group in groups.items():
+        args = []
+        kwds = {}
+        keys = (key, ) if len(by) == 1 else key
+        for field, val in zip(by, keys or ()):
+            if isinstance(field, str):
+                kwds[field] = val
+            else:
+                args.append(val)
+
+        if count:
+            kwds["count"] = group[0]
+
+        for index, (op, _field, name) in enumerate(specs, 1):
+            val = group[index]
+            kwds[name] = (val / group[0]) if op == "mean" else val
+
+        results.append(pyvalues(*args, **kwds))
+
+    return results
+
+
+def pycsv_reader(fileobj, header=True, types=None,
+                 delimiter=",", quotechar='"'):
+
+    rows = csv.reader(fileobj, delimiter=delimiter, quotechar=quotechar,
+                      strict=True)
+    try:
+        for row in _pycsv_rows(rows, header, types):
+            yield row
+    except csv.Error as err:
+        # the native reader raises ValueError for malformed text
+        raise ValueError("csv line %i: %s" % (rows.line_num, err)) from err
+
+
+def _pycsv_rows(rows, header, types):
+
+    if header is True:
+        header = next(rows, None)
+    elif header is False:
+        header = None
+
+    if header is not None:
+        header = tuple(header)
+
+    if types is None:
+        converters = ()
+    elif isinstance(types, dict):
+        count = len(header) if header else (max(types) + 1 if types else 0)
+        converters = []
+        for index in range(count):
+            name = header[index] if header else None
+            converters.append(types.get(name, types.get(index)))
+    else:
+        converters = tuple(types)
+
+    for row in rows:
+        if not row:
+            continue
+
+        for index, conv in enumerate(converters[:len(row)]):
+            if conv is not None:
+                row[index] = conv(row[index])
+
+        if header is None:
+            yield pyvalues(*row)
+
+        elif len(row) != len(header):
+            raise ValueError("csv line %i: %i fields, but the header has %i" %
+                             (rows.line_num, len(row), len(header)))
+        else:
+            yield pyvalues(**dict(zip(header, row)))
+
+
+class pypipe(object):
+    """
+    pipe(*funcs)
+
+    A callable applying each of funcs in turn, the first to the pipe's
+    own arguments and each after to the result of the one before. A
+    values passed along is splatted into the arguments of the stage
+    receiving it. Pipes among funcs are flattened into this one
+    """
+
+    __slots__ = ("funcs", )
+
+
+    def __init__(self, *funcs):
+        if not funcs:
+            raise TypeError("pipe requires at least one function")
+
+        flat = []
+        for func in funcs:
+            if type(func) is pypipe:
+                flat.extend(func.funcs)
+            elif not callable(func):
+                raise TypeError("pipe stages must be callable, not %s" %
+                                type(func).__name__)
+            else:
+                flat.append(func)
+
+        self.funcs = tuple(flat)
+
+
+    def __repr__(self):
+        return "pipe(%s)" % ", ".join(map(repr, self.funcs))
+
+
+    def __call__(self, *args, **kwds):
+        funcs = self.funcs
+
+        if len(args) == 1 and not kwds and isinstance(args[0], _values_types):
+            result = args[0](funcs[0])
+        else:
+            result = funcs[0](*args, **kwds)
+
+        for func in funcs[1:]:
+            if isinstance(result, _values_types):
+                result = result(func)
+            else:
+                result = func(result)
+
+        return result
+
+
+class pyformatter(object):
+    """
+    formatter(template)
+
+    A str.format template compiled once for repeated rendering. Called
+    with a values, its fields resolve against the values' positionals
+    and keywords directly. Called with anything else, it is the same
+    as template.format(*args, **kwds)
+    """
+
+    __slots__ = ("template", "_plan")
+
+
+    def __init__(self, template):
+        if not isinstance(template, str):
+            raise TypeError("formatter() argument must be str, not %s" %
+                            type(template).__name__)
+
+        self.template = template
+        self._plan = _compile_format(template, [False, False, 0])
+
+
+    def __repr__(self):
+        return "formatter(%r)" % self.template
+
+
+    def __call__(self, *args, **kwds):
+        if len(args) == 1 and not kwds and isinstance(args[0], _values_types):
+            only = args[0]
+            return _render_format(self._plan, tuple(only), only)
+        else:
+            return _render_format(self._plan, args, kwds)
+
+
+def _compile_format(template, numbering):
+    # numbering is [manual, automatic, next], shared with nested specs
+    plan = []
+
+    for literal, name, spec, conversion in formatter_parser(template):
+        if literal:
+            plan.append(literal)
+        if name is None:
+            continue
+
+        first, rest = formatter_field_name_split(name)
+        if first == "" or isinstance(first, int):
+            if first == "":
+                if numbering[0]:
+                    raise ValueError("cannot switch from manual field"
+                                     " specification to automatic field"
+                                     " numbering")
+                numbering[1] = True
+                first = numbering[2]
+                numbering[2] += 1
+            else:
+                if numbering[1]:
+                    raise ValueError("cannot switch from automatic field"
+                                     " numbering to manual field"
+                                     " specification")
+                numbering[0] = True
+
+        if conversion not in (None, "r", "s", "a"):
+            raise ValueError("Unknown conversion specifier %s" % conversion)
+
+        if "{" in spec:
+            spec = _compile_format(spec, numbering)
+
+        plan.append((first, tuple(rest), conversion, spec))
+
+    return plan
+
+
+_conversions = {"r": repr, "s": str, "a": ascii}
+
+
+def _render_format(plan, args, kwds):
+    pieces = []
+
+    for step in plan:
+        if type(step) is str:
+            pieces.append(step)
+            continue
+
+        first, rest, conversion, spec = step
+        if type(first) is int:
+            if first >= len(args):
+                raise IndexError("Replacement index %i out of range for"
+                                 " positional args tuple" % first)
+            obj = args[first]
+        else:
+            obj = kwds[first]
+
+        for is_attr, key in rest:
+            obj = getattr(obj, key) if is_attr else obj[key]
+
+        if conversion:
+            obj = _conversions[conversion](obj)
+
+        if type(spec) is list:
+            spec = _render_format(spec, args, kwds)
+
+        pieces.append(format(obj, spec))
+
+    return "".join(pieces)
+
+
+_PROFILE_SUB_BITS = 5
+_PROFILE_SUB = 1 << _PROFILE_SUB_BITS
+
+
+def _profile_bucket(ns):
+    if ns < 2 * _PROFILE_SUB:
+        return ns
+    shift = ns.bit_length() - 1 - _PROFILE_SUB_BITS
+    return shift * _PROFILE_SUB + (ns >> shift)
+
+
+def _profile_bucket_range(index):
+    if index < 2 * _PROFILE_SUB:
+        return index, index
+    shift = index // _PROFILE_SUB - 1
+    low = (index - shift * _PROFILE_SUB) << shift
+    return low, low + (1 << shift) - 1
+
+
+class pyprofile(object):
+    """
+    profile(func)
+
+    A callable invoking func and recording how long each call took
+    into a log-linear latency histogram, precise to about 3%. Usable
+    as a decorator, including on methods
+    """
+
+    __slots__ = ("func", "_lock", "_count", "_errors", "_total", "_min",
+                 "_max", "_buckets", "__weakref__")
+
+
+    def __init__(self, func):
+        if not callable(func):
+            raise TypeError("profile requires a callable, not %s" %
+                            type(func).__name__)
+
+        self.func = func
+        self._lock = Lock()
+        self._zero()
+
+
+    def __repr__(self):
+        return "profile(%r)" % self.func
+
+
+    def __get__(self, obj, objtype=None):
+        return self if obj is None else MethodType(self, obj)
+
+
+    def __call__(self, *args, **kwds):
+        failed = True
+        start = perf_counter_ns()
+        try:
+            result = self.func(*args, **kwds)
+            failed = False
+            return result
+        finally:
+            ns = perf_counter_ns() - start
+            with self._lock:
+                index = _profile_bucket(ns)
+                buckets = self._buckets
+                buckets[index] = buckets.get(index, 0) + 1
+                self._count += 1
+                self._total += ns
+                self._errors += failed
+                self._min = ns if self._min is None else min(self._min, ns)
+                self._max = max(self._max, ns)
+
+
+    @property
+    def count(self):
+        return self._count
+
+
+    @property
+    def errors(self):
+        return self._errors
+
+
+    def _zero(self):
+        self._count = self._errors = self._total = self._max = 0
+        self._min = None
+        self._buckets = {}
+
+
+    def _take(self, reset):
+        with self._lock:
+            found = (self._count, self._errors, self._total, self._min,
+                     self._max, dict(self._buckets))
+            if reset:
+                self._zero()
+            return found
+
+
+    @staticmethod
+    def _percentile(count, maximum, buckets, pct):
+        if not count:
+            return 0
+
+        rank = min(max(int(pct / 100.0 * count + 0.5), 1), count)
+        seen = 0
+        for index in sorted(buckets):
+            seen += buckets[index]
+            if seen >= rank:
+                return min(_profile_bucket_range(index)[1], maximum)
+
+        return maximum
+
+
+    def percentile(self, pct):
+        """
+        The duration in nanoseconds which pct percent of calls took no
+        longer than, to within the histogram's precision
+        """
+
+        if not 0 <= pct <= 100:
+            raise ValueError("percentile must be from 0 to 100")
+
+        count, _errors, _total, _min, maximum, buckets = self._take(False)
+        return self._percentile(count, maximum, buckets, pct)
+
+
+    def snapshot(self, reset=False):
+        """
+        The recorded calls as a values of count, errors, total, min,
+        max and mean, the percentiles p50, p90, p99 and p999, and
+        buckets, a tuple of (low, high, count) for each bucket holding
+        any calls. All times are in nanoseconds. With reset=True the
+        counters are cleared in the same pass, losing no calls in
+        between
+        """
+
+        count, errors, total, least, most, buckets = self._take(reset)
+
+        def pct(p):
+            return self._percentile(count, most, buckets, p)
+
+        return values(count=count, errors=errors, total=total,
+                      min=least or 0, max=most,
+                      mean=(total / count) if count else 0.0,
+                      p50=pct(50.0), p90=pct(90.0), p99=pct(99.0),
+                      p999=pct(99.9),
+                      buckets=tuple(_profile_bucket_range(index) +
+                                    (buckets[index], )
+                                    for index in sorted(buckets)))
+
+
+    def reset(self):
+        """
+        Clears the recorded calls
+        """
+
+        self._take(True)
+
+
+class _pyshapes(object):
+    """
+    The state of the pure-Python shape sampler. See _pyshape_sample
+    """
+
+    every = 0
+    countdown = 0
+    capacity = 32
+    constructed = 0
+    sampled = 0
+    arities = {}
+    shapes = {}
+
+
+    @classmethod
+    def reset(cls):
+        cls.countdown = cls.every
+        cls.constructed = 0
+        cls.sampled = 0
+        cls.arities = {}
+        cls.shapes = {}
+
+
+    @classmethod
+    def sample(cls, args, kwds):
+        cls.constructed += 1
+        cls.countdown -= 1
+        if cls.countdown > 0:
+            return
+
+        cls.countdown = cls.every
+        cls.sampled += 1
+
+        arity = min(len(args), 63)
+        cls.arities[arity] = cls.arities.get(arity, 0) + 1
+
+        # Space-Saving, with the count and error kept by key set
+        keys = frozenset(kwds)
+        shapes = cls.shapes
+        found = shapes.get(keys)
+        if found is not None:
+            found[0] += 1
+        elif len(shapes) < cls.capacity:
+            shapes[keys] = [1, 0]
+        else:
+            least = min(shapes, key=lambda k: shapes[k][0])
+            count = shapes.pop(least)[0]
+            shapes[keys] = [count + 1, count]
+
+
+_pyvalues_init = pyvalues.__init__
+
+
+def _pyvalues_init_sampled(self, *args, **kwds):
+    _pyvalues_init(self, *args, **kwds)
+    _pyshapes.sample(args, kwds)
+
+
+def _pyshape_sample(every, capacity=32):
+    """
+    Samples one in every constructed values, counting its positional
+    arity and its set of keyword names, and keeping the top capacity
+    keyword sets. Zero stops sampling. The counts are cleared, and the
+    previous every is returned
+    """
+
+    if every < 0 or capacity < 1:
+        raise ValueError("_shape_sample requires every >= 0 and"
+                         " capacity >= 1")
+
+    previous = _pyshapes.every
+    _pyshapes.every = every
+    _pyshapes.capacity = capacity
+    _pyshapes.reset()
+
+    # only pay for sampling while it's on
+    pyvalues.__init__ = _pyvalues_init_sampled if every else _pyvalues_init
+
+    return previous
+
+
+def _pyshape_report(reset=False):
+    """
+    The sampled shapes, as a values of every, constructed, sampled,
+    arities as (arity, count) pairs, and shapes as (keys, count,
+    error) heaviest first, where a keyword set's true count is between
+    count - error and count. Arities of 63 and over are counted
+    together as 63
+    """
+
+    state = _pyshapes
+    shapes = sorted(state.shapes.items(), key=lambda i: -i[1][0])
+
+    report = pyvalues.__new__(pyvalues)
+    _pyvalues_init(report, every=state.every,
+                   constructed=state.constructed, sampled=state.sampled,
+                   arities=tuple(sorted(state.arities.items())),
+                   shapes=tuple((tuple(sorted(keys)), count, error)
+                                for keys, (count, error) in shapes))
+
+    if reset:
+        state.reset()
+
+    return report
+
+
+def _pymemory_report(limit=10):
+    """
+    The bytes held by every live values, as count and total, broken
+    down as struct, args, kwds and repr, and as shapes, the limit
+    heaviest (arity, keys, count, bytes). Storage shared between
+    values is counted once. Members of the values are not counted
+    """
+
+    from gc import get_objects
+    from sys import getsizeof
+
+    seen = set()
+
+    def once(obj):
+        if obj is None or id(obj) in seen:
+            return 0
+        seen.add(id(obj))
+        return getsizeof(obj)
+
+    count = 0
+    kinds = dict.fromkeys(("struct", "args", "kwds", "repr"), 0)
+    shapes = {}
+
+    for obj in get_objects():
+        if not isinstance(obj, pyvalues):
+            continue
+
+        args = obj._pyvalues__args
+        kwds = obj._pyvalues__kwds
+        sizes = (once(obj), once(args) if args else 0, once(kwds),
+                 once(obj._pyvalues__repr))
+
+        total = 0
+        for kind, size in zip(("struct", "args", "kwds", "repr"), sizes):
+            kinds[kind] += size
+            total += size
+        count += 1
+
+        shape = (len(args), tuple(sorted(kwds)))
+        entry = shapes.setdefault(shape, [0, 0])
+        entry[0] += 1
+        entry[1] += total
+
+    heaviest = sorted(((-nbytes, num, arity, keys)
+                       for (arity, keys), (num, nbytes) in shapes.items()))
+
+    return pyvalues(count=count, total=sum(kinds.values()), **kinds,
+                      shapes=tuple((arity, keys, num, -nbytes) for
+                                 nbytes, num, arity, keys
+                                 in heaviest[:limit]))
+
+
+def pycompact(records, fields=None):
+    """
+    Has the values in records share one object for each equal str,
+    bytes, int or float member, swapping out the duplicates in place.
+    Only the given fields are compacted, where there are any. Reports
+    count of records, how many members were replaced, and the bytes
+    reclaimed by duplicates nothing else was holding, less those of
+    any positional tuples copied because something else shared them
+    """
+
+    from sys import getrefcount, getsizeof
+
+    if fields is not None:
+        fields = (fields, ) if isinstance(fields, (str, int)) \
+            else tuple(fields)
+
+    # one table per type, as 1 and 1.0 are equal but not the same
+    tables = {str: {}, bytes: {}, int: {}, float: {}}
+
+    # the duplicates swapped out, and the positional tuples replaced,
+    # kept until the end to see which of them nothing else holds
+    displaced = {}
+    rebuilt = {}
+    replaced = 0
+    reclaimed = 0
+
+    def alone(held):
+        # empties held, yielding those of its objects nothing else
+        # refers to, as judged against a sentinel counted the same way
+        objects = [object()]
+        objects.extend(held.values())
+        held.clear()
+
+        floor = None
+        for obj in objects:
+            refs = getrefcount(obj)
+            if floor is None:
+                floor = refs
+            elif refs <= floor:
+                yield obj
+
+    def canonical(value):
+        nonlocal replaced
+
+        table = tables.get(type(value))
+        # zeros are left be, as -0.0 is equal to 0.0 but has another repr
+        if table is None or (type(value) is float and value == 0.0):
+            return value
+        found = table.setdefault(value, value)
+        if found is not value:
+            displaced[id(value)] = value
+            replaced += 1
+        return found
+
+    count = 0
+    for rec in records:
+        if not isinstance(rec, pyvalues):
+            raise TypeError("compact expects values, not %s" %
+                            type(rec).__name__)
+        count += 1
+
+        arity = len(rec._pyvalues__args)
+        kwds = rec._pyvalues__kwds
+
+        if fields is None:
+            positions = range(arity)
+            keys = list(kwds)
+        else:
+            positions = [field for field in fields if isinstance(field, int)
+                         and -arity <= field < arity]
+            keys = [field for field in fields if field in kwds]
+
+        if positions:
+            args = list(rec._pyvalues__args)
+            for index in positions:
+                args[index] = canonical(args[index])
+
+            if any(new is not old for new, old
+                   in zip(args, rec._pyvalues__args)):
+                # the old tuple may be shared, and is freed only if not
+                rebuilt[id(rec._pyvalues__args)] = rec._pyvalues__args
+                rec._pyvalues__args = tuple(args)
+                reclaimed -= getsizeof(rec._pyvalues__args)
+
+        for key in keys:
+            kwds[key] = canonical(kwds[key])
+
+    # the old tuples go first, as those still held elsewhere also
+    # hold on to their members
+    reclaimed += sum(map(getsizeof, alone(rebuilt)))
+    reclaimed += sum(map(getsizeof, alone(displaced)))
+
+    return pyvalues(count=count, replaced=replaced, reclaimed=reclaimed)
+
+
+class pyIndex(object):
+    """
+    Index(records=(), on=fields)
+
+    A hash index of records by the given field or fields. Supports
+    get, get_all, in and len, and is kept up to date by add and
+    discard
+    """
+
+    __slots__ = ("on", "_groups", "_len", )
+
+
+    def __init__(self, records=(), on=None):
+        if on is None:
+            raise TypeError("Index requires the fields it is on")
+
+        on = _fields(on)
+        if not on:
+            raise ValueError("on requires at least one field")
+
+        self.on = on
+        self._groups = {}
+        self._len = 0
+
+        for rec in records or ():
+            self.add(rec)
+
+
+    def _key(self, rec):
+        on = self.on
+        if len(on) == 1:
+            return rec[on[0]]
+        return tuple(rec[field] for field in on)
+
+
+    def _check(self, key):
+        count = len(self.on)
+        if count > 1 and not (isinstance(key, tuple) and len(key) == count):
+            raise TypeError("Index on %i fields requires keys which are a"
+                            " tuple of %i values" % (count, count))
+
+
+    def __len__(self):
+        return self._len
+
+
+    def __contains__(self, key):
+        self._check(key)
+        return key in self._groups
+
+
+    def get(self, key, default=None):
+        self._check(key)
+        group = self._groups.get(key)
+        return group[0] if group else default
+
+
+    def get_all(self, key):
+        self._check(key)
+        return list(self._groups.get(key, ()))
+
+
+    def add(self, rec):
+        self._groups.setdefault(self._key(rec), []).append(rec)
+        self._len += 1
+
+
+    def discard(self, rec):
+        try:
+            key = self._key(rec)
+        except (KeyError, IndexError):
+            return
+
+        group = self._groups.get(key)
+        if group and rec in group:
+            group.remove(rec)
+            self._len -= 1
+            if not group:
+                del self._groups[key]
+
+
+def pyjoin(left, right, on, how="inner"):
+    if how not in ("inner", "left"):
+        raise ValueError("join how must be \"inner\" or \"left\", not"
+                         " \"%s\"" % how)
+
+    index = pyIndex(right, on=on)
+    key = index._key
+    outer = (how == "left")
+
+    joined = []
+    for rec in left:
+        matches = index.get_all(key(rec))
+        if matches:
+            joined.extend(rec + match for match in matches)
+        elif outer:
+            joined.append(rec)
+
+    return joined
+
+
+def _contains(value, operand):
+    return value in operand
+
+
+def _contains_members(value, operand):
+    members, operand = operand
+    try:
+        return value in members
+    except TypeError:
+        # an unhashable value may still be equal to one of them
+        return value in operand
+
+
+_where_ops = {"__ne": ne, "__lt": lt, "__le": le,
+              "__gt": gt, "__ge": ge, "__in": _contains, }
+
+
+class pywhere(object):
+    """
+    where(**conditions)
+
+    A predicate over records, true of a record when every condition
+    holds. field=value tests for equality, and field__ne, __lt, __le,
+    __gt, __ge or __in for that operator. Call it with a record, or
+    use filter or count over many
+    """
+
+    __slots__ = ("_conditions", "_tests", )
+
+
+    def __init__(self, **conditions):
+        tests = []
+        for name, operand in conditions.items():
+            op = _where_ops.get(name[-4:]) if len(name) > 4 else None
+            if op is None:
+                field, op = name, eq
+            else:
+                field = name[:-4]
+
+            if op is _contains and isinstance(operand, (list, tuple)):
+                try:
+                    op, operand = _contains_members, (frozenset(operand),
+                                                      operand)
+                except TypeError:
+                    pass
+
+            tests.append((field, op, operand))
+
+        self._conditions = conditions
+        self._tests = tuple(tests)
+
+
+    def __repr__(self):
+        return "where(%s)" % ", ".join("%s=%r" % item for item
+                                       in self._conditions.items())
+
+
+    def __call__(self, rec):
+        for field, op, operand in self._tests:
+            if not op(rec[field], operand):
+                return False
+        return True
+
+
+    def filter(self, records):
+        return [rec for rec in records if self(rec)]
+
+
+    def count(self, records):
+        return sum(1 for rec in records if self(rec))
+
+
 try:
     # let's see if we're on a platform that supports extensions
     from ._values import cvalues
@@ -157,10 +1532,79 @@ try:
 except ImportError:
     # nope! that's fine, we have the plain ol' python one ready to go
     values = pyvalues
+    _values_types = (pyvalues, )
+
+    stable_hash_many = pystable_hash_many
+    partition = pypartition
+    groupby = pygroupby
+    sort_by = pysort_by
+    aggregate = pyaggregate
+    csv_reader = pycsv_reader
+    from_canonical = pyfrom_canonical
+    pipe = pypipe
+    formatter = pyformatter
+    repr_cache = pyrepr_cache
+    profile = pyprofile
+    _shape_sample = _pyshape_sample
+    _shape_report = _pyshape_report
+    _memory_report = _pymemory_report
+    compact = pycompact
+    Index = pyIndex
+    join = pyjoin
+    where = pywhere
 
 else:
     # we prefer the native one though
     values = cvalues
+    _values_types = (pyvalues, cvalues)
+
+    from ._values import stable_hash_many, partition, groupby, aggregate
+    from ._values import sort_by
+    from ._values import csv_reader, from_canonical
+    from ._values import SharedMemo as _SharedMemo
+    from ._values import Channel, pipe, formatter, repr_cache, profile
+    from ._values import _shape_sample, _shape_report, _memory_report
+    from ._values import compact
+    from ._values import Index, join, where
+
+
+    class SharedMemo(_SharedMemo):
+        """
+        SharedMemo(name, capacity, slot_size=1024)
+
+        A memo table in named POSIX shared memory, which every process
+        on the host opening the same name will share. Keys are encoded
+        canonically, results are stored pickled.
+        """
+
+        def memoize(self, function):
+            """
+            Decorates function so that its results are looked up in,
+            and stored into, this table, keyed by its qualified name
+            and the values of its arguments.
+            """
+
+            name = "%s.%s" % (function.__module__, function.__qualname__)
+            missing = object()
+
+            @wraps(function)
+            def memoized(*args, **kwds):
+                key = values(name, *args, **kwds)
+                found = self.get(key, missing)
+                if found is missing:
+                    found = function(*args, **kwds)
+                    self.put(key, found)
+                return found
+
+            return memoized
+
+
+try:
+    # the disk memo locks with flock, which not every platform has
+    from .diskmemo import DiskMemo, diskmemo  # noqa: E402
+
+except ImportError:
+    pass
 
 
 #
@@ -0,0 +1,1027 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values canonical encoding
+
+   A deterministic, process-independent byte encoding of values and
+   the scalars they may contain, and the stable hash computed over it.
+
+   Every encoded object starts with a one-byte type tag. Lengths and
+   counts are unsigned 64-bit little-endian.
+
+     N              None
+     T / F          True / False
+     i <8>          int fitting in a signed 64-bit, little-endian
+     I <len> <...>  any other int, minimal little-endian two's complement
+     f <8>          float, IEEE 754 little-endian, with NaN normalized
+     s <len> <...>  str, as UTF-8
+     b <len> <...>  bytes
+     t <count> ...  tuple, followed by its encoded items
+     v <count> ... <count> ...
+                    values, its encoded positionals followed by its
+                    keywords sorted by their UTF-8 bytes, each as
+                    <len> <key> and then the encoded value
+
+   This has to stay in agreement with the pure-Python implementation
+   in values/__init__.py
+
+   On 3.11, the encoding also serves as the flat copy by which values
+   cross between subinterpreters. It decodes back to plain values,
+   tuples and scalars, so any subclass types are not preserved.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <stddef.h>
+#include <string.h>
+
+
+/* === XXH64 === */
+
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t read64(const unsigned char *p) {
+  return ((uint64_t) p[0]) | ((uint64_t) p[1] << 8) |
+    ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24) |
+    ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40) |
+    ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
+
+
+static inline uint64_t read32(const unsigned char *p) {
+  return ((uint64_t) p[0]) | ((uint64_t) p[1] << 8) |
+    ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24);
+}
+
+
+static inline void write64(unsigned char *p, uint64_t v) {
+  int i;
+  for (i = 0; i < 8; i++) {
+    p[i] = (unsigned char) (v >> (i * 8));
+  }
+}
+
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * PRIME64_2;
+  acc = rotl64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+  acc ^= xxh64_round(0, val);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+
+void xxh64_reset(xxh64_state *state, uint64_t seed) {
+  memset(state, 0, sizeof(xxh64_state));
+  state->seed = seed;
+  state->v[0] = seed + PRIME64_1 + PRIME64_2;
+  state->v[1] = seed + PRIME64_2;
+  state->v[2] = seed;
+  state->v[3] = seed - PRIME64_1;
+}
+
+
+void xxh64_update(xxh64_state *state, const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *) data;
+  const unsigned char *end = p + len;
+
+  state->total_len += len;
+
+  if (state->memsize + len < 32) {
+    // not enough for a full stripe yet, just stash it
+    memcpy(state->mem + state->memsize, p, len);
+    state->memsize += (unsigned int) len;
+    return;
+  }
+
+  if (state->memsize) {
+    // complete the stashed stripe and consume it
+    memcpy(state->mem + state->memsize, p, 32 - state->memsize);
+    p += 32 - state->memsize;
+
+    state->v[0] = xxh64_round(state->v[0], read64(state->mem));
+    state->v[1] = xxh64_round(state->v[1], read64(state->mem + 8));
+    state->v[2] = xxh64_round(state->v[2], read64(state->mem + 16));
+    state->v[3] = xxh64_round(state->v[3], read64(state->mem + 24));
+    state->memsize = 0;
+  }
+
+  while (p + 32 <= end) {
+    state->v[0] = xxh64_round(state->v[0], read64(p));
+    state->v[1] = xxh64_round(state->v[1], read64(p + 8));
+    state->v[2] = xxh64_round(state->v[2], read64(p + 16));
+    state->v[3] = xxh64_round(state->v[3], read64(p + 24));
+    p += 32;
+  }
+
+  if (p < end) {
+    memcpy(state->mem, p, end - p);
+    state->memsize = (unsigned int) (end - p);
+  }
+}
+
+
+uint64_t xxh64_digest(const xxh64_state *state) {
+  const unsigned char *p = state->mem;
+  const unsigned char *end = p + state->memsize;
+  uint64_t h;
+
+  if (state->total_len >= 32) {
+    h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) +
+      rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+    h = xxh64_merge(h, state->v[0]);
+    h = xxh64_merge(h, state->v[1]);
+    h = xxh64_merge(h, state->v[2]);
+    h = xxh64_merge(h, state->v[3]);
+
+  } else {
+    h = state->seed + PRIME64_5;
+  }
+
+  h += state->total_len;
+
+  while (p + 8 <= end) {
+    h ^= xxh64_round(0, read64(p));
+    h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    p += 8;
+  }
+
+  if (p + 4 <= end) {
+    h ^= read32(p) * PRIME64_1;
+    h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  while (p < end) {
+    h ^= (*p) * PRIME64_5;
+    h = rotl64(h, 11) * PRIME64_1;
+    p++;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+
+/* === canonical writer === */
+
+
+static int canon_write(canon_writer *w, const void *data, Py_ssize_t len) {
+
+  if (likely(w->used + len <= CANON_BUFSIZE)) {
+    memcpy(w->buffer + w->used, data, len);
+    w->used += len;
+    return 0;
+  }
+
+  if (w->used) {
+    if (w->flush(w, w->buffer, w->used))
+      return -1;
+    w->used = 0;
+  }
+
+  if (len >= CANON_BUFSIZE) {
+    // too big to be worth copying, so hand it over directly
+    return w->flush(w, (const char *) data, len);
+
+  } else {
+    memcpy(w->buffer, data, len);
+    w->used = len;
+    return 0;
+  }
+}
+
+
+static int canon_write_tagged(canon_writer *w, char tag, uint64_t val) {
+  unsigned char buf[9];
+
+  buf[0] = (unsigned char) tag;
+  write64(buf + 1, val);
+  return canon_write(w, buf, 9);
+}
+
+
+static int canon_write_blob(canon_writer *w, char tag,
+			    const char *data, Py_ssize_t len) {
+
+  if (canon_write_tagged(w, tag, (uint64_t) len))
+    return -1;
+  return canon_write(w, data, len);
+}
+
+
+int canon_finish(canon_writer *w) {
+  if (w->used) {
+    if (w->flush(w, w->buffer, w->used))
+      return -1;
+    w->used = 0;
+  }
+  return 0;
+}
+
+
+/* === canonical encoding === */
+
+
+static int canon_encode_bigint(canon_writer *w, PyObject *obj) {
+  static PyObject *to_bytes = NULL, *signed_kwds = NULL;
+  PyObject *bits, *args, *data;
+  Py_ssize_t nbytes;
+  int rc;
+
+  if (! to_bytes) {
+    to_bytes = PyObject_GetAttrString((PyObject *) &PyLong_Type,
+				      "to_bytes");
+    if (! to_bytes)
+      return -1;
+  }
+
+  if (! signed_kwds) {
+    signed_kwds = Py_BuildValue("{sO}", "signed", Py_True);
+    if (! signed_kwds)
+      return -1;
+  }
+
+  // we go through the int type itself rather than the object, so that
+  // an int subclass can't change the encoding out from under us
+  bits = PyObject_CallMethod((PyObject *) &PyLong_Type,
+			     "bit_length", "O", obj);
+  if (! bits)
+    return -1;
+
+  nbytes = (PyLong_AsSsize_t(bits) + 8) / 8;
+  Py_DECREF(bits);
+
+  args = Py_BuildValue("(Ons)", obj, nbytes, "little");
+  if (! args)
+    return -1;
+
+  data = PyObject_Call(to_bytes, args, signed_kwds);
+  Py_DECREF(args);
+  if (! data)
+    return -1;
+
+  rc = canon_write_blob(w, 'I', PyBytes_AS_STRING(data),
+			PyBytes_GET_SIZE(data));
+  Py_DECREF(data);
+  return rc;
+}
+
+
+typedef struct canon_kwd {
+  const char *key;
+  Py_ssize_t keylen;
+  PyObject *value;
+} canon_kwd;
+
+
+static int canon_kwd_cmp(const void *a, const void *b) {
+  const canon_kwd *l = (const canon_kwd *) a, *r = (const canon_kwd *) b;
+  int c = memcmp(l->key, r->key, l->keylen < r->keylen? l->keylen: r->keylen);
+
+  if (c)
+    return c;
+  return (l->keylen > r->keylen) - (l->keylen < r->keylen);
+}
+
+
+#define CANON_KWDS_STACK 16
+
+
+static int canon_encode_values(canon_writer *w, PyValues *v) {
+  canon_kwd stack[CANON_KWDS_STACK], *kwds = stack;
+  Py_ssize_t index, count, pos = 0;
+  PyObject *key, *value;
+  int rc = -1;
+
+  if (VALUES_FORCE(v))
+    return -1;
+
+  count = PyTuple_GET_SIZE(v->args);
+  if (canon_write_tagged(w, 'v', (uint64_t) count))
+    return -1;
+
+  for (index = 0; index < count; index++) {
+    if (canon_encode(w, PyTuple_GET_ITEM(v->args, index)))
+      return -1;
+  }
+
+  count = v->kwds? PyDict_GET_SIZE(v->kwds): 0;
+
+  {
+    unsigned char buf[8];
+    write64(buf, (uint64_t) count);
+    if (canon_write(w, buf, 8))
+      return -1;
+  }
+
+  if (! count)
+    return 0;
+
+  if (count > CANON_KWDS_STACK) {
+    kwds = PyMem_New(canon_kwd, count);
+    if (! kwds) {
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+
+  index = 0;
+  while (PyDict_Next(v->kwds, &pos, &key, &value)) {
+    if (unlikely(! PyUnicode_Check(key))) {
+      PyErr_Format(PyExc_TypeError, "cannot canonically encode a values"
+		   " with a non-str keyword %R", key);
+      goto done;
+    }
+
+    kwds[index].key = PyUnicode_AsUTF8AndSize(key, &kwds[index].keylen);
+    if (! kwds[index].key)
+      goto done;
+
+    kwds[index].value = value;
+    index++;
+  }
+
+  qsort(kwds, count, sizeof(canon_kwd), canon_kwd_cmp);
+
+  for (index = 0; index < count; index++) {
+    unsigned char buf[8];
+
+    write64(buf, (uint64_t) kwds[index].keylen);
+    if (canon_write(w, buf, 8) ||
+	canon_write(w, kwds[index].key, kwds[index].keylen) ||
+	canon_encode(w, kwds[index].value))
+      goto done;
+  }
+
+  rc = 0;
+
+ done:
+  if (kwds != stack)
+    PyMem_Free(kwds);
+
+  return rc;
+}
+
+
+int canon_encode(canon_writer *w, PyObject *obj) {
+  int rc;
+
+  if (obj == Py_None) {
+    return canon_write(w, "N", 1);
+
+  } else if (obj == Py_True) {
+    return canon_write(w, "T", 1);
+
+  } else if (obj == Py_False) {
+    return canon_write(w, "F", 1);
+
+  } else if (PyLong_Check(obj)) {
+    int overflow = 0;
+    long long val = PyLong_AsLongLongAndOverflow(obj, &overflow);
+
+    if (likely(! overflow)) {
+      if (val == -1 && PyErr_Occurred())
+	return -1;
+      return canon_write_tagged(w, 'i', (uint64_t) val);
+
+    } else {
+      return canon_encode_bigint(w, obj);
+    }
+
+  } else if (PyFloat_Check(obj)) {
+    double val = PyFloat_AS_DOUBLE(obj);
+    uint64_t bits;
+
+    if (val != val) {
+      // all NaNs encode the same
+      bits = 0x7ff8000000000000ULL;
+    } else {
+      memcpy(&bits, &val, 8);
+    }
+    return canon_write_tagged(w, 'f', bits);
+
+  } else if (PyUnicode_Check(obj)) {
+    Py_ssize_t len;
+    const char *data = PyUnicode_AsUTF8AndSize(obj, &len);
+
+    if (! data)
+      return -1;
+    return canon_write_blob(w, 's', data, len);
+
+  } else if (PyBytes_Check(obj)) {
+    return canon_write_blob(w, 'b', PyBytes_AS_STRING(obj),
+			    PyBytes_GET_SIZE(obj));
+  }
+
+  // the remaining cases are containers, so guard the recursion
+  if (Py_EnterRecursiveCall(" in canonical encoding"))
+    return -1;
+
+  if (PyValues_Check(obj)) {
+    rc = canon_encode_values(w, (PyValues *) obj);
+
+  } else if (PyTuple_Check(obj)) {
+    Py_ssize_t index, count = PyTuple_GET_SIZE(obj);
+
+    rc = canon_write_tagged(w, 't', (uint64_t) count);
+    for (index = 0; (! rc) && index < count; index++) {
+      rc = canon_encode(w, PyTuple_GET_ITEM(obj, index));
+    }
+
+  } else {
+    PyErr_Format(PyExc_TypeError, "cannot canonically encode an object"
+		 " of type %.200s", Py_TYPE(obj)->tp_name);
+    rc = -1;
+  }
+
+  Py_LeaveRecursiveCall();
+  return rc;
+}
+
+
+/* === stable hash === */
+
+
+static int canon_flush_xxh64(canon_writer *w,
+			     const char *data, Py_ssize_t len) {
+
+  xxh64_update((xxh64_state *) w->ctx, data, (size_t) len);
+  return 0;
+}
+
+
+int canon_stable_hash(PyObject *obj, uint64_t seed, uint64_t *result) {
+  xxh64_state state;
+  canon_writer w;
+
+  xxh64_reset(&state, seed);
+
+  w.flush = canon_flush_xxh64;
+  w.ctx = &state;
+  w.used = 0;
+
+  if (canon_encode(&w, obj) || canon_finish(&w))
+    return -1;
+
+  *result = xxh64_digest(&state);
+  return 0;
+}
+
+
+PyObject *values_stable_hash(PyObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "seed", NULL };
+  unsigned long long seed = 0;
+  uint64_t result;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|K:stable_hash",
+				    kwlist, &seed))
+    return NULL;
+
+  if (canon_stable_hash(self, (uint64_t) seed, &result))
+    return NULL;
+
+  return PyLong_FromUnsignedLongLong(result);
+}
+
+
+/* === canonical bytes and digests === */
+
+
+typedef struct canon_bytes_ctx {
+  PyObject *data;
+  Py_ssize_t len;
+} canon_bytes_ctx;
+
+
+static int canon_flush_bytes(canon_writer *w,
+			     const char *data, Py_ssize_t len) {
+
+  canon_bytes_ctx *ctx = (canon_bytes_ctx *) w->ctx;
+  Py_ssize_t size = PyBytes_GET_SIZE(ctx->data);
+
+  if (ctx->len + len > size) {
+    // grow geometrically, so a large tree isn't quadratic
+    size = (size * 2 > ctx->len + len)? size * 2: ctx->len + len;
+    if (_PyBytes_Resize(&ctx->data, size))
+      return -1;
+  }
+
+  memcpy(PyBytes_AS_STRING(ctx->data) + ctx->len, data, len);
+  ctx->len += len;
+  return 0;
+}
+
+
+PyObject *canon_bytes(PyObject *obj) {
+  canon_bytes_ctx ctx;
+  canon_writer w;
+
+  ctx.data = PyBytes_FromStringAndSize(NULL, CANON_BUFSIZE);
+  ctx.len = 0;
+  if (! ctx.data)
+    return NULL;
+
+  w.flush = canon_flush_bytes;
+  w.ctx = &ctx;
+  w.used = 0;
+
+  if (canon_encode(&w, obj) || canon_finish(&w) ||
+      _PyBytes_Resize(&ctx.data, ctx.len)) {
+    Py_XDECREF(ctx.data);
+    return NULL;
+  }
+
+  return ctx.data;
+}
+
+
+PyObject *values_canonical_bytes(PyObject *self, PyObject *_noargs) {
+  return canon_bytes(self);
+}
+
+
+static int canon_flush_hasher(canon_writer *w,
+			      const char *data, Py_ssize_t len) {
+
+  PyObject *view, *result;
+
+  // the chunk is only borrowed for the duration of the update call
+  view = PyMemoryView_FromMemory((char *) data, len, PyBUF_READ);
+  if (! view)
+    return -1;
+
+  result = PyObject_CallMethod((PyObject *) w->ctx, "update", "O", view);
+  Py_DECREF(view);
+
+  if (! result)
+    return -1;
+
+  Py_DECREF(result);
+  return 0;
+}
+
+
+PyObject *values_digest(PyObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "algorithm", NULL };
+  static PyObject *hashlib_new = NULL;
+
+  const char *algorithm = "blake2b";
+  PyObject *hasher, *result;
+  canon_writer w;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|s:digest",
+				    kwlist, &algorithm))
+    return NULL;
+
+  if (! hashlib_new) {
+    PyObject *hashlib = PyImport_ImportModule("hashlib");
+    if (! hashlib)
+      return NULL;
+
+    hashlib_new = PyObject_GetAttrString(hashlib, "new");
+    Py_DECREF(hashlib);
+    if (! hashlib_new)
+      return NULL;
+  }
+
+  hasher = PyObject_CallFunction(hashlib_new, "s", algorithm);
+  if (! hasher)
+    return NULL;
+
+  // the encoding is fed to the hasher a buffer at a time, and is
+  // never held in full
+  w.flush = canon_flush_hasher;
+  w.ctx = hasher;
+  w.used = 0;
+
+  if (canon_encode(&w, self) || canon_finish(&w)) {
+    Py_DECREF(hasher);
+    return NULL;
+  }
+
+  result = PyObject_CallMethod(hasher, "digest", NULL);
+  Py_DECREF(hasher);
+
+  return result;
+}
+
+
+PyObject *values_stable_hash_many(PyObject *mod,
+				  PyObject *args, PyObject *kwds) {
+
+  static char *kwlist[] = { "seq", "seed", NULL };
+  static PyObject *array_type = NULL;
+
+  unsigned long long seed = 0;
+  PyObject *seq, *fast, *data, *result;
+  Py_ssize_t index, count;
+  unsigned char *out;
+  uint64_t hashed;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|K:stable_hash_many",
+				    kwlist, &seq, &seed))
+    return NULL;
+
+  if (! array_type) {
+    PyObject *array_mod = PyImport_ImportModule("array");
+    if (! array_mod)
+      return NULL;
+
+    array_type = PyObject_GetAttrString(array_mod, "array");
+    Py_DECREF(array_mod);
+    if (! array_type)
+      return NULL;
+  }
+
+  fast = PySequence_Fast(seq, "stable_hash_many requires an iterable");
+  if (! fast)
+    return NULL;
+
+  count = PySequence_Fast_GET_SIZE(fast);
+  data = PyBytes_FromStringAndSize(NULL, count * 8);
+  if (! data) {
+    Py_DECREF(fast);
+    return NULL;
+  }
+
+  out = (unsigned char *) PyBytes_AS_STRING(data);
+  for (index = 0; index < count; index++) {
+    if (canon_stable_hash(PySequence_Fast_GET_ITEM(fast, index),
+			  (uint64_t) seed, &hashed)) {
+      Py_DECREF(fast);
+      Py_DECREF(data);
+      return NULL;
+    }
+
+    // the array is filled in native byte order
+    memcpy(out + (index * 8), &hashed, 8);
+  }
+
+  Py_DECREF(fast);
+
+  result = PyObject_CallFunction(array_type, "sO", "Q", data);
+  Py_DECREF(data);
+
+  return result;
+}
+
+
+
+/* === canonical decoding === */
+
+
+typedef struct canon_reader {
+  const unsigned char *pos;
+  const unsigned char *end;
+} canon_reader;
+
+
+static int canon_read(canon_reader *r, Py_ssize_t len,
+		      const unsigned char **data) {
+
+  if (unlikely(len < 0 || r->end - r->pos < len)) {
+    PyErr_SetString(PyExc_ValueError, "truncated canonical encoding");
+    return -1;
+  }
+
+  *data = r->pos;
+  r->pos += len;
+  return 0;
+}
+
+
+static int canon_read_len(canon_reader *r, Py_ssize_t *len) {
+  const unsigned char *data;
+  uint64_t val;
+
+  if (canon_read(r, 8, &data))
+    return -1;
+
+  val = read64(data);
+  if (unlikely(val > (uint64_t) (r->end - r->pos))) {
+    // every counted thing takes at least a byte, so this can't be
+    // honest, and we won't go allocating for it
+    PyErr_SetString(PyExc_ValueError, "truncated canonical encoding");
+    return -1;
+  }
+
+  *len = (Py_ssize_t) val;
+  return 0;
+}
+
+
+static PyObject *canon_decode(canon_reader *r);
+
+
+static PyObject *canon_decode_values(canon_reader *r) {
+  PyObject *args, *kwds = NULL, *key, *value, *result;
+  const unsigned char *data;
+  Py_ssize_t index, count;
+
+  if (canon_read_len(r, &count))
+    return NULL;
+
+  args = PyTuple_New(count);
+  if (! args)
+    return NULL;
+
+  for (index = 0; index < count; index++) {
+    value = canon_decode(r);
+    if (! value)
+      goto error;
+    PyTuple_SET_ITEM(args, index, value);
+  }
+
+  if (canon_read_len(r, &count))
+    goto error;
+
+  if (count) {
+    kwds = PyDict_New();
+    if (! kwds)
+      goto error;
+  }
+
+  for (index = 0; index < count; index++) {
+    Py_ssize_t keylen;
+
+    if (canon_read_len(r, &keylen) || canon_read(r, keylen, &data))
+      goto error;
+
+    key = PyUnicode_DecodeUTF8((const char *) data, keylen, NULL);
+    if (! key)
+      goto error;
+
+    // a stream of records repeats the same handful of keywords
+    PyUnicode_InternInPlace(&key);
+
+    value = canon_decode(r);
+    if (! value || PyDict_SetItem(kwds, key, value)) {
+      Py_DECREF(key);
+      Py_XDECREF(value);
+      goto error;
+    }
+
+    Py_DECREF(key);
+    Py_DECREF(value);
+  }
+
+  result = sib_values(args, kwds);
+  Py_DECREF(args);
+  Py_XDECREF(kwds);
+  return result;
+
+ error:
+  Py_DECREF(args);
+  Py_XDECREF(kwds);
+  return NULL;
+}
+
+
+static PyObject *canon_decode(canon_reader *r) {
+  const unsigned char *data;
+  PyObject *result;
+  Py_ssize_t len;
+
+  if (canon_read(r, 1, &data))
+    return NULL;
+
+  switch (*data) {
+  case 'N':
+    Py_RETURN_NONE;
+
+  case 'T':
+    Py_RETURN_TRUE;
+
+  case 'F':
+    Py_RETURN_FALSE;
+
+  case 'i':
+    if (canon_read(r, 8, &data))
+      return NULL;
+    return PyLong_FromLongLong((long long) read64(data));
+
+  case 'I':
+    if (canon_read_len(r, &len) || canon_read(r, len, &data))
+      return NULL;
+    return _PyLong_FromByteArray(data, len, 1, 1);
+
+  case 'f':
+    {
+      uint64_t bits;
+      double val;
+
+      if (canon_read(r, 8, &data))
+	return NULL;
+
+      bits = read64(data);
+      memcpy(&val, &bits, 8);
+      return PyFloat_FromDouble(val);
+    }
+
+  case 's':
+    if (canon_read_len(r, &len) || canon_read(r, len, &data))
+      return NULL;
+    return PyUnicode_DecodeUTF8((const char *) data, len, NULL);
+
+  case 'b':
+    if (canon_read_len(r, &len) || canon_read(r, len, &data))
+      return NULL;
+    return PyBytes_FromStringAndSize((const char *) data, len);
+  }
+
+  // the remaining cases are containers, so guard the recursion
+  if (Py_EnterRecursiveCall(" in canonical decoding"))
+    return NULL;
+
+  if (*data == 'v') {
+    result = canon_decode_values(r);
+
+  } else if (*data == 't') {
+    Py_ssize_t index;
+
+    result = NULL;
+    if (! canon_read_len(r, &len))
+      result = PyTuple_New(len);
+
+    for (index = 0; result && index < len; index++) {
+      PyObject *item = canon_decode(r);
+      if (! item) {
+	Py_CLEAR(result);
+	break;
+      }
+      PyTuple_SET_ITEM(result, index, item);
+    }
+
+  } else {
+    PyErr_Format(PyExc_ValueError, "unknown canonical encoding tag 0x%02x",
+		 (unsigned int) *data);
+    result = NULL;
+  }
+
+  Py_LeaveRecursiveCall();
+  return result;
+}
+
+
+PyObject *canon_from_bytes(const char *data, Py_ssize_t len) {
+  canon_reader r;
+  PyObject *result;
+
+  r.pos = (const unsigned char *) data;
+  r.end = r.pos + len;
+
+  result = canon_decode(&r);
+  if (result && r.pos != r.end) {
+    Py_DECREF(result);
+    PyErr_SetString(PyExc_ValueError,
+		    "trailing data after canonical encoding");
+    return NULL;
+  }
+
+  return result;
+}
+
+
+PyObject *values_from_canonical(PyObject *mod, PyObject *data) {
+  PyObject *result;
+  Py_buffer view;
+
+  if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE))
+    return NULL;
+
+  result = canon_from_bytes((const char *) view.buf, view.len);
+  PyBuffer_Release(&view);
+
+  return result;
+}
+
+
+/* === sharing between interpreters === */
+
+
+/* This module uses single-phase init, so only the legacy
+   subinterpreters sharing the main GIL may import it. From 3.12 on,
+   the interpreters module creates isolated ones, which refuse to,
+   and the cross-interpreter data hooks became internal in 3.13. That
+   leaves 3.11, where a values is handed between interpreters as one
+   raw copy of its canonical encoding, which the receiving interpreter
+   decodes directly. Elsewhere, values can be passed as their
+   canonical_bytes, which are themselves shareable, to an interpreter
+   able to import the module at all. */
+
+#if PY_VERSION_HEX >= 0x030B0000 && PY_VERSION_HEX < 0x030C0000
+#define CANON_XID 1
+#endif
+
+
+#ifdef CANON_XID
+
+
+typedef struct canon_shared {
+  Py_ssize_t len;
+  char data[1];
+} canon_shared;
+
+
+static PyObject *canon_shared_new_object(_PyCrossInterpreterData *xid) {
+  canon_shared *shared = (canon_shared *) xid->data;
+  return canon_from_bytes(shared->data, shared->len);
+}
+
+
+static int canon_shared_get_data(PyObject *obj,
+				 _PyCrossInterpreterData *xid) {
+
+  canon_shared *shared;
+  PyObject *data;
+
+  data = canon_bytes(obj);
+  if (! data)
+    return -1;
+
+  // the copy has to be raw memory, owned by no interpreter in
+  // particular, since the sender's bytes object may be gone by the
+  // time the receiver gets to it
+  shared = PyMem_RawMalloc(offsetof(canon_shared, data) +
+			   PyBytes_GET_SIZE(data));
+  if (! shared) {
+    Py_DECREF(data);
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  shared->len = PyBytes_GET_SIZE(data);
+  memcpy(shared->data, PyBytes_AS_STRING(data), shared->len);
+  Py_DECREF(data);
+
+  xid->data = shared;
+  xid->obj = NULL;
+  xid->new_object = canon_shared_new_object;
+  xid->free = PyMem_RawFree;
+
+  return 0;
+}
+
+
+#endif
+
+
+int canon_register_shareable(void) {
+#ifdef CANON_XID
+  static int registered = 0;
+
+  // the registry is process-wide, but this runs again for each
+  // interpreter that imports us
+  if (registered)
+    return 0;
+
+  if (_PyCrossInterpreterData_RegisterClass(&PyValuesType,
+					    canon_shared_get_data))
+    return -1;
+
+  registered = 1;
+#endif
+  return 0;
+}
+
+
+/* The end. */
@@ -0,0 +1,709 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values channel
+
+   A bounded multi-producer multi-consumer queue of object references
+   for handing work between threads.
+
+   The queue is a ring of cells, each carrying a sequence number which
+   says whose turn it is at that cell. A producer claims the cell at
+   the head position by advancing the head with a compare-and-swap,
+   stores its reference, and then publishes it by moving the cell's
+   sequence on. A consumer does the same from the tail. Neither side
+   ever takes a lock to move an item, and producers and consumers only
+   contend with their own kind.
+
+   Only a blocking call which can't make progress takes the mutex, to
+   park on the condition variable until the other side signals that
+   it has moved something. Signalling is skipped entirely while nobody
+   is parked. Parking is done in short slices, so that a pending
+   signal or a timeout is noticed promptly.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <stddef.h>
+#include <time.h>
+
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_CHANNEL_PARK 1
+#include <pthread.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+
+/* how long a parked thread sleeps before looking around again */
+#define CHANNEL_PARK_NS 20000000L
+
+/* and how long it naps for instead, where there's nothing to park on
+   and so nobody to wake it */
+#define CHANNEL_NAP_NS 1000000L
+
+
+typedef struct channel_cell {
+  size_t seq;
+  PyObject *item;
+} channel_cell;
+
+
+typedef struct Channel {
+  PyObject_HEAD
+
+  size_t capacity;
+  channel_cell *cells;
+
+  // the two ends are written by different threads, so keep them off
+  // of each other's cache line
+  char _pad0[64];
+  size_t head;
+  char _pad1[64 - sizeof(size_t)];
+  size_t tail;
+  char _pad2[64 - sizeof(size_t)];
+
+  int parked;
+
+#ifdef HAVE_CHANNEL_PARK
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+} Channel;
+
+
+/* === the ring === */
+
+
+static int channel_try_put(Channel *ch, PyObject *item) {
+  channel_cell *cell;
+  size_t pos, seq;
+
+  pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = ch->cells + (pos % ch->capacity);
+    seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == pos) {
+      // the cell is free for this lap, try to claim it
+      if (__atomic_compare_exchange_n(&ch->head, &pos, pos + 1, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	break;
+
+    } else if ((ptrdiff_t) (seq - pos) < 0) {
+      // still holding the previous lap's item, so we're full
+      return 0;
+
+    } else {
+      // another producer got here first
+      pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  Py_INCREF(item);
+  cell->item = item;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+
+/* Returns a stolen reference, or NULL if empty. Never sets an
+   exception */
+static PyObject *channel_try_get(Channel *ch) {
+  channel_cell *cell;
+  PyObject *item;
+  size_t pos, seq;
+
+  pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = ch->cells + (pos % ch->capacity);
+    seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == pos + 1) {
+      if (__atomic_compare_exchange_n(&ch->tail, &pos, pos + 1, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	break;
+
+    } else if ((ptrdiff_t) (seq - (pos + 1)) < 0) {
+      // nothing published here yet, so we're empty
+      return NULL;
+
+    } else {
+      pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  item = cell->item;
+  cell->item = NULL;
+  __atomic_store_n(&cell->seq, pos + ch->capacity, __ATOMIC_RELEASE);
+
+  return item;
+}
+
+
+static int channel_can_put(Channel *ch) {
+  size_t pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED);
+  channel_cell *cell = ch->cells + (pos % ch->capacity);
+  return __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos;
+}
+
+
+static int channel_can_get(Channel *ch) {
+  size_t pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+  channel_cell *cell = ch->cells + (pos % ch->capacity);
+  return __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+
+/* === parking === */
+
+
+static double channel_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Lets any parked threads know that something moved */
+static void channel_wake(Channel *ch) {
+
+  // pairs with the increment in channel_park, so that either we see
+  // the parked count, or the parker sees what we just did
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (likely(! __atomic_load_n(&ch->parked, __ATOMIC_RELAXED)))
+    return;
+
+#ifdef HAVE_CHANNEL_PARK
+  pthread_mutex_lock(&ch->lock);
+  pthread_cond_broadcast(&ch->cond);
+  pthread_mutex_unlock(&ch->lock);
+#endif
+}
+
+
+#ifndef HAVE_CHANNEL_PARK
+/* Gives up the CPU for about ns, rather than spinning */
+static void channel_nap(long ns) {
+#if defined(_WIN32)
+  Sleep((DWORD) (ns / 1000000) + 1);
+#else
+  struct timespec ts = { 0, ns };
+  nanosleep(&ts, NULL);
+#endif
+}
+#endif
+
+
+/* Waits with the GIL released for ready(ch), for at most a slice.
+   deadline is a channel_now() value, or negative for none. Returns 1
+   to try again, 0 if the deadline has passed, or -1 with an exception
+   set if a signal handler raised */
+static int channel_park(Channel *ch, int (*ready)(Channel *),
+			double deadline) {
+
+  long slice = CHANNEL_PARK_NS;
+
+  if (PyErr_CheckSignals())
+    return -1;
+
+  if (deadline >= 0) {
+    double left = deadline - channel_now();
+    if (left <= 0)
+      return 0;
+    if (left * 1e9 < slice)
+      slice = (long) (left * 1e9) + 1;
+  }
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  __atomic_add_fetch(&ch->parked, 1, __ATOMIC_SEQ_CST);
+
+#ifdef HAVE_CHANNEL_PARK
+  pthread_mutex_lock(&ch->lock);
+  if (! ready(ch)) {
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += slice;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec += until.tv_nsec / 1000000000L;
+      until.tv_nsec %= 1000000000L;
+    }
+    pthread_cond_timedwait(&ch->cond, &ch->lock, &until);
+  }
+  pthread_mutex_unlock(&ch->lock);
+#else
+  if (! ready(ch))
+    channel_nap(slice < CHANNEL_NAP_NS? slice: CHANNEL_NAP_NS);
+#endif
+
+  __atomic_sub_fetch(&ch->parked, 1, __ATOMIC_SEQ_CST);
+
+  Py_END_ALLOW_THREADS;
+
+  return 1;
+}
+
+
+static int channel_deadline(PyObject *block, PyObject *timeout,
+			    double *deadline) {
+
+  double secs;
+  int blocking;
+
+  *deadline = -1;
+  if (timeout == Py_None)
+    return 0;
+
+  blocking = PyObject_IsTrue(block);
+  if (blocking < 1)
+    return blocking;
+
+  secs = PyFloat_AsDouble(timeout);
+  if (secs == -1 && PyErr_Occurred())
+    return -1;
+
+  if (secs < 0) {
+    PyErr_SetString(PyExc_ValueError, "timeout must be a non-negative"
+		    " number");
+    return -1;
+  }
+
+  *deadline = channel_now() + secs;
+  return 0;
+}
+
+
+static PyObject *channel_queue_error(const char *name) {
+  static PyObject *queue_mod = NULL;
+
+  if (! queue_mod) {
+    queue_mod = PyImport_ImportModule("queue");
+    if (! queue_mod)
+      return NULL;
+  }
+
+  return PyObject_GetAttrString(queue_mod, name);
+}
+
+
+static PyObject *channel_raise(const char *name) {
+  PyObject *exc = channel_queue_error(name);
+
+  if (exc) {
+    PyErr_SetNone(exc);
+    Py_DECREF(exc);
+  }
+  return NULL;
+}
+
+
+/* === methods === */
+
+
+static PyObject *channel_put(PyObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "item", "block", "timeout", NULL };
+
+  Channel *ch = (Channel *) self;
+  PyObject *item, *block = Py_True, *timeout = Py_None;
+  double deadline;
+  int blocking, rc;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|OO:put", kwlist,
+				    &item, &block, &timeout))
+    return NULL;
+
+  blocking = PyObject_IsTrue(block);
+  if (blocking < 0)
+    return NULL;
+
+  if (likely(channel_try_put(ch, item))) {
+    channel_wake(ch);
+    Py_RETURN_NONE;
+  }
+
+  if (! blocking)
+    return channel_raise("Full");
+
+  if (channel_deadline(block, timeout, &deadline))
+    return NULL;
+
+  for (;;) {
+    rc = channel_park(ch, channel_can_put, deadline);
+    if (rc < 0)
+      return NULL;
+
+    if (channel_try_put(ch, item)) {
+      channel_wake(ch);
+      Py_RETURN_NONE;
+    }
+
+    if (rc == 0)
+      return channel_raise("Full");
+  }
+}
+
+
+static PyObject *channel_get(PyObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "block", "timeout", NULL };
+
+  Channel *ch = (Channel *) self;
+  PyObject *item, *block = Py_True, *timeout = Py_None;
+  double deadline;
+  int blocking, rc;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|OO:get", kwlist,
+				    &block, &timeout))
+    return NULL;
+
+  blocking = PyObject_IsTrue(block);
+  if (blocking < 0)
+    return NULL;
+
+  item = channel_try_get(ch);
+  if (likely(item)) {
+    channel_wake(ch);
+    return item;
+  }
+
+  if (! blocking)
+    return channel_raise("Empty");
+
+  if (channel_deadline(block, timeout, &deadline))
+    return NULL;
+
+  for (;;) {
+    rc = channel_park(ch, channel_can_get, deadline);
+    if (rc < 0)
+      return NULL;
+
+    item = channel_try_get(ch);
+    if (item) {
+      channel_wake(ch);
+      return item;
+    }
+
+    if (rc == 0)
+      return channel_raise("Empty");
+  }
+}
+
+
+static PyObject *channel_put_many(PyObject *self,
+				  PyObject *args, PyObject *kwds) {
+
+  static char *kwlist[] = { "items", "block", "timeout", NULL };
+
+  Channel *ch = (Channel *) self;
+  PyObject *items, *fast, *block = Py_True, *timeout = Py_None;
+  Py_ssize_t index = 0, count;
+  int blocking, rc = 1;
+  double deadline;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|OO:put_many", kwlist,
+				    &items, &block, &timeout))
+    return NULL;
+
+  blocking = PyObject_IsTrue(block);
+  if (blocking < 0 || channel_deadline(block, timeout, &deadline))
+    return NULL;
+
+  fast = PySequence_Fast(items, "put_many requires an iterable");
+  if (! fast)
+    return NULL;
+
+  count = PySequence_Fast_GET_SIZE(fast);
+
+  while (index < count) {
+    Py_ssize_t moved = index;
+
+    while (index < count &&
+	   channel_try_put(ch, PySequence_Fast_GET_ITEM(fast, index)))
+      index++;
+
+    // one wake for the whole run
+    if (index > moved)
+      channel_wake(ch);
+
+    if (index == count || ! blocking || rc == 0)
+      break;
+
+    rc = channel_park(ch, channel_can_put, deadline);
+    if (rc < 0) {
+      Py_DECREF(fast);
+      return NULL;
+    }
+  }
+
+  Py_DECREF(fast);
+  return PyLong_FromSsize_t(index);
+}
+
+
+static PyObject *channel_get_many(PyObject *self,
+				  PyObject *args, PyObject *kwds) {
+
+  static char *kwlist[] = { "max", "block", "timeout", NULL };
+
+  Channel *ch = (Channel *) self;
+  PyObject *result, *item, *block = Py_True, *timeout = Py_None;
+  PyObject *maxobj = Py_None;
+  Py_ssize_t max = PY_SSIZE_T_MAX;
+  double deadline;
+  int blocking, rc;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|OOO:get_many", kwlist,
+				    &maxobj, &block, &timeout))
+    return NULL;
+
+  blocking = PyObject_IsTrue(block);
+  if (blocking < 0)
+    return NULL;
+
+  // None is everything there is
+  if (maxobj != Py_None) {
+    max = PyNumber_AsSsize_t(maxobj, PyExc_OverflowError);
+    if (max == -1 && PyErr_Occurred())
+      return NULL;
+  }
+
+  if (max < 1) {
+    PyErr_SetString(PyExc_ValueError, "get_many max must be >= 1");
+    return NULL;
+  }
+
+  result = PyList_New(0);
+  if (! result)
+    return NULL;
+
+  item = channel_try_get(ch);
+
+  if (! item && blocking) {
+    if (channel_deadline(block, timeout, &deadline)) {
+      Py_DECREF(result);
+      return NULL;
+    }
+
+    do {
+      rc = channel_park(ch, channel_can_get, deadline);
+      if (rc < 0) {
+	Py_DECREF(result);
+	return NULL;
+      }
+      item = channel_try_get(ch);
+    } while (! item && rc);
+  }
+
+  // having waited for the first, take whatever else is already there
+  while (item) {
+    rc = PyList_Append(result, item);
+    Py_DECREF(item);
+    if (rc) {
+      Py_DECREF(result);
+      return NULL;
+    }
+
+    if (PyList_GET_SIZE(result) >= max)
+      break;
+    item = channel_try_get(ch);
+  }
+
+  if (PyList_GET_SIZE(result))
+    channel_wake(ch);
+
+  return result;
+}
+
+
+static Py_ssize_t channel_len(PyObject *self) {
+  Channel *ch = (Channel *) self;
+  size_t head, tail;
+
+  // only a snapshot, the ends may be moving underneath us
+  tail = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE);
+  head = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+
+  return (head > tail)? (Py_ssize_t) (head - tail): 0;
+}
+
+
+static PyObject *channel_get_capacity(PyObject *self, void *_closure) {
+  return PyLong_FromSize_t(((Channel *) self)->capacity);
+}
+
+
+/* === type === */
+
+
+static PyObject *channel_new(PyTypeObject *type,
+			     PyObject *args, PyObject *kwds) {
+
+  static char *kwlist[] = { "capacity", NULL };
+
+  Py_ssize_t capacity, index;
+  Channel *ch;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "n:Channel", kwlist,
+				    &capacity))
+    return NULL;
+
+  if (capacity < 1) {
+    PyErr_SetString(PyExc_ValueError, "Channel capacity must be >= 1");
+    return NULL;
+  }
+
+  ch = (Channel *) type->tp_alloc(type, 0);
+  if (! ch)
+    return NULL;
+
+  ch->cells = PyMem_New(channel_cell, capacity);
+  if (! ch->cells) {
+    Py_DECREF(ch);
+    return PyErr_NoMemory();
+  }
+
+  ch->capacity = (size_t) capacity;
+  for (index = 0; index < capacity; index++) {
+    ch->cells[index].seq = (size_t) index;
+    ch->cells[index].item = NULL;
+  }
+
+  ch->head = 0;
+  ch->tail = 0;
+  ch->parked = 0;
+
+#ifdef HAVE_CHANNEL_PARK
+  pthread_mutex_init(&ch->lock, NULL);
+  pthread_cond_init(&ch->cond, NULL);
+#endif
+
+  return (PyObject *) ch;
+}
+
+
+static int channel_traverse(PyObject *self, visitproc visit, void *arg) {
+  Channel *ch = (Channel *) self;
+  size_t index;
+
+  if (ch->cells) {
+    for (index = 0; index < ch->capacity; index++)
+      Py_VISIT(ch->cells[index].item);
+  }
+  return 0;
+}
+
+
+static int channel_clear(PyObject *self) {
+  Channel *ch = (Channel *) self;
+  PyObject *item;
+
+  if (ch->cells) {
+    while ((item = channel_try_get(ch)))
+      Py_DECREF(item);
+  }
+  return 0;
+}
+
+
+static void channel_dealloc(PyObject *self) {
+  Channel *ch = (Channel *) self;
+
+  PyObject_GC_UnTrack(self);
+  channel_clear(self);
+
+  if (ch->cells) {
+    PyMem_Free(ch->cells);
+    ch->cells = NULL;
+
+#ifdef HAVE_CHANNEL_PARK
+    pthread_mutex_destroy(&ch->lock);
+    pthread_cond_destroy(&ch->cond);
+#endif
+  }
+
+  Py_TYPE(self)->tp_free(self);
+}
+
+
+static PyGetSetDef channel_getset[] = {
+  { "capacity", channel_get_capacity, NULL,
+    "the most items the channel will hold", NULL },
+  { NULL },
+};
+
+
+static PyMethodDef channel_methods[] = {
+  { "put", (PyCFunction) channel_put, METH_VARARGS|METH_KEYWORDS,
+    "C.put(item, block=True, timeout=None)\n"
+    "Adds item to the channel, waiting for room unless block is\n"
+    "False. Raises queue.Full if there was no room in time" },
+
+  { "get", (PyCFunction) channel_get, METH_VARARGS|METH_KEYWORDS,
+    "C.get(block=True, timeout=None) -> item\n"
+    "Removes the oldest item, waiting for one unless block is False.\n"
+    "Raises queue.Empty if there was none in time" },
+
+  { "put_many", (PyCFunction) channel_put_many, METH_VARARGS|METH_KEYWORDS,
+    "C.put_many(items, block=True, timeout=None) -> int\n"
+    "Adds items in order, waiting for room as needed unless block is\n"
+    "False. Returns how many were added, which is all of them unless\n"
+    "not blocking or the timeout passed" },
+
+  { "get_many", (PyCFunction) channel_get_many, METH_VARARGS|METH_KEYWORDS,
+    "C.get_many(max=None, block=True, timeout=None) -> list\n"
+    "Removes up to max of the oldest items. When blocking, waits for\n"
+    "at least one. The list is empty if there were none in time" },
+
+  { NULL, NULL, 0, NULL },
+};
+
+
+static PySequenceMethods channel_as_sequence = {
+  .sq_length = channel_len,
+};
+
+
+PyTypeObject PyValuesChannelType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "Channel",
+  sizeof(Channel),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC,
+  .tp_doc = "Channel(capacity)\n"
+  "A bounded first-in first-out queue for handing objects between\n"
+  "threads, which any number of producers and consumers may share.\n"
+  "Items move without taking a lock, only a thread which has to wait\n"
+  "for room or for an item sleeps",
+  .tp_new = channel_new,
+  .tp_dealloc = channel_dealloc,
+  .tp_traverse = channel_traverse,
+  .tp_clear = channel_clear,
+  .tp_methods = channel_methods,
+  .tp_getset = channel_getset,
+  .tp_as_sequence = &channel_as_sequence,
+};
+
+
+/* The end. */
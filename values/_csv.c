@@ -0,0 +1,624 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values csv reader
+
+   Parses CSV text straight into values, one per row. With a header,
+   every row is a values of keywords sharing the same interned key
+   objects, copied from a single template dict. Columns may be given
+   converters, and int and float are applied natively.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <string.h>
+
+
+typedef struct CsvReader {
+  PyObject_HEAD
+
+  PyObject *lines;
+  PyObject *header;
+  PyObject *template;
+  PyObject *types;
+  PyObject *converters;
+  PyObject *fields;
+
+  char delimiter;
+  char quotechar;
+  Py_ssize_t line_num;
+
+  char *field;
+  Py_ssize_t field_len;
+  Py_ssize_t field_size;
+} CsvReader;
+
+
+enum csv_state {
+  START_FIELD,
+  IN_FIELD,
+  IN_QUOTED,
+  QUOTE_IN_QUOTED,
+};
+
+
+static int csv_field_append(CsvReader *r, char c) {
+  if (unlikely(r->field_len + 1 >= r->field_size)) {
+    Py_ssize_t size = r->field_size * 2;
+    char *grown = PyMem_Realloc(r->field, size);
+
+    if (! grown) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    r->field = grown;
+    r->field_size = size;
+  }
+
+  r->field[r->field_len++] = c;
+  return 0;
+}
+
+
+/* Applies a converter to the collected field. int and float are
+   parsed directly from the buffer, falling back to calling them on
+   the str should the fast parse not cover the text (non-ASCII
+   digits, say), so that the results and errors are always exactly
+   those of int(s) or float(s) */
+static PyObject *csv_convert(CsvReader *r, PyObject *convert) {
+  PyObject *result, *text;
+  char *end = NULL;
+
+  r->field[r->field_len] = '\0';
+
+  if (convert == (PyObject *) &PyLong_Type) {
+    result = PyLong_FromString(r->field, &end, 10);
+    if (result)
+      return result;
+    PyErr_Clear();
+
+  } else if (convert == (PyObject *) &PyFloat_Type) {
+    double val = PyOS_string_to_double(r->field, &end, NULL);
+
+    if (end && end != r->field && *end == '\0' &&
+	! (val == -1.0 && PyErr_Occurred()))
+      return PyFloat_FromDouble(val);
+    PyErr_Clear();
+  }
+
+  text = PyUnicode_DecodeUTF8(r->field, r->field_len, NULL);
+  if (! text || convert == Py_None)
+    return text;
+
+  result = PyObject_CallFunctionObjArgs(convert, text, NULL);
+  Py_DECREF(text);
+  return result;
+}
+
+
+static int csv_emit_field(CsvReader *r) {
+  Py_ssize_t column = PyList_GET_SIZE(r->fields);
+  PyObject *convert = Py_None, *val;
+  int rc;
+
+  if (r->converters && column < PyTuple_GET_SIZE(r->converters))
+    convert = PyTuple_GET_ITEM(r->converters, column);
+
+  val = csv_convert(r, convert);
+  if (! val)
+    return -1;
+
+  rc = PyList_Append(r->fields, val);
+  Py_DECREF(val);
+  r->field_len = 0;
+
+  return rc;
+}
+
+
+/* Parses the next record into r->fields. Returns 1 when a record was
+   read, 0 at the end of the input, or -1 with an exception set */
+static int csv_parse_record(CsvReader *r) {
+  enum csv_state state = START_FIELD;
+  PyObject *line;
+  const char *data;
+  Py_ssize_t len, index;
+  char c;
+
+  Py_XSETREF(r->fields, PyList_New(0));
+  if (! r->fields)
+    return -1;
+
+  r->field_len = 0;
+
+  while (1) {
+    line = PyIter_Next(r->lines);
+    if (! line) {
+      if (PyErr_Occurred())
+	return -1;
+
+      if (state == IN_QUOTED) {
+	PyErr_Format(PyExc_ValueError, "csv line %zd: unexpected end of"
+		     " data inside a quoted field", r->line_num);
+	return -1;
+
+      } else if (state == START_FIELD && ! PyList_GET_SIZE(r->fields)) {
+	return 0;
+
+      } else {
+	// the final record had no line terminator
+	return csv_emit_field(r)? -1: 1;
+      }
+    }
+
+    if (! PyUnicode_Check(line)) {
+      PyErr_Format(PyExc_TypeError, "csv lines must be str, not %.200s",
+		   Py_TYPE(line)->tp_name);
+      Py_DECREF(line);
+      return -1;
+    }
+
+    r->line_num++;
+    data = PyUnicode_AsUTF8AndSize(line, &len);
+    if (! data) {
+      Py_DECREF(line);
+      return -1;
+    }
+
+    // the delimiter and quote are ASCII, so walking the UTF-8 bytes
+    // never splits a multi-byte character out of a field
+    for (index = 0; index < len; index++) {
+      c = data[index];
+
+      switch (state) {
+      case START_FIELD:
+	if (c == r->quotechar) {
+	  state = IN_QUOTED;
+	  break;
+	} else if (c == '\r' || c == '\n') {
+	  goto end_of_line;
+	}
+	state = IN_FIELD;
+	// fall through
+
+      case IN_FIELD:
+	if (c == r->delimiter) {
+	  if (csv_emit_field(r))
+	    goto error;
+	  state = START_FIELD;
+	} else if (c == '\r' || c == '\n') {
+	  goto end_of_line;
+	} else if (csv_field_append(r, c)) {
+	  goto error;
+	}
+	break;
+
+      case IN_QUOTED:
+	if (c == r->quotechar) {
+	  state = QUOTE_IN_QUOTED;
+	} else if (csv_field_append(r, c)) {
+	  goto error;
+	}
+	break;
+
+      case QUOTE_IN_QUOTED:
+	if (c == r->quotechar) {
+	  // a doubled quote is a literal one
+	  if (csv_field_append(r, c))
+	    goto error;
+	  state = IN_QUOTED;
+	} else if (c == r->delimiter) {
+	  if (csv_emit_field(r))
+	    goto error;
+	  state = START_FIELD;
+	} else if (c == '\r' || c == '\n') {
+	  goto end_of_line;
+	} else {
+	  if (csv_field_append(r, c))
+	    goto error;
+	  state = IN_FIELD;
+	}
+	break;
+      }
+    }
+
+    Py_DECREF(line);
+
+    if (state != IN_QUOTED) {
+      // a line that ran out without its terminator
+      if (state == START_FIELD && ! PyList_GET_SIZE(r->fields))
+	continue;
+      return csv_emit_field(r)? -1: 1;
+    }
+
+    // still inside quotes, so the record carries on with the next line
+    continue;
+
+  end_of_line:
+    // only a line's own terminator may end it. Anything after a bare
+    // \r is refused, as csv does, rather than silently dropped
+    if (! (index + 1 == len ||
+	   (index + 2 == len && data[index] == '\r' &&
+	    data[index + 1] == '\n'))) {
+      PyErr_Format(PyExc_ValueError, "csv line %zd: new-line character"
+		   " seen in unquoted field", r->line_num);
+      goto error;
+    }
+
+    Py_DECREF(line);
+
+    if (state == START_FIELD && ! PyList_GET_SIZE(r->fields)) {
+      // a blank line, which isn't a record
+      continue;
+    }
+    return csv_emit_field(r)? -1: 1;
+  }
+
+ error:
+  Py_DECREF(line);
+  return -1;
+}
+
+
+/* Resolves the types argument against the header into a tuple with
+   one converter (or None) per column */
+static int csv_resolve_types(CsvReader *r) {
+  PyObject *types = r->types, *conv, *found;
+  Py_ssize_t index, count;
+
+  if (! types || types == Py_None)
+    return 0;
+
+  if (PyDict_Check(types)) {
+    count = r->header? PyTuple_GET_SIZE(r->header): 0;
+    if (PyDict_Size(types) && ! count) {
+      // without a header, the dict can only be keyed by column
+      PyObject *key, *val;
+      Py_ssize_t pos = 0;
+
+      while (PyDict_Next(types, &pos, &key, &val)) {
+	index = PyLong_AsSsize_t(key);
+	if (index == -1 && PyErr_Occurred())
+	  return -1;
+	if (index + 1 > count)
+	  count = index + 1;
+      }
+    }
+
+    conv = PyTuple_New(count);
+    if (! conv)
+      return -1;
+
+    for (index = 0; index < count; index++) {
+      found = NULL;
+
+      if (r->header) {
+	found = PyDict_GetItemWithError(types,
+					PyTuple_GET_ITEM(r->header, index));
+      }
+      if (! found && ! PyErr_Occurred()) {
+	PyObject *col = PyLong_FromSsize_t(index);
+	found = col? PyDict_GetItemWithError(types, col): NULL;
+	Py_XDECREF(col);
+      }
+      if (! found) {
+	if (PyErr_Occurred()) {
+	  Py_DECREF(conv);
+	  return -1;
+	}
+	found = Py_None;
+      }
+
+      Py_INCREF(found);
+      PyTuple_SET_ITEM(conv, index, found);
+    }
+
+  } else {
+    conv = PySequence_Tuple(types);
+    if (! conv)
+      return -1;
+  }
+
+  r->converters = conv;
+  return 0;
+}
+
+
+static int csv_read_header(CsvReader *r, PyObject *names) {
+  Py_ssize_t index, count;
+  PyObject *name;
+  int rc;
+
+  if (! names) {
+    rc = csv_parse_record(r);
+    if (rc <= 0)
+      return rc;
+    names = r->fields;
+  }
+
+  names = PySequence_Fast(names, "csv header must be a sequence");
+  if (! names)
+    return -1;
+
+  count = PySequence_Fast_GET_SIZE(names);
+  r->header = PyTuple_New(count);
+  r->template = PyDict_New();
+  if (! (r->header && r->template)) {
+    Py_DECREF(names);
+    return -1;
+  }
+
+  // every row shares these same interned key objects, so all of the
+  // lookups against them hit on identity
+  for (index = 0; index < count; index++) {
+    name = PySequence_Fast_GET_ITEM(names, index);
+    if (! PyUnicode_CheckExact(name)) {
+      PyErr_SetString(PyExc_TypeError, "csv header names must be str");
+      Py_DECREF(names);
+      return -1;
+    }
+
+    Py_INCREF(name);
+    PyUnicode_InternInPlace(&name);
+    PyTuple_SET_ITEM(r->header, index, name);
+
+    if (PyDict_SetItem(r->template, name, Py_None)) {
+      Py_DECREF(names);
+      return -1;
+    }
+  }
+
+  Py_DECREF(names);
+  return 1;
+}
+
+
+static PyObject *csv_next(PyObject *self) {
+  CsvReader *r = (CsvReader *) self;
+  PyObject *args, *kwds;
+  PyValues *result;
+  Py_ssize_t index, count;
+  int rc;
+
+  if (! r->lines)
+    return NULL;
+
+  rc = csv_parse_record(r);
+  if (rc <= 0)
+    return NULL;
+
+  if (! r->header) {
+    args = PyList_AsTuple(r->fields);
+    if (! args)
+      return NULL;
+
+    result = (PyValues *) sib_values(args, NULL);
+    Py_DECREF(args);
+    return (PyObject *) result;
+  }
+
+  count = PyTuple_GET_SIZE(r->header);
+  if (PyList_GET_SIZE(r->fields) != count) {
+    PyErr_Format(PyExc_ValueError, "csv line %zd: %zd fields, but the"
+		 " header has %zd", r->line_num,
+		 PyList_GET_SIZE(r->fields), count);
+    return NULL;
+  }
+
+  // a copy of the template has a correctly sized table with all of
+  // the keys in place, so filling it in never resizes
+  kwds = PyDict_Copy(r->template);
+  if (! kwds)
+    return NULL;
+
+  for (index = 0; index < count; index++) {
+    if (PyDict_SetItem(kwds, PyTuple_GET_ITEM(r->header, index),
+		       PyList_GET_ITEM(r->fields, index))) {
+      Py_DECREF(kwds);
+      return NULL;
+    }
+  }
+
+  args = PyTuple_New(0);
+  if (! args) {
+    Py_DECREF(kwds);
+    return NULL;
+  }
+
+  result = (PyValues *) sib_values_take(args, kwds);
+  Py_DECREF(args);
+
+  return (PyObject *) result;
+}
+
+
+static void csv_dealloc(PyObject *self) {
+  CsvReader *r = (CsvReader *) self;
+
+  PyObject_GC_UnTrack(self);
+
+  Py_XDECREF(r->lines);
+  Py_XDECREF(r->header);
+  Py_XDECREF(r->template);
+  Py_XDECREF(r->types);
+  Py_XDECREF(r->converters);
+  Py_XDECREF(r->fields);
+  PyMem_Free(r->field);
+
+  PyObject_GC_Del(self);
+}
+
+
+static int csv_traverse(PyObject *self, visitproc visit, void *arg) {
+  CsvReader *r = (CsvReader *) self;
+
+  Py_VISIT(r->lines);
+  Py_VISIT(r->header);
+  Py_VISIT(r->template);
+  Py_VISIT(r->types);
+  Py_VISIT(r->converters);
+  Py_VISIT(r->fields);
+  return 0;
+}
+
+
+static int csv_clear(PyObject *self) {
+  CsvReader *r = (CsvReader *) self;
+
+  // without lines, csv_next simply stops
+  Py_CLEAR(r->lines);
+  Py_CLEAR(r->header);
+  Py_CLEAR(r->template);
+  Py_CLEAR(r->types);
+  Py_CLEAR(r->converters);
+  Py_CLEAR(r->fields);
+  return 0;
+}
+
+
+static PyObject *csv_get_fieldnames(PyObject *self, void *_closure) {
+  CsvReader *r = (CsvReader *) self;
+  PyObject *result = r->header? r->header: Py_None;
+
+  Py_INCREF(result);
+  return result;
+}
+
+
+static PyObject *csv_get_line_num(PyObject *self, void *_closure) {
+  return PyLong_FromSsize_t(((CsvReader *) self)->line_num);
+}
+
+
+static PyGetSetDef csv_getset[] = {
+  { "fieldnames", csv_get_fieldnames, NULL,
+    "the names from the header, or None", NULL },
+  { "line_num", csv_get_line_num, NULL,
+    "the number of lines read so far", NULL },
+  { NULL },
+};
+
+
+PyTypeObject PyValuesCsvReaderType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "csv_reader",
+  sizeof(CsvReader),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC,
+  .tp_dealloc = csv_dealloc,
+  .tp_traverse = csv_traverse,
+  .tp_clear = csv_clear,
+  .tp_iter = PyObject_SelfIter,
+  .tp_iternext = csv_next,
+  .tp_getset = csv_getset,
+};
+
+
+static int csv_char(PyObject *given, const char *name, char *result) {
+  Py_ssize_t len;
+  const char *data = PyUnicode_AsUTF8AndSize(given, &len);
+
+  if (! data)
+    return -1;
+
+  if (len != 1 || (data[0] & 0x80) || data[0] == '\r' || data[0] == '\n') {
+    PyErr_Format(PyExc_ValueError, "csv %s must be a single ASCII"
+		 " character", name);
+    return -1;
+  }
+
+  *result = data[0];
+  return 0;
+}
+
+
+PyObject *values_csv_reader(PyObject *mod, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "fileobj", "header", "types",
+			    "delimiter", "quotechar", NULL };
+
+  PyObject *fileobj, *header = Py_True, *types = Py_None;
+  PyObject *delimiter = NULL, *quotechar = NULL;
+  CsvReader *r;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|OOUU:csv_reader", kwlist,
+				    &fileobj, &header, &types,
+				    &delimiter, &quotechar))
+    return NULL;
+
+  r = PyObject_GC_New(CsvReader, &PyValuesCsvReaderType);
+  if (! r)
+    return NULL;
+
+  r->lines = NULL;
+  r->header = NULL;
+  r->template = NULL;
+  r->types = NULL;
+  r->converters = NULL;
+  r->fields = NULL;
+  r->delimiter = ',';
+  r->quotechar = '"';
+  r->line_num = 0;
+  r->field_len = 0;
+  r->field_size = 256;
+  r->field = PyMem_Malloc(r->field_size);
+
+  PyObject_GC_Track((PyObject *) r);
+
+  if (! r->field) {
+    PyErr_NoMemory();
+    goto error;
+  }
+
+  if ((delimiter && csv_char(delimiter, "delimiter", &r->delimiter)) ||
+      (quotechar && csv_char(quotechar, "quotechar", &r->quotechar)))
+    goto error;
+
+  r->lines = PyObject_GetIter(fileobj);
+  if (! r->lines)
+    goto error;
+
+  Py_INCREF(types);
+  r->types = types;
+
+  if (header == Py_True) {
+    if (csv_read_header(r, NULL) < 0)
+      goto error;
+
+  } else if (header != Py_False && header != Py_None) {
+    // an explicit list of names
+    if (csv_read_header(r, header) < 0)
+      goto error;
+  }
+
+  if (csv_resolve_types(r))
+    goto error;
+
+  return (PyObject *) r;
+
+ error:
+  Py_DECREF(r);
+  return NULL;
+}
+
+
+/* The end. */
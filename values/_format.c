@@ -0,0 +1,515 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values formatter
+
+   A str.format template parsed once into a plan, so that rendering
+   it is a single walk over literal text and fields.
+
+   Each field of the plan records where its value comes from: a
+   positional index or a keyword, any attribute and item lookups after
+   that, its conversion, and its format spec. A spec which itself
+   holds replacement fields is compiled into a nested plan.
+
+   Given a values, fields are resolved directly against its positional
+   tuple and keyword dict, with no unpacking of either into a call.
+   Given anything else, the formatter works like template.format.
+
+   The parsing is done by the same helpers which string.Formatter
+   uses, so the template language is exactly that of str.format.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+
+
+enum fmt_source {
+  FMT_NONE,
+  FMT_INDEX,
+  FMT_KEY,
+};
+
+
+typedef struct fmt_field {
+  PyObject *literal;
+  enum fmt_source source;
+  Py_ssize_t index;
+  PyObject *key;
+  PyObject *path;
+  Py_UCS4 conversion;
+  PyObject *spec;
+} fmt_field;
+
+
+typedef struct Formatter {
+  PyObject_HEAD
+
+  PyObject *template;
+  Py_ssize_t count;
+  fmt_field *fields;
+} Formatter;
+
+
+/* tracks automatic field numbering across a template and the specs
+   nested in it, as str.format does */
+typedef struct fmt_numbering {
+  int manual;
+  int automatic;
+  Py_ssize_t next;
+} fmt_numbering;
+
+
+static PyObject *fmt_parser = NULL;
+static PyObject *fmt_name_split = NULL;
+static PyObject *fmt_empty = NULL;
+
+
+static int fmt_init(void) {
+  PyObject *mod;
+
+  if (fmt_parser)
+    return 0;
+
+  fmt_empty = PyUnicode_FromString("");
+  if (! fmt_empty)
+    return -1;
+
+  mod = PyImport_ImportModule("_string");
+  if (! mod)
+    return -1;
+
+  fmt_parser = PyObject_GetAttrString(mod, "formatter_parser");
+  fmt_name_split = PyObject_GetAttrString(mod, "formatter_field_name_split");
+  Py_DECREF(mod);
+
+  if (! (fmt_parser && fmt_name_split)) {
+    Py_CLEAR(fmt_parser);
+    Py_CLEAR(fmt_name_split);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* === compiling === */
+
+
+static Formatter *fmt_compile(PyObject *template, fmt_numbering *numbering);
+
+
+static int fmt_compile_name(fmt_field *field, PyObject *name,
+			    fmt_numbering *numbering) {
+
+  PyObject *split, *first, *rest, *path;
+
+  split = PyObject_CallFunctionObjArgs(fmt_name_split, name, NULL);
+  if (! split)
+    return -1;
+
+  first = PyTuple_GET_ITEM(split, 0);
+  rest = PyTuple_GET_ITEM(split, 1);
+
+  if (PyLong_Check(first) ||
+      (PyUnicode_Check(first) && ! PyUnicode_GET_LENGTH(first))) {
+
+    if (PyLong_Check(first)) {
+      if (numbering->automatic) {
+	PyErr_SetString(PyExc_ValueError, "cannot switch from automatic"
+			" field numbering to manual field specification");
+	Py_DECREF(split);
+	return -1;
+      }
+      numbering->manual = 1;
+      field->index = PyLong_AsSsize_t(first);
+
+    } else {
+      if (numbering->manual) {
+	PyErr_SetString(PyExc_ValueError, "cannot switch from manual"
+			" field specification to automatic field numbering");
+	Py_DECREF(split);
+	return -1;
+      }
+      numbering->automatic = 1;
+      field->index = numbering->next++;
+    }
+
+    if (field->index == -1 && PyErr_Occurred()) {
+      Py_DECREF(split);
+      return -1;
+    }
+    field->source = FMT_INDEX;
+
+  } else {
+    Py_INCREF(first);
+    field->key = first;
+    field->source = FMT_KEY;
+  }
+
+  path = PySequence_Tuple(rest);
+  Py_DECREF(split);
+  if (! path)
+    return -1;
+
+  if (PyTuple_GET_SIZE(path)) {
+    field->path = path;
+  } else {
+    Py_DECREF(path);
+  }
+
+  return 0;
+}
+
+
+static int fmt_compile_field(fmt_field *field, PyObject *parsed,
+			     fmt_numbering *numbering) {
+
+  PyObject *literal, *name, *spec, *conversion;
+
+  literal = PyTuple_GET_ITEM(parsed, 0);
+  name = PyTuple_GET_ITEM(parsed, 1);
+  spec = PyTuple_GET_ITEM(parsed, 2);
+  conversion = PyTuple_GET_ITEM(parsed, 3);
+
+  if (PyUnicode_GET_LENGTH(literal)) {
+    Py_INCREF(literal);
+    field->literal = literal;
+  }
+
+  if (name == Py_None)
+    return 0;
+
+  if (fmt_compile_name(field, name, numbering))
+    return -1;
+
+  if (conversion != Py_None) {
+    field->conversion = PyUnicode_READ_CHAR(conversion, 0);
+    if (field->conversion != 'r' && field->conversion != 's' &&
+	field->conversion != 'a') {
+      PyErr_Format(PyExc_ValueError, "Unknown conversion specifier %U",
+		   conversion);
+      return -1;
+    }
+  }
+
+  if (PyUnicode_FindChar(spec, '{', 0, PyUnicode_GET_LENGTH(spec), 1) >= 0) {
+    // the spec has fields of its own to fill in first
+    field->spec = (PyObject *) fmt_compile(spec, numbering);
+    if (! field->spec)
+      return -1;
+
+  } else if (PyUnicode_GET_LENGTH(spec)) {
+    Py_INCREF(spec);
+    field->spec = spec;
+  }
+
+  return 0;
+}
+
+
+static Formatter *fmt_compile(PyObject *template, fmt_numbering *numbering) {
+  PyObject *parsed;
+  Py_ssize_t index, count;
+  Formatter *f;
+
+  parsed = PyObject_CallFunctionObjArgs(fmt_parser, template, NULL);
+  if (! parsed)
+    return NULL;
+
+  Py_SETREF(parsed, PySequence_List(parsed));
+  if (! parsed)
+    return NULL;
+
+  f = PyObject_New(Formatter, &PyValuesFormatterType);
+  if (! f) {
+    Py_DECREF(parsed);
+    return NULL;
+  }
+
+  count = PyList_GET_SIZE(parsed);
+
+  Py_INCREF(template);
+  f->template = template;
+  f->count = count;
+  f->fields = PyMem_New(fmt_field, count);
+
+  if (! f->fields) {
+    f->count = 0;
+    Py_DECREF(f);
+    Py_DECREF(parsed);
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  memset(f->fields, 0, sizeof(fmt_field) * count);
+
+  for (index = 0; index < count; index++) {
+    if (fmt_compile_field(f->fields + index,
+			  PyList_GET_ITEM(parsed, index), numbering)) {
+      Py_DECREF(f);
+      Py_DECREF(parsed);
+      return NULL;
+    }
+  }
+
+  Py_DECREF(parsed);
+  return f;
+}
+
+
+/* === rendering === */
+
+
+static PyObject *fmt_render(Formatter *f, PyValues *v,
+			    PyObject *args, PyObject *kwds);
+
+
+static PyObject *fmt_resolve(fmt_field *field, PyValues *v,
+			     PyObject *args, PyObject *kwds) {
+
+  PyObject *obj, *tmp;
+  Py_ssize_t index;
+
+  if (field->source == FMT_INDEX) {
+    if (field->index >= PyTuple_GET_SIZE(args)) {
+      PyErr_Format(PyExc_IndexError, "Replacement index %zd out of range"
+		   " for positional args tuple", field->index);
+      return NULL;
+    }
+    obj = PyTuple_GET_ITEM(args, field->index);
+    Py_INCREF(obj);
+
+  } else {
+    obj = kwds? PyDict_GetItemWithError(kwds, field->key): NULL;
+    if (! obj) {
+      if (! PyErr_Occurred())
+	PyErr_SetObject(PyExc_KeyError, field->key);
+      return NULL;
+    }
+
+    if (v && unlikely(PyLazyField_Check(obj))) {
+      obj = values_kwd_force(v, field->key, obj);
+      if (! obj)
+	return NULL;
+    } else {
+      Py_INCREF(obj);
+    }
+  }
+
+  if (field->path) {
+    for (index = 0; obj && index < PyTuple_GET_SIZE(field->path); index++) {
+      PyObject *step = PyTuple_GET_ITEM(field->path, index);
+
+      if (PyObject_IsTrue(PyTuple_GET_ITEM(step, 0))) {
+	tmp = PyObject_GetAttr(obj, PyTuple_GET_ITEM(step, 1));
+      } else {
+	tmp = PyObject_GetItem(obj, PyTuple_GET_ITEM(step, 1));
+      }
+      Py_SETREF(obj, tmp);
+    }
+  }
+
+  return obj;
+}
+
+
+static PyObject *fmt_render_field(fmt_field *field, PyValues *v,
+				  PyObject *args, PyObject *kwds) {
+
+  PyObject *obj, *spec, *result;
+
+  obj = fmt_resolve(field, v, args, kwds);
+  if (! obj)
+    return NULL;
+
+  switch (field->conversion) {
+  case 'r':
+    Py_SETREF(obj, PyObject_Repr(obj));
+    break;
+  case 's':
+    Py_SETREF(obj, PyObject_Str(obj));
+    break;
+  case 'a':
+    Py_SETREF(obj, PyObject_ASCII(obj));
+    break;
+  }
+
+  if (! obj)
+    return NULL;
+
+  if (! field->spec) {
+    // the common case, so skip the format protocol for plain strs
+    if (PyUnicode_CheckExact(obj))
+      return obj;
+
+    result = PyObject_Format(obj, NULL);
+
+  } else if (PyUnicode_Check(field->spec)) {
+    result = PyObject_Format(obj, field->spec);
+
+  } else {
+    spec = fmt_render((Formatter *) field->spec, v, args, kwds);
+    result = spec? PyObject_Format(obj, spec): NULL;
+    Py_XDECREF(spec);
+  }
+
+  Py_DECREF(obj);
+  return result;
+}
+
+
+static PyObject *fmt_render(Formatter *f, PyValues *v,
+			    PyObject *args, PyObject *kwds) {
+
+  PyObject *pieces, *piece, *result;
+  Py_ssize_t index, used = 0;
+  fmt_field *field;
+
+  pieces = PyList_New(f->count * 2);
+  if (! pieces)
+    return NULL;
+
+  for (index = 0; index < f->count; index++) {
+    field = f->fields + index;
+
+    if (field->literal) {
+      Py_INCREF(field->literal);
+      PyList_SET_ITEM(pieces, used++, field->literal);
+    }
+
+    if (field->source != FMT_NONE) {
+      piece = fmt_render_field(field, v, args, kwds);
+      if (! piece) {
+	Py_DECREF(pieces);
+	return NULL;
+      }
+      PyList_SET_ITEM(pieces, used++, piece);
+    }
+  }
+
+  // the unused tail was never filled, so it can simply be cut off
+  Py_SET_SIZE(pieces, used);
+
+  result = PyUnicode_Join(fmt_empty, pieces);
+  Py_DECREF(pieces);
+
+  return result;
+}
+
+
+static PyObject *fmt_call(PyObject *self, PyObject *args, PyObject *kwds) {
+  Formatter *f = (Formatter *) self;
+  PyObject *only;
+
+  if (PyTuple_GET_SIZE(args) == 1 && ! (kwds && PyDict_GET_SIZE(kwds))) {
+    only = PyTuple_GET_ITEM(args, 0);
+
+    if (PyValues_Check(only)) {
+      PyValues *v = (PyValues *) only;
+      return fmt_render(f, v, v->args, v->kwds);
+    }
+  }
+
+  return fmt_render(f, NULL, args, kwds);
+}
+
+
+/* === type === */
+
+
+static PyObject *fmt_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "template", NULL };
+
+  fmt_numbering numbering = { 0, 0, 0 };
+  PyObject *template;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "U:formatter", kwlist,
+				    &template))
+    return NULL;
+
+  if (fmt_init())
+    return NULL;
+
+  return (PyObject *) fmt_compile(template, &numbering);
+}
+
+
+static void fmt_dealloc(PyObject *self) {
+  Formatter *f = (Formatter *) self;
+  Py_ssize_t index;
+
+  for (index = 0; index < f->count; index++) {
+    fmt_field *field = f->fields + index;
+
+    Py_XDECREF(field->literal);
+    Py_XDECREF(field->key);
+    Py_XDECREF(field->path);
+    Py_XDECREF(field->spec);
+  }
+
+  PyMem_Free(f->fields);
+  Py_XDECREF(f->template);
+
+  PyObject_Del(self);
+}
+
+
+static PyObject *fmt_repr(PyObject *self) {
+  return PyUnicode_FromFormat("formatter(%R)", ((Formatter *) self)->template);
+}
+
+
+static PyObject *fmt_get_template(PyObject *self, void *_closure) {
+  PyObject *template = ((Formatter *) self)->template;
+  Py_INCREF(template);
+  return template;
+}
+
+
+static PyGetSetDef fmt_getset[] = {
+  { "template", fmt_get_template, NULL,
+    "the str.format template this was compiled from", NULL },
+  { NULL },
+};
+
+
+PyTypeObject PyValuesFormatterType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "formatter",
+  sizeof(Formatter),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = "formatter(template)\n"
+  "A str.format template compiled once for repeated rendering. Called\n"
+  "with a values, its fields resolve against the values' positionals\n"
+  "and keywords directly. Called with anything else, it is the same\n"
+  "as template.format(*args, **kwds)",
+  .tp_new = fmt_new,
+  .tp_dealloc = fmt_dealloc,
+  .tp_call = fmt_call,
+  .tp_repr = fmt_repr,
+  .tp_getset = fmt_getset,
+};
+
+
+/* The end. */
@@ -0,0 +1,917 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values Index
+
+   A hash index over a collection of records, by one or more of their
+   fields. Where a dict would need a key object for every record (and
+   a tuple of the fields, for a composite key), this keeps nothing but
+   the record itself and the hash of its fields.
+
+   The layout is that of a compact dict. Entries are kept in the order
+   they were added, and an open addressed table of slots holds their
+   positions. Discarding a record empties its entry, which is only
+   reclaimed once the entries are rebuilt. Slots are never emptied
+   short of a rebuild, so records of the same key are always met in
+   the order they were added when probing.
+
+   Probing compares the fields of each candidate record against the
+   key given, in place, so a lookup allocates nothing.
+
+   Entries grow by half again as they fill, or are sized exactly when
+   the count is known up front. Slots are 32 bits wide, which limits
+   an Index to INDEX_MAX records.
+
+   join builds one of these over the smaller of its two sides, and
+   probes it with the fields of each record of the other.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+#define INDEX_MIN_SLOTS 8
+#define INDEX_EMPTY (-1)
+#define INDEX_MAX ((Py_ssize_t) INT32_MAX)
+
+/* the same mixing as CPython's tuple hash, but over the fields */
+#define INDEX_PRIME_1 ((Py_uhash_t) 11400714785074694791ULL)
+#define INDEX_PRIME_2 ((Py_uhash_t) 14029467366897019727ULL)
+#define INDEX_PRIME_5 ((Py_uhash_t) 2870177450012600261ULL)
+#define INDEX_ROTATE(x)					\
+  (((x) << 31) | ((x) >> (8 * sizeof(Py_uhash_t) - 31)))
+
+
+typedef struct index_entry {
+  Py_hash_t hash;
+  PyObject *rec;  // NULL once discarded
+} index_entry;
+
+
+typedef struct Index {
+  PyObject_HEAD
+
+  PyObject *on;
+
+  index_entry *entries;
+  Py_ssize_t used;
+  Py_ssize_t allocated;
+  Py_ssize_t live;
+
+  int32_t *slots;
+  size_t mask;
+
+  // bumped by every change, so a lookup calling back into Python
+  // code can tell that the table moved under it
+  unsigned long long version;
+} Index;
+
+
+/* === hashing and matching === */
+
+
+static Py_uhash_t index_mix(Py_uhash_t acc, Py_hash_t lane) {
+  acc += (Py_uhash_t) lane * INDEX_PRIME_2;
+  acc = INDEX_ROTATE(acc);
+  return acc * INDEX_PRIME_1;
+}
+
+
+/* the hash of rec's fields. A single field hashes as itself, so that
+   its value can be looked up directly */
+static int index_hash_rec(Index *idx, PyObject *rec, Py_hash_t *hash) {
+  Py_ssize_t index, count = PyTuple_GET_SIZE(idx->on);
+  Py_uhash_t acc = INDEX_PRIME_5;
+  PyObject *field;
+  Py_hash_t lane;
+
+  for (index = 0; index < count; index++) {
+    field = record_field(rec, PyTuple_GET_ITEM(idx->on, index));
+    if (! field)
+      return -1;
+
+    lane = PyObject_Hash(field);
+    Py_DECREF(field);
+    if (lane == -1)
+      return -1;
+
+    if (count == 1) {
+      *hash = lane;
+      return 0;
+    }
+    acc = index_mix(acc, lane);
+  }
+
+  *hash = (Py_hash_t) acc;
+  return 0;
+}
+
+
+/* the fields of a key as given to get, get_all or in. That's the value
+   itself for a single field, otherwise a tuple of as many values as
+   there are fields. Borrowed, there's nothing to release */
+static PyObject **index_key_items(Index *idx, PyObject **key) {
+  Py_ssize_t count = PyTuple_GET_SIZE(idx->on);
+
+  if (count == 1)
+    return key;
+
+  if (! PyTuple_Check(*key) || PyTuple_GET_SIZE(*key) != count) {
+    PyErr_Format(PyExc_TypeError, "Index on %zd fields requires keys which"
+		 " are a tuple of %zd values", count, count);
+    return NULL;
+  }
+
+  return PySequence_Fast_ITEMS(*key);
+}
+
+
+static int index_hash_key(Index *idx, PyObject **items, Py_hash_t *hash) {
+  Py_ssize_t index, count = PyTuple_GET_SIZE(idx->on);
+  Py_uhash_t acc = INDEX_PRIME_5;
+  Py_hash_t lane;
+
+  for (index = 0; index < count; index++) {
+    lane = PyObject_Hash(items[index]);
+    if (lane == -1)
+      return -1;
+
+    if (count == 1) {
+      *hash = lane;
+      return 0;
+    }
+    acc = index_mix(acc, lane);
+  }
+
+  *hash = (Py_hash_t) acc;
+  return 0;
+}
+
+
+/* whether the fields of rec equal the key items, or -1 with an
+   exception set */
+static int index_match(Index *idx, PyObject *rec, PyObject **items) {
+  Py_ssize_t index, count = PyTuple_GET_SIZE(idx->on);
+  PyObject *field;
+  int found = 1;
+
+  for (index = 0; found == 1 && index < count; index++) {
+    field = record_field(rec, PyTuple_GET_ITEM(idx->on, index));
+    if (! field)
+      return -1;
+
+    found = PyObject_RichCompareBool(field, items[index], Py_EQ);
+    Py_DECREF(field);
+  }
+
+  return found;
+}
+
+
+/* === the table === */
+
+
+/* The first slot to probe for a hash. Probing then moves on by
+   triangular steps, which visit every slot of a power of two table
+   exactly once, so that no record is met twice. The hash is spread
+   first, as ints hash to themselves and would otherwise pile up. */
+static inline size_t index_home(Index *idx, Py_hash_t hash) {
+  uint64_t spread = (uint64_t) hash * 0x9E3779B97F4A7C15ULL;
+  return (size_t) (spread ^ (spread >> 32)) & idx->mask;
+}
+
+
+#define INDEX_PROBE(idx, at, step)			\
+  ((at) = ((at) + ++(step)) & (idx)->mask)
+
+
+/* the slot to insert an entry of the given hash into */
+static int32_t *index_free_slot(Index *idx, Py_hash_t hash) {
+  size_t at = index_home(idx, hash), step = 0;
+
+  while (idx->slots[at] != INDEX_EMPTY)
+    INDEX_PROBE(idx, at, step);
+
+  return idx->slots + at;
+}
+
+
+/* Makes room for extra more entries, dropping the discarded ones and
+   rebuilding the slots if need be. Returns 0 on success, or -1 with an
+   exception set, leaving the table as it was. */
+static int index_reserve(Index *idx, Py_ssize_t extra) {
+  Py_ssize_t index, used = 0, need, allocated;
+  index_entry *entries;
+  size_t count = INDEX_MIN_SLOTS;
+  int32_t *slots;
+
+  if (idx->used + extra <= idx->allocated)
+    return 0;
+
+  need = idx->live + extra;
+  if (need > INDEX_MAX || need < 0) {
+    PyErr_SetString(PyExc_OverflowError, "Index is too large");
+    return -1;
+  }
+
+  // half again as much as was used, unless asked for more than that
+  allocated = idx->used + idx->used / 2;
+  if (allocated < need)
+    allocated = need;
+  if (allocated > INDEX_MAX)
+    allocated = INDEX_MAX;
+
+  // no more than two thirds full, as a dict would be
+  while ((Py_ssize_t) (count / 3 * 2) < allocated)
+    count <<= 1;
+
+  entries = PyMem_New(index_entry, allocated);
+  slots = PyMem_New(int32_t, count);
+  if (! (entries && slots)) {
+    PyMem_Free(entries);
+    PyMem_Free(slots);
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  for (index = 0; index < (Py_ssize_t) count; index++)
+    slots[index] = INDEX_EMPTY;
+
+  for (index = 0; index < idx->used; index++) {
+    if (idx->entries[index].rec)
+      entries[used++] = idx->entries[index];
+  }
+
+  PyMem_Free(idx->entries);
+  PyMem_Free(idx->slots);
+
+  idx->entries = entries;
+  idx->used = used;
+  idx->allocated = allocated;
+  idx->slots = slots;
+  idx->mask = count - 1;
+  idx->version++;
+
+  for (index = 0; index < used; index++)
+    *index_free_slot(idx, entries[index].hash) = (int32_t) index;
+
+  return 0;
+}
+
+
+static int index_add(Index *idx, PyObject *rec) {
+  Py_hash_t hash;
+
+  if (index_hash_rec(idx, rec, &hash) || index_reserve(idx, 1))
+    return -1;
+
+  Py_INCREF(rec);
+  idx->entries[idx->used].hash = hash;
+  idx->entries[idx->used].rec = rec;
+  *index_free_slot(idx, hash) = (int32_t) idx->used++;
+  idx->live++;
+  idx->version++;
+
+  return 0;
+}
+
+
+/* Calls found for each record matching the key items, with its
+   position among the entries, in the order they were added, until
+   found returns anything but zero. Returns
+   what found last returned, 0 if nothing matched, or -1 with an
+   exception set. */
+static int index_probe(Index *idx, PyObject **items,
+		       int (*found)(PyObject *rec, Py_ssize_t position,
+				    void *arg),
+		       void *arg) {
+
+  unsigned long long version = idx->version;
+  size_t at, step = 0;
+  int32_t position;
+  index_entry *entry;
+  PyObject *rec;
+  Py_hash_t hash;
+  int match, rc;
+
+  if (! idx->live)
+    return 0;
+
+  if (index_hash_key(idx, items, &hash))
+    return -1;
+
+  at = index_home(idx, hash);
+
+  while ((position = idx->slots[at]) != INDEX_EMPTY) {
+    entry = idx->entries + position;
+
+    if (entry->hash == hash && (rec = entry->rec)) {
+      Py_INCREF(rec);
+      match = index_match(idx, rec, items);
+
+      if (version != idx->version) {
+	if (match >= 0)
+	  PyErr_SetString(PyExc_RuntimeError,
+			  "Index changed size during lookup");
+	match = -1;
+      }
+
+      rc = match > 0? found(rec, position, arg): match;
+      Py_DECREF(rec);
+
+      if (rc)
+	return rc;
+    }
+
+    INDEX_PROBE(idx, at, step);
+  }
+
+  return 0;
+}
+
+
+static int index_found_first(PyObject *rec, Py_ssize_t position,
+			     void *arg) {
+
+  Py_INCREF(rec);
+  *((PyObject **) arg) = rec;
+  return 1;
+}
+
+
+static int index_found_all(PyObject *rec, Py_ssize_t position,
+			   void *arg) {
+
+  return PyList_Append((PyObject *) arg, rec)? -1: 0;
+}
+
+
+/* === methods === */
+
+
+static PyObject *index_get(PyObject *self, PyObject *const *args,
+			   Py_ssize_t nargs) {
+
+  PyObject *key, *dflt = Py_None, *result = NULL, **items;
+
+  // this is the hot path, so no argument parsing
+  if (nargs < 1 || nargs > 2) {
+    PyErr_Format(PyExc_TypeError, "get expected 1 or 2 arguments, got %zd",
+		 nargs);
+    return NULL;
+  }
+
+  key = args[0];
+  if (nargs == 2)
+    dflt = args[1];
+
+  items = index_key_items((Index *) self, &key);
+  if (! items)
+    return NULL;
+
+  if (index_probe((Index *) self, items, index_found_first, &result) < 0)
+    return NULL;
+
+  if (! result) {
+    Py_INCREF(dflt);
+    result = dflt;
+  }
+
+  return result;
+}
+
+
+static PyObject *index_get_all(PyObject *self, PyObject *key) {
+  PyObject *result, **items;
+
+  items = index_key_items((Index *) self, &key);
+  if (! items)
+    return NULL;
+
+  result = PyList_New(0);
+  if (result &&
+      index_probe((Index *) self, items, index_found_all, result) < 0)
+    Py_CLEAR(result);
+
+  return result;
+}
+
+
+static int index_contains(PyObject *self, PyObject *key) {
+  PyObject *found = NULL, **items;
+  int rc;
+
+  items = index_key_items((Index *) self, &key);
+  if (! items)
+    return -1;
+
+  rc = index_probe((Index *) self, items, index_found_first, &found);
+  Py_XDECREF(found);
+
+  return rc;
+}
+
+
+static PyObject *index_add_rec(PyObject *self, PyObject *rec) {
+  if (index_add((Index *) self, rec))
+    return NULL;
+
+  Py_RETURN_NONE;
+}
+
+
+static PyObject *index_discard(PyObject *self, PyObject *rec) {
+  Index *idx = (Index *) self;
+  unsigned long long version;
+  size_t at, step = 0;
+  int32_t position;
+  index_entry *entry;
+  PyObject *found;
+  Py_hash_t hash;
+  int match;
+
+  if (! idx->live)
+    Py_RETURN_NONE;
+
+  if (index_hash_rec(idx, rec, &hash)) {
+    // lacking the fields, it can't have been added
+    if (! (PyErr_ExceptionMatches(PyExc_KeyError) ||
+	   PyErr_ExceptionMatches(PyExc_IndexError)))
+      return NULL;
+
+    PyErr_Clear();
+    Py_RETURN_NONE;
+  }
+
+  version = idx->version;
+  at = index_home(idx, hash);
+
+  while ((position = idx->slots[at]) != INDEX_EMPTY) {
+    entry = idx->entries + position;
+
+    if (entry->hash == hash && (found = entry->rec)) {
+      Py_INCREF(found);
+      match = PyObject_RichCompareBool(found, rec, Py_EQ);
+
+      if (version != idx->version) {
+	if (match >= 0)
+	  PyErr_SetString(PyExc_RuntimeError,
+			  "Index changed size during discard");
+	match = -1;
+      }
+
+      if (match) {
+	if (match > 0) {
+	  entry->rec = NULL;
+	  idx->live--;
+	  idx->version++;
+	  Py_DECREF(found);  // the reference the entry held
+	}
+
+	Py_DECREF(found);
+	if (match < 0)
+	  return NULL;
+	Py_RETURN_NONE;
+      }
+
+      Py_DECREF(found);
+    }
+
+    INDEX_PROBE(idx, at, step);
+  }
+
+  Py_RETURN_NONE;
+}
+
+
+static Py_ssize_t index_len(PyObject *self) {
+  return ((Index *) self)->live;
+}
+
+
+static PyObject *index_get_on(PyObject *self, void *_closure) {
+  PyObject *on = ((Index *) self)->on;
+  Py_INCREF(on);
+  return on;
+}
+
+
+/* === type === */
+
+
+/* the fields given as on, as a tuple of at least one */
+static PyObject *index_fields(PyObject *on) {
+  PyObject *result;
+
+  if (PyUnicode_Check(on) || PyLong_Check(on))
+    return PyTuple_Pack(1, on);
+
+  result = PySequence_Tuple(on);
+  if (result && ! PyTuple_GET_SIZE(result)) {
+    PyErr_SetString(PyExc_ValueError, "on requires at least one field");
+    Py_CLEAR(result);
+  }
+
+  return result;
+}
+
+
+static void index_release(Index *idx) {
+  index_entry *entries = idx->entries;
+  Py_ssize_t index, used = idx->used;
+
+  // forgotten before any record goes, in case one's finalizer finds
+  // its way back here
+  idx->entries = NULL;
+  idx->used = idx->allocated = idx->live = 0;
+  PyMem_Free(idx->slots);
+  idx->slots = NULL;
+  idx->mask = 0;
+  idx->version++;
+
+  for (index = 0; index < used; index++)
+    Py_XDECREF(entries[index].rec);
+  PyMem_Free(entries);
+}
+
+
+static PyObject *index_new(PyTypeObject *type, PyObject *args,
+			   PyObject *kwds) {
+
+  static char *kwlist[] = { "records", "on", NULL };
+
+  PyObject *records = NULL, *on = NULL, *iter = NULL, *rec;
+  Index *idx;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|OO:Index", kwlist,
+				    &records, &on))
+    return NULL;
+
+  if (! on) {
+    PyErr_SetString(PyExc_TypeError, "Index requires the fields it is on");
+    return NULL;
+  }
+
+  idx = (Index *) type->tp_alloc(type, 0);
+  if (! idx)
+    return NULL;
+
+  idx->on = index_fields(on);
+  if (! idx->on)
+    goto error;
+
+  if (records && records != Py_None) {
+    Py_ssize_t hint = PyObject_LengthHint(records, 0);
+
+    if (hint < 0 || index_reserve(idx, hint))
+      goto error;
+
+    iter = PyObject_GetIter(records);
+    if (! iter)
+      goto error;
+
+    while ((rec = PyIter_Next(iter))) {
+      int rc = index_add(idx, rec);
+      Py_DECREF(rec);
+      if (rc)
+	goto error;
+    }
+
+    if (PyErr_Occurred())
+      goto error;
+    Py_CLEAR(iter);
+  }
+
+  return (PyObject *) idx;
+
+ error:
+  Py_XDECREF(iter);
+  Py_DECREF(idx);
+  return NULL;
+}
+
+
+static void index_dealloc(PyObject *self) {
+  Index *idx = (Index *) self;
+
+  PyObject_GC_UnTrack(self);
+  index_release(idx);
+  Py_CLEAR(idx->on);
+  Py_TYPE(self)->tp_free(self);
+}
+
+
+static int index_traverse(PyObject *self, visitproc visit, void *arg) {
+  Index *idx = (Index *) self;
+  Py_ssize_t index;
+
+  for (index = 0; index < idx->used; index++)
+    Py_VISIT(idx->entries[index].rec);
+
+  Py_VISIT(idx->on);
+  return 0;
+}
+
+
+static int index_clear(PyObject *self) {
+  index_release((Index *) self);
+  return 0;
+}
+
+
+static PyMethodDef index_methods[] = {
+  { "get", (PyCFunction) index_get, METH_FASTCALL,
+    "I.get(key, default=None) -> record\n"
+    "The earliest added record whose fields equal key, or default.\n"
+    "key is the field's value for an Index on a single field,\n"
+    "otherwise a tuple of the values of the fields, in order" },
+
+  { "get_all", (PyCFunction) index_get_all, METH_O,
+    "I.get_all(key) -> list\n"
+    "Every record whose fields equal key, in the order added" },
+
+  { "add", (PyCFunction) index_add_rec, METH_O,
+    "I.add(record)\n"
+    "Indexes record by its fields. Raises KeyError if it lacks one" },
+
+  { "discard", (PyCFunction) index_discard, METH_O,
+    "I.discard(record)\n"
+    "Removes the earliest added record equal to record, if there is\n"
+    "one" },
+
+  { NULL, NULL, 0, NULL },
+};
+
+
+static PyGetSetDef index_getset[] = {
+  { "on", index_get_on, NULL, "the fields records are indexed by", NULL },
+  { NULL },
+};
+
+
+static PySequenceMethods index_as_sequence = {
+  .sq_length = index_len,
+  .sq_contains = index_contains,
+};
+
+
+PyTypeObject PyValuesIndexType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "Index",
+  sizeof(Index),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC,
+  .tp_doc = "Index(records=(), on=fields)\n"
+  "A hash index of records by the given field or fields, holding\n"
+  "only the records and the hashes of their fields. Supports get,\n"
+  "get_all, in and len, and is kept up to date by add and discard",
+  .tp_new = index_new,
+  .tp_dealloc = index_dealloc,
+  .tp_traverse = index_traverse,
+  .tp_clear = index_clear,
+  .tp_as_sequence = &index_as_sequence,
+  .tp_methods = index_methods,
+  .tp_getset = index_getset,
+};
+
+
+/* === join === */
+
+
+typedef struct join_pair {
+  Py_ssize_t left;
+  Py_ssize_t right;
+} join_pair;
+
+
+typedef struct join_probe {
+  Py_ssize_t at;
+  int built_left;
+  join_pair *pairs;
+  Py_ssize_t count;
+  Py_ssize_t allocated;
+} join_probe;
+
+
+static int join_found(PyObject *rec, Py_ssize_t position, void *arg) {
+  join_probe *probe = (join_probe *) arg;
+  join_pair *pair;
+
+  if (probe->count == probe->allocated) {
+    Py_ssize_t allocated = probe->allocated? probe->allocated * 2: 64;
+
+    pair = PyMem_Resize(probe->pairs, join_pair, allocated);
+    if (! pair) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    probe->pairs = pair;
+    probe->allocated = allocated;
+  }
+
+  pair = probe->pairs + probe->count++;
+  pair->left = probe->built_left? position: probe->at;
+  pair->right = probe->built_left? probe->at: position;
+
+  return 0;
+}
+
+
+/* An Index of the records on the given fields, with each record's
+   entry at its position among them */
+static Index *join_build(PyObject *on, PyObject *records) {
+  Py_ssize_t index, count = PyTuple_GET_SIZE(records);
+  Index *idx;
+
+  idx = (Index *) PyValuesIndexType.tp_alloc(&PyValuesIndexType, 0);
+  if (! idx)
+    return NULL;
+
+  Py_INCREF(on);
+  idx->on = on;
+
+  if (index_reserve(idx, count))
+    goto error;
+
+  for (index = 0; index < count; index++) {
+    if (index_add(idx, PyTuple_GET_ITEM(records, index)))
+      goto error;
+  }
+
+  return idx;
+
+ error:
+  Py_DECREF(idx);
+  return NULL;
+}
+
+
+/* Probes idx with the fields of each of the records, collecting the
+   matches as pairs of positions. Returns 0 on success, or -1 with an
+   exception set. */
+static int join_probe_all(Index *idx, PyObject *records, join_probe *probe) {
+  Py_ssize_t field, nfields = PyTuple_GET_SIZE(idx->on);
+  PyObject **items;
+  int rc = 0;
+
+  items = PyMem_New(PyObject *, nfields);
+  if (! items) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  for (probe->at = 0; ! rc && probe->at < PyTuple_GET_SIZE(records);
+       probe->at++) {
+
+    PyObject *rec = PyTuple_GET_ITEM(records, probe->at);
+
+    for (field = 0; field < nfields; field++) {
+      items[field] = record_field(rec, PyTuple_GET_ITEM(idx->on, field));
+      if (! items[field]) {
+	rc = -1;
+	break;
+      }
+    }
+
+    if (! rc)
+      rc = index_probe(idx, items, join_found, probe) < 0? -1: 0;
+
+    while (field--)
+      Py_DECREF(items[field]);
+  }
+
+  PyMem_Free(items);
+  return rc;
+}
+
+
+PyObject *values_join(PyObject *mod, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "left", "right", "on", "how", NULL };
+
+  PyObject *left, *right, *on, *result = NULL, *merged, *rec;
+  PyObject *lrecs = NULL, *rrecs = NULL;
+  Py_ssize_t *starts = NULL, nleft, index, pos, out = 0, total;
+  const char *how = "inner";
+  join_probe probe;
+  join_pair *sorted = NULL;
+  Index *idx = NULL;
+  int outer;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "OOO|s:join", kwlist,
+				    &left, &right, &on, &how))
+    return NULL;
+
+  if (! strcmp(how, "inner")) {
+    outer = 0;
+  } else if (! strcmp(how, "left")) {
+    outer = 1;
+  } else {
+    PyErr_Format(PyExc_ValueError, "join how must be \"inner\" or"
+		 " \"left\", not \"%.100s\"", how);
+    return NULL;
+  }
+
+  memset(&probe, 0, sizeof(probe));
+
+  on = index_fields(on);
+  if (! on)
+    return NULL;
+
+  lrecs = PySequence_Tuple(left);
+  rrecs = lrecs? PySequence_Tuple(right): NULL;
+  if (! rrecs)
+    goto done;
+
+  nleft = PyTuple_GET_SIZE(lrecs);
+
+  // the table goes on the smaller side, and the other probes it
+  probe.built_left = nleft < PyTuple_GET_SIZE(rrecs);
+
+  idx = join_build(on, probe.built_left? lrecs: rrecs);
+  if (! idx || join_probe_all(idx, probe.built_left? rrecs: lrecs, &probe))
+    goto done;
+
+  // a counting sort of the pairs by their left position, which keeps
+  // them in the order of the right side within each. The results then
+  // come in the order of the left side, whichever side was built.
+  starts = PyMem_Calloc(nleft + 1, sizeof(Py_ssize_t));
+  sorted = PyMem_New(join_pair, probe.count? probe.count: 1);
+  if (! (starts && sorted)) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  for (index = 0; index < probe.count; index++)
+    starts[probe.pairs[index].left + 1]++;
+
+  total = probe.count;
+  for (index = 0; index < nleft; index++) {
+    if (outer && ! starts[index + 1])
+      total++;
+    starts[index + 1] += starts[index];
+  }
+
+  for (index = 0; index < probe.count; index++)
+    sorted[starts[probe.pairs[index].left]++] = probe.pairs[index];
+
+  result = PyList_New(total);
+  if (! result)
+    goto done;
+
+  // starts now holds where each left position's pairs end
+  for (index = 0, pos = 0; index < nleft; index++) {
+    rec = PyTuple_GET_ITEM(lrecs, index);
+
+    if (outer && pos == starts[index]) {
+      Py_INCREF(rec);
+      PyList_SET_ITEM(result, out++, rec);
+      continue;
+    }
+
+    for (; pos < starts[index]; pos++) {
+      merged = PyNumber_Add(rec, PyTuple_GET_ITEM(rrecs, sorted[pos].right));
+      if (! merged) {
+	Py_CLEAR(result);
+	goto done;
+      }
+      PyList_SET_ITEM(result, out++, merged);
+    }
+  }
+
+ done:
+  PyMem_Free(starts);
+  PyMem_Free(sorted);
+  PyMem_Free(probe.pairs);
+  Py_XDECREF(idx);
+  Py_XDECREF(lrecs);
+  Py_XDECREF(rrecs);
+  Py_DECREF(on);
+
+  return result;
+}
+
+
+/* The end. */
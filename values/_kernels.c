@@ -0,0 +1,1133 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values kernels
+
+   Bulk operations over whole collections of values records, which
+   would otherwise be written as Python loops
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <limits.h>
+#include <string.h>
+
+
+/* === fields === */
+
+
+PyObject *record_field(PyObject *rec, PyObject *key) {
+  PyObject *result;
+
+  if (likely(PyValues_Check(rec))) {
+    PyValues *v = (PyValues *) rec;
+
+    if (PyLong_CheckExact(key))
+      return PySequence_GetItem(v->args, PyLong_AsSsize_t(key));
+
+    result = v->kwds? PyDict_GetItemWithError(v->kwds, key): NULL;
+    if (likely(result)) {
+      if (unlikely(PyLazyField_Check(result)))
+	return values_kwd_force(v, key, result);
+
+      Py_INCREF(result);
+
+    } else if (! PyErr_Occurred()) {
+      PyErr_SetObject(PyExc_KeyError, key);
+    }
+
+    return result;
+
+  } else {
+    return PyObject_GetItem(rec, key);
+  }
+}
+
+
+/* The key of a record over the given fields. A single field is used
+   as the key directly, several are collected into a tuple. */
+static PyObject *record_key(PyObject *rec, PyObject *fields) {
+  Py_ssize_t index, count = PyTuple_GET_SIZE(fields);
+  PyObject *key, *field;
+
+  if (count == 1)
+    return record_field(rec, PyTuple_GET_ITEM(fields, 0));
+
+  key = PyTuple_New(count);
+  if (! key)
+    return NULL;
+
+  for (index = 0; index < count; index++) {
+    field = record_field(rec, PyTuple_GET_ITEM(fields, index));
+    if (! field) {
+      Py_DECREF(key);
+      return NULL;
+    }
+    PyTuple_SET_ITEM(key, index, field);
+  }
+
+  return key;
+}
+
+
+/* === partition === */
+
+
+/* Computes the bucket of each of count items into buckets, reading
+   the hash from key(item) when key is not NULL. This touches nothing
+   but its own slice of the arrays, so that it could be split over
+   several threads. Returns 0 on success, or -1 with an exception
+   set. */
+static int partition_hash(PyObject **items, Py_ssize_t count,
+			  PyObject *key, int stable, Py_ssize_t n,
+			  Py_ssize_t *buckets) {
+
+  Py_ssize_t index;
+  PyObject *item;
+
+  for (index = 0; index < count; index++) {
+    item = items[index];
+
+    if (key) {
+      item = PyObject_CallFunctionObjArgs(key, item, NULL);
+      if (! item)
+	return -1;
+    }
+
+    if (stable) {
+      uint64_t hashed;
+
+      if (canon_stable_hash(item, 0, &hashed)) {
+	if (key)
+	  Py_DECREF(item);
+	return -1;
+      }
+      buckets[index] = (Py_ssize_t) (hashed % (uint64_t) n);
+
+    } else {
+      // values keep their hash cached, so repeated partitioning of
+      // the same records is cheap
+      Py_hash_t hashed = PyObject_Hash(item);
+
+      if (hashed == -1) {
+	if (key)
+	  Py_DECREF(item);
+	return -1;
+      }
+
+      // same as hash(item) % n in Python, never negative
+      buckets[index] = (Py_ssize_t) (hashed % n);
+      if (buckets[index] < 0)
+	buckets[index] += n;
+    }
+
+    if (key)
+      Py_DECREF(item);
+  }
+
+  return 0;
+}
+
+
+PyObject *values_partition(PyObject *mod, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "seq", "n", "key", "stable", NULL };
+
+  PyObject *seq, *key = Py_None, *items_tup, *result = NULL, *part;
+  Py_ssize_t n, index, count, *buckets = NULL, *sizes = NULL;
+  PyObject **items;
+  int stable = 0;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "On|Op:partition", kwlist,
+				    &seq, &n, &key, &stable))
+    return NULL;
+
+  if (n < 1) {
+    PyErr_SetString(PyExc_ValueError, "partition requires n >= 1");
+    return NULL;
+  }
+
+  if (key == Py_None)
+    key = NULL;
+
+  // a tuple, because hashing can call back into Python code, which
+  // mustn't be able to resize the items out from under us
+  items_tup = PySequence_Tuple(seq);
+  if (! items_tup)
+    return NULL;
+
+  count = PyTuple_GET_SIZE(items_tup);
+  items = PySequence_Fast_ITEMS(items_tup);
+
+  buckets = PyMem_New(Py_ssize_t, count? count: 1);
+  sizes = PyMem_New(Py_ssize_t, n);
+  if (! (buckets && sizes)) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  // first pass, hash everything and count the size of each bucket
+  if (partition_hash(items, count, key, stable, n, buckets))
+    goto done;
+
+  memset(sizes, 0, n * sizeof(Py_ssize_t));
+  for (index = 0; index < count; index++) {
+    sizes[buckets[index]]++;
+  }
+
+  // each output list is allocated at its final size, and then
+  // filled from the back by the second pass
+  result = PyList_New(n);
+  if (! result)
+    goto done;
+
+  for (index = 0; index < n; index++) {
+    part = PyList_New(sizes[index]);
+    if (! part) {
+      Py_CLEAR(result);
+      goto done;
+    }
+    PyList_SET_ITEM(result, index, part);
+  }
+
+  // second pass, scatter the items into place. Walking backwards
+  // with the sizes as cursors keeps the input order in each bucket
+  for (index = count; index--; ) {
+    Py_ssize_t bucket = buckets[index];
+
+    part = PyList_GET_ITEM(result, bucket);
+    Py_INCREF(items[index]);
+    PyList_SET_ITEM(part, --sizes[bucket], items[index]);
+  }
+
+ done:
+  PyMem_Free(buckets);
+  PyMem_Free(sizes);
+  Py_DECREF(items_tup);
+
+  return result;
+}
+
+
+/* === groupby === */
+
+
+PyObject *values_groupby(PyObject *mod, PyObject *args) {
+  PyObject *records, *fields, *iter, *rec, *key, *group;
+  PyObject *result = NULL;
+
+  if (PyTuple_GET_SIZE(args) < 2) {
+    PyErr_SetString(PyExc_TypeError, "groupby requires records and at"
+		    " least one key");
+    return NULL;
+  }
+
+  records = PyTuple_GET_ITEM(args, 0);
+  fields = PyTuple_GetSlice(args, 1, PyTuple_GET_SIZE(args));
+  if (! fields)
+    return NULL;
+
+  iter = PyObject_GetIter(records);
+  if (! iter)
+    goto done;
+
+  result = PyDict_New();
+  if (! result)
+    goto done;
+
+  while ((rec = PyIter_Next(iter))) {
+    key = record_key(rec, fields);
+    if (! key) {
+      Py_DECREF(rec);
+      Py_CLEAR(result);
+      goto done;
+    }
+
+    group = PyDict_GetItemWithError(result, key);
+    if (group) {
+      if (PyList_Append(group, rec))
+	group = NULL;
+
+    } else if (! PyErr_Occurred()) {
+      group = PyList_New(1);
+      if (group) {
+	Py_INCREF(rec);
+	PyList_SET_ITEM(group, 0, rec);
+
+	if (PyDict_SetItem(result, key, group))
+	  Py_CLEAR(group);
+	else
+	  Py_DECREF(group);  // the dict is holding it now
+      }
+    }
+
+    Py_DECREF(key);
+    Py_DECREF(rec);
+
+    if (! group) {
+      Py_CLEAR(result);
+      goto done;
+    }
+  }
+
+  if (PyErr_Occurred())
+    Py_CLEAR(result);
+
+ done:
+  Py_XDECREF(iter);
+  Py_DECREF(fields);
+
+  return result;
+}
+
+
+/* === sort_by === */
+
+
+/* Records are sorted one key at a time, from the last key to the
+   first, with each pass a stable sort of the order the previous pass
+   left. Keys holding only ints that fit in a long long, or only
+   floats, are radix sorted unboxed. Keys holding only strs are merge
+   sorted comparing the strings directly, and anything else is merge
+   sorted through the usual rich comparison. */
+
+
+#define SORT_RUN 16
+#define SORT_DIGITS 8
+
+/* the bits of a NaN, after every other float in either direction */
+#define SORT_NAN UINT64_MAX
+
+
+enum sort_kind { SORT_INT, SORT_FLOAT, SORT_STR, SORT_OBJECT };
+
+
+typedef union sort_cell {
+  long long ival;
+  double fval;
+  uint64_t bits;
+  PyObject *oval;
+} sort_cell;
+
+
+typedef struct sort_entry {
+  sort_cell cell;
+  Py_ssize_t index;
+} sort_entry;
+
+
+typedef struct sort_pass {
+  enum sort_kind kind;
+  int reverse;
+  int failed;
+} sort_pass;
+
+
+/* Settles the kind of a column of freshly gathered objects, and if it
+   can be sorted unboxed, converts its cells in place. */
+static enum sort_kind sort_column(sort_cell *column, Py_ssize_t count) {
+  Py_ssize_t index;
+  int ints = 1, floats = 1, strs = 1, overflow;
+
+  for (index = 0; index < count && (ints || floats || strs); index++) {
+    PyObject *obj = column[index].oval;
+
+    if (ints) {
+      if (! PyLong_CheckExact(obj))
+	ints = 0;
+      else if (PyLong_AsLongLongAndOverflow(obj, &overflow) == -1 && overflow)
+	ints = 0;
+    }
+
+    floats = floats && PyFloat_CheckExact(obj);
+    strs = strs && PyUnicode_CheckExact(obj);
+  }
+
+  if (ints) {
+    for (index = 0; index < count; index++) {
+      PyObject *obj = column[index].oval;
+      column[index].ival = PyLong_AsLongLongAndOverflow(obj, &overflow);
+      Py_DECREF(obj);
+    }
+    return SORT_INT;
+
+  } else if (floats) {
+    for (index = 0; index < count; index++) {
+      PyObject *obj = column[index].oval;
+      column[index].fval = PyFloat_AS_DOUBLE(obj);
+      Py_DECREF(obj);
+    }
+    return SORT_FLOAT;
+
+  } else {
+    return strs? SORT_STR: SORT_OBJECT;
+  }
+}
+
+
+/* the bits of an unboxed cell, such that they order as unsigned
+   integers the way the cell's value orders */
+static inline uint64_t sort_bits(sort_cell cell, enum sort_kind kind) {
+  uint64_t bits;
+
+  if (kind == SORT_INT)
+    return (uint64_t) cell.ival ^ ((uint64_t) 1 << 63);
+
+  // -0.0 is equal to 0.0, and so must keep its place among them. NaN
+  // doesn't order at all, and is put last
+  if (cell.fval == 0.0)
+    cell.fval = 0.0;
+  else if (cell.fval != cell.fval)
+    return SORT_NAN;
+
+  memcpy(&bits, &cell.fval, sizeof(bits));
+  return (bits >> 63)? ~bits: bits | ((uint64_t) 1 << 63);
+}
+
+
+/* A stable LSD radix sort of entries by their bits, a byte at a time,
+   using work as scratch space of the same length. Bytes which are the
+   same across every entry are skipped. Returns whichever of entries
+   or work the result ended up in. */
+static sort_entry *sort_radix(sort_entry *entries, sort_entry *work,
+			      Py_ssize_t count) {
+
+  Py_ssize_t (*counts)[256], index, offset, total;
+  sort_entry *swap;
+  int digit, shift;
+
+  counts = PyMem_Calloc(SORT_DIGITS, sizeof(*counts));
+  if (! counts)
+    return NULL;
+
+  // every digit's histogram in a single pass
+  for (index = 0; index < count; index++) {
+    uint64_t bits = entries[index].cell.bits;
+
+    for (digit = 0; digit < SORT_DIGITS; digit++)
+      counts[digit][(bits >> (digit * 8)) & 0xff]++;
+  }
+
+  for (digit = 0; digit < SORT_DIGITS; digit++) {
+    shift = digit * 8;
+
+    if (counts[digit][(entries[0].cell.bits >> shift) & 0xff] == count)
+      continue;
+
+    for (index = 0, total = 0; index < 256; index++) {
+      offset = counts[digit][index];
+      counts[digit][index] = total;
+      total += offset;
+    }
+
+    for (index = 0; index < count; index++) {
+      sort_entry *entry = entries + index;
+      work[counts[digit][(entry->cell.bits >> shift) & 0xff]++] = *entry;
+    }
+
+    swap = entries;
+    entries = work;
+    work = swap;
+  }
+
+  PyMem_Free(counts);
+  return entries;
+}
+
+
+static int sort_str_less(PyObject *left, PyObject *right) {
+  Py_ssize_t llen, rlen;
+  int found;
+
+  if (PyUnicode_KIND(left) == PyUnicode_1BYTE_KIND &&
+      PyUnicode_KIND(right) == PyUnicode_1BYTE_KIND) {
+
+    llen = PyUnicode_GET_LENGTH(left);
+    rlen = PyUnicode_GET_LENGTH(right);
+
+    found = memcmp(PyUnicode_DATA(left), PyUnicode_DATA(right),
+		   llen < rlen? llen: rlen);
+    return found? found < 0: llen < rlen;
+  }
+
+  return PyUnicode_Compare(left, right) < 0;
+}
+
+
+/* whether entry a orders before entry b. On an error, the pass is
+   marked failed and everything after compares as equal */
+static int sort_less(sort_pass *pass, sort_entry *a, sort_entry *b) {
+  int found;
+
+  if (pass->reverse) {
+    sort_entry *swap = a;
+    a = b;
+    b = swap;
+  }
+
+  if (pass->kind == SORT_STR)
+    return sort_str_less(a->cell.oval, b->cell.oval);
+
+  if (unlikely(pass->failed))
+    return 0;
+
+  found = PyObject_RichCompareBool(a->cell.oval, b->cell.oval, Py_LT);
+  if (found < 0) {
+    pass->failed = 1;
+    return 0;
+  }
+
+  return found;
+}
+
+
+/* A stable merge sort of entries, using work as scratch space of at
+   least half the length. Short runs are insertion sorted, and a merge
+   is skipped entirely when its halves are already in order. */
+static void sort_merge(sort_pass *pass, sort_entry *entries,
+		       sort_entry *work, Py_ssize_t count) {
+
+  Py_ssize_t half, left, right, out, index;
+  sort_entry moving;
+
+  if (count <= SORT_RUN) {
+    for (index = 1; index < count; index++) {
+      moving = entries[index];
+      for (out = index; out && sort_less(pass, &moving, entries + out - 1);
+	   out--)
+	entries[out] = entries[out - 1];
+      entries[out] = moving;
+    }
+    return;
+  }
+
+  half = count / 2;
+  sort_merge(pass, entries, work, half);
+  sort_merge(pass, entries + half, work, count - half);
+
+  if (! sort_less(pass, entries + half, entries + half - 1))
+    return;
+
+  memcpy(work, entries, half * sizeof(sort_entry));
+
+  // taking from the right only when strictly less keeps it stable
+  for (left = 0, right = half, out = 0; left < half; out++) {
+    if (right < count && sort_less(pass, entries + right, work + left))
+      entries[out] = entries[right++];
+    else
+      entries[out] = work[left++];
+  }
+}
+
+
+/* Stably sorts order by the column of cells, which are of the given
+   kind. Returns 0 on success, or -1 with an exception set. */
+static int sort_pass_by(Py_ssize_t *order, Py_ssize_t count,
+			sort_cell *column, enum sort_kind kind, int reverse,
+			sort_entry *entries, sort_entry *work) {
+
+  sort_pass pass = { kind, reverse, 0 };
+  sort_entry *sorted = entries;
+  Py_ssize_t index;
+
+  if (count < 2)
+    return 0;
+
+  for (index = 0; index < count; index++) {
+    entries[index].index = order[index];
+    entries[index].cell = column[order[index]];
+
+    if (kind == SORT_INT || kind == SORT_FLOAT) {
+      uint64_t bits = sort_bits(entries[index].cell, kind);
+
+      // inverting keeps equal keys in their order, as reverse does.
+      // NaN isn't inverted, so that it stays last either way
+      if (reverse && ! (kind == SORT_FLOAT && bits == SORT_NAN))
+	bits = ~bits;
+      entries[index].cell.bits = bits;
+    }
+  }
+
+  if (kind == SORT_INT || kind == SORT_FLOAT) {
+    sorted = sort_radix(entries, work, count);
+    if (! sorted) {
+      PyErr_NoMemory();
+      return -1;
+    }
+
+  } else {
+    sort_merge(&pass, entries, work, count);
+    if (pass.failed)
+      return -1;
+  }
+
+  for (index = 0; index < count; index++)
+    order[index] = sorted[index].index;
+
+  return 0;
+}
+
+
+PyObject *values_sort_by(PyObject *mod, PyObject *args, PyObject *kwds) {
+  PyObject *records, *fields, *rec, *field, *result = NULL;
+  PyObject *reverse = NULL, **items;
+  Py_ssize_t count, nkeys, index, key, columns = 0, gathered = 0;
+  Py_ssize_t *order = NULL;
+  enum sort_kind *kinds = NULL;
+  sort_entry *entries = NULL, *work = NULL;
+  sort_cell *cells = NULL;
+  int reversed = 0;
+
+  if (PyTuple_GET_SIZE(args) < 2) {
+    PyErr_SetString(PyExc_TypeError, "sort_by requires records and at"
+		    " least one key");
+    return NULL;
+  }
+
+  if (kwds && PyDict_GET_SIZE(kwds)) {
+    reverse = PyDict_GetItemString(kwds, "reverse");
+    if (! reverse || PyDict_GET_SIZE(kwds) > 1) {
+      PyErr_SetString(PyExc_TypeError, "sort_by accepts only reverse as"
+		      " a keyword argument");
+      return NULL;
+    }
+
+    reversed = PyObject_IsTrue(reverse);
+    if (reversed < 0)
+      return NULL;
+  }
+
+  // a tuple, so comparisons calling back into Python code can't
+  // change the records out from under us
+  records = PySequence_Tuple(PyTuple_GET_ITEM(args, 0));
+  if (! records)
+    return NULL;
+
+  fields = PyTuple_GetSlice(args, 1, PyTuple_GET_SIZE(args));
+  if (! fields) {
+    Py_DECREF(records);
+    return NULL;
+  }
+
+  count = PyTuple_GET_SIZE(records);
+  nkeys = PyTuple_GET_SIZE(fields);
+  items = PySequence_Fast_ITEMS(records);
+
+  kinds = PyMem_New(enum sort_kind, nkeys);
+  cells = PyMem_New(sort_cell, (count? count: 1) * nkeys);
+  order = PyMem_New(Py_ssize_t, count? count: 1);
+  entries = PyMem_New(sort_entry, count? count: 1);
+  work = PyMem_New(sort_entry, count? count: 1);
+  if (! (kinds && cells && order && entries && work)) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  // gather each key as a column, and unbox the columns that allow it
+  for (key = 0; key < nkeys; key++) {
+    sort_cell *column = cells + key * count;
+
+    field = PyTuple_GET_ITEM(fields, key);
+    kinds[key] = SORT_OBJECT;
+    columns++;
+
+    for (gathered = 0; gathered < count; gathered++) {
+      rec = record_field(items[gathered], field);
+      if (! rec)
+	goto done;
+      column[gathered].oval = rec;
+    }
+
+    kinds[key] = sort_column(column, count);
+  }
+
+  for (index = 0; index < count; index++)
+    order[index] = index;
+
+  for (key = nkeys; key--; ) {
+    if (sort_pass_by(order, count, cells + key * count, kinds[key],
+		     reversed, entries, work))
+      goto done;
+  }
+
+  result = PyList_New(count);
+  if (! result)
+    goto done;
+
+  for (index = 0; index < count; index++) {
+    rec = items[order[index]];
+    Py_INCREF(rec);
+    PyList_SET_ITEM(result, index, rec);
+  }
+
+ done:
+  // release the columns left boxed, and any partly gathered one
+  for (key = 0; key < columns; key++) {
+    sort_cell *column = cells + key * count;
+
+    if (kinds[key] == SORT_INT || kinds[key] == SORT_FLOAT)
+      continue;
+
+    for (index = 0; index < (key < columns - 1? count: gathered); index++)
+      Py_DECREF(column[index].oval);
+  }
+
+  PyMem_Free(kinds);
+  PyMem_Free(cells);
+  PyMem_Free(order);
+  PyMem_Free(entries);
+  PyMem_Free(work);
+  Py_DECREF(fields);
+  Py_DECREF(records);
+
+  return result;
+}
+
+
+/* === aggregate === */
+
+
+enum agg_op { AGG_SUM, AGG_MIN, AGG_MAX, AGG_MEAN };
+
+enum agg_kind { AGG_NONE, AGG_INT, AGG_FLOAT, AGG_OBJECT };
+
+
+/* A single running accumulator. Sums stay unboxed as a long long or
+   a double for as long as the inputs allow, and only fall back to
+   Python arithmetic on an overflow or some other type. min and max
+   simply keep the best object seen. */
+typedef struct agg_acc {
+  enum agg_kind kind;
+  long long ival;
+  double fval;
+  PyObject *oval;
+} agg_acc;
+
+
+typedef struct agg_group {
+  PyObject *key;
+  long long count;
+  agg_acc accs[1];
+} agg_group;
+
+
+typedef struct agg_spec {
+  enum agg_op op;
+  PyObject *field;
+  PyObject *name;
+} agg_spec;
+
+
+static PyObject *agg_acc_value(agg_acc *acc) {
+  switch (acc->kind) {
+  case AGG_INT:
+    return PyLong_FromLongLong(acc->ival);
+  case AGG_FLOAT:
+    return PyFloat_FromDouble(acc->fval);
+  case AGG_OBJECT:
+    Py_INCREF(acc->oval);
+    return acc->oval;
+  default:
+    Py_RETURN_NONE;
+  }
+}
+
+
+static int agg_sum(agg_acc *acc, PyObject *val) {
+  PyObject *tmp;
+
+  // the sum starts from the first value, not from 0, so that anything
+  // supporting addition may be summed
+  if (acc->kind == AGG_NONE) {
+    if (PyLong_CheckExact(val)) {
+      acc->kind = AGG_INT;
+      acc->ival = 0;
+
+    } else if (PyFloat_CheckExact(val)) {
+      acc->kind = AGG_FLOAT;
+      acc->fval = PyFloat_AS_DOUBLE(val);
+      return 0;
+
+    } else {
+      Py_INCREF(val);
+      acc->oval = val;
+      acc->kind = AGG_OBJECT;
+      return 0;
+    }
+  }
+
+  if (PyLong_CheckExact(val) && acc->kind != AGG_OBJECT) {
+    int overflow = 0;
+    long long ival = PyLong_AsLongLongAndOverflow(val, &overflow);
+
+    if (acc->kind == AGG_INT && ! overflow &&
+	! ((ival > 0 && acc->ival > LLONG_MAX - ival) ||
+	   (ival < 0 && acc->ival < LLONG_MIN - ival))) {
+      acc->ival += ival;
+      return 0;
+
+    } else if (acc->kind == AGG_FLOAT) {
+      double fval = PyLong_AsDouble(val);
+      if (fval == -1.0 && PyErr_Occurred())
+	return -1;
+      acc->fval += fval;
+      return 0;
+    }
+
+  } else if (PyFloat_CheckExact(val)) {
+    if (acc->kind == AGG_INT) {
+      acc->kind = AGG_FLOAT;
+      acc->fval = (double) acc->ival;
+    }
+    if (acc->kind == AGG_FLOAT) {
+      acc->fval += PyFloat_AS_DOUBLE(val);
+      return 0;
+    }
+  }
+
+  // anything else goes through Python addition from here on
+  if (acc->kind != AGG_OBJECT) {
+    acc->oval = agg_acc_value(acc);
+    if (! acc->oval)
+      return -1;
+    acc->kind = AGG_OBJECT;
+  }
+
+  tmp = PyNumber_Add(acc->oval, val);
+  if (! tmp)
+    return -1;
+
+  Py_SETREF(acc->oval, tmp);
+  return 0;
+}
+
+
+static int agg_best(agg_acc *acc, PyObject *val, int op) {
+  int better;
+
+  if (acc->kind == AGG_NONE) {
+    Py_INCREF(val);
+    acc->oval = val;
+    acc->kind = AGG_OBJECT;
+    return 0;
+  }
+
+  if (PyFloat_CheckExact(val) && PyFloat_CheckExact(acc->oval)) {
+    double l = PyFloat_AS_DOUBLE(val), r = PyFloat_AS_DOUBLE(acc->oval);
+    better = (op == Py_GT)? (l > r): (l < r);
+
+  } else {
+    better = PyObject_RichCompareBool(val, acc->oval, op);
+    if (better < 0)
+      return -1;
+  }
+
+  if (better) {
+    Py_INCREF(val);
+    Py_SETREF(acc->oval, val);
+  }
+
+  return 0;
+}
+
+
+/* Collects the field names given to one of the aggregate keywords,
+   which may be a single field or a sequence of them */
+static PyObject *agg_fields(PyObject *given) {
+  if (! given || given == Py_None)
+    return PyTuple_New(0);
+
+  if (PyUnicode_Check(given) || PyLong_Check(given))
+    return PyTuple_Pack(1, given);
+
+  return PySequence_Tuple(given);
+}
+
+
+static void agg_free_groups(agg_group **groups, Py_ssize_t ngroups,
+			    Py_ssize_t naccs) {
+  Py_ssize_t g, a;
+
+  for (g = 0; g < ngroups; g++) {
+    Py_XDECREF(groups[g]->key);
+    for (a = 0; a < naccs; a++) {
+      if (groups[g]->accs[a].kind == AGG_OBJECT)
+	Py_XDECREF(groups[g]->accs[a].oval);
+    }
+    PyMem_Free(groups[g]);
+  }
+  PyMem_Free(groups);
+}
+
+
+static PyObject *agg_result(agg_group *group, PyObject *by,
+			    int count, agg_spec *specs, Py_ssize_t naccs) {
+
+  Py_ssize_t index, nby = PyTuple_GET_SIZE(by);
+  PyObject *kwds, *args = NULL, *field, *val;
+  PyValues *result;
+
+  kwds = PyDict_New();
+  args = PyList_New(0);
+  if (! (kwds && args))
+    goto error;
+
+  // grouping fields are carried over under their own names, or as
+  // positionals when they were positionals in the records
+  for (index = 0; index < nby; index++) {
+    field = PyTuple_GET_ITEM(by, index);
+    val = (nby == 1)? group->key: PyTuple_GET_ITEM(group->key, index);
+
+    if (PyUnicode_Check(field)? PyDict_SetItem(kwds, field, val):
+	PyList_Append(args, val))
+      goto error;
+  }
+
+  if (count) {
+    val = PyLong_FromLongLong(group->count);
+    if (! val || PyDict_SetItemString(kwds, "count", val)) {
+      Py_XDECREF(val);
+      goto error;
+    }
+    Py_DECREF(val);
+  }
+
+  for (index = 0; index < naccs; index++) {
+    val = agg_acc_value(group->accs + index);
+    if (val && specs[index].op == AGG_MEAN) {
+      PyObject *n = PyLong_FromLongLong(group->count);
+      Py_SETREF(val, n? PyNumber_TrueDivide(val, n): NULL);
+      Py_XDECREF(n);
+    }
+
+    if (! val || PyDict_SetItem(kwds, specs[index].name, val)) {
+      Py_XDECREF(val);
+      goto error;
+    }
+    Py_DECREF(val);
+  }
+
+  Py_SETREF(args, PyList_AsTuple(args));
+  if (! args)
+    goto error;
+
+  result = (PyValues *) sib_values_take(args, kwds);
+  Py_DECREF(args);
+  return (PyObject *) result;
+
+ error:
+  Py_XDECREF(kwds);
+  Py_XDECREF(args);
+  return NULL;
+}
+
+
+PyObject *values_aggregate(PyObject *mod, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "records", "by", "count",
+			    "sum", "min", "max", "mean", NULL };
+  static const char *op_names[] = { "sum", "min", "max", "mean" };
+
+  PyObject *records, *by = NULL, *given[4] = { NULL, NULL, NULL, NULL };
+  PyObject *fields[4] = { NULL, NULL, NULL, NULL };
+  PyObject *iter = NULL, *index_of = NULL, *result = NULL;
+  PyObject *rec, *key, *found, *val;
+  agg_group **groups = NULL, *group;
+  Py_ssize_t ngroups = 0, allocated = 0, naccs = 0, index, op;
+  agg_spec *specs = NULL;
+  int count = 1, rc;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|OpOOOO:aggregate",
+				    kwlist, &records, &by, &count,
+				    &given[AGG_SUM], &given[AGG_MIN],
+				    &given[AGG_MAX], &given[AGG_MEAN]))
+    return NULL;
+
+  by = agg_fields(by);
+  if (! by)
+    return NULL;
+
+  // flatten the requested aggregates into a single list of specs, one
+  // per accumulator each group will carry
+  for (op = AGG_SUM; op <= AGG_MEAN; op++) {
+    fields[op] = agg_fields(given[op]);
+    if (! fields[op])
+      goto done;
+    naccs += PyTuple_GET_SIZE(fields[op]);
+  }
+
+  specs = PyMem_New(agg_spec, naccs? naccs: 1);
+  if (! specs) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  naccs = 0;
+  for (op = AGG_SUM; op <= AGG_MEAN; op++) {
+    for (index = 0; index < PyTuple_GET_SIZE(fields[op]); index++) {
+      PyObject *field = PyTuple_GET_ITEM(fields[op], index);
+      PyObject *name = PyUnicode_FromFormat("%s_%S", op_names[op], field);
+
+      if (! name)
+	goto done;
+
+      specs[naccs].op = (enum agg_op) op;
+      specs[naccs].field = field;
+      specs[naccs].name = name;
+      naccs++;
+    }
+  }
+
+  iter = PyObject_GetIter(records);
+  if (! iter)
+    goto done;
+
+  // maps each group key to its position in groups, which is also the
+  // order the results are emitted in
+  index_of = PyDict_New();
+  if (! index_of)
+    goto done;
+
+  while ((rec = PyIter_Next(iter))) {
+    if (PyTuple_GET_SIZE(by)) {
+      key = record_key(rec, by);
+    } else {
+      key = Py_None;
+      Py_INCREF(key);
+    }
+
+    if (! key) {
+      Py_DECREF(rec);
+      goto done;
+    }
+
+    found = PyDict_GetItemWithError(index_of, key);
+    if (found) {
+      group = groups[PyLong_AsSsize_t(found)];
+      Py_DECREF(key);
+
+    } else if (PyErr_Occurred()) {
+      Py_DECREF(key);
+      Py_DECREF(rec);
+      goto done;
+
+    } else {
+      if (ngroups == allocated) {
+	agg_group **grown;
+
+	allocated = allocated? allocated * 2: 16;
+	grown = PyMem_Realloc(groups, allocated * sizeof(agg_group *));
+	if (! grown) {
+	  PyErr_NoMemory();
+	  Py_DECREF(key);
+	  Py_DECREF(rec);
+	  goto done;
+	}
+	groups = grown;
+      }
+
+      group = (agg_group *) PyMem_Calloc(1, sizeof(agg_group) +
+					 naccs * sizeof(agg_acc));
+      found = group? PyLong_FromSsize_t(ngroups): NULL;
+      if (! found || PyDict_SetItem(index_of, key, found)) {
+	if (! group)
+	  PyErr_NoMemory();
+	PyMem_Free(group);
+	Py_XDECREF(found);
+	Py_DECREF(key);
+	Py_DECREF(rec);
+	goto done;
+      }
+      Py_DECREF(found);
+
+      group->key = key;  // the group takes our reference
+      groups[ngroups++] = group;
+    }
+
+    group->count++;
+
+    for (index = 0; index < naccs; index++) {
+      val = record_field(rec, specs[index].field);
+      if (! val) {
+	Py_DECREF(rec);
+	goto done;
+      }
+
+      switch (specs[index].op) {
+      case AGG_MIN:
+	rc = agg_best(group->accs + index, val, Py_LT);
+	break;
+      case AGG_MAX:
+	rc = agg_best(group->accs + index, val, Py_GT);
+	break;
+      default:
+	rc = agg_sum(group->accs + index, val);
+	break;
+      }
+
+      Py_DECREF(val);
+      if (rc) {
+	Py_DECREF(rec);
+	goto done;
+      }
+    }
+
+    Py_DECREF(rec);
+  }
+
+  if (PyErr_Occurred())
+    goto done;
+
+  result = PyList_New(ngroups);
+  if (! result)
+    goto done;
+
+  for (index = 0; index < ngroups; index++) {
+    val = agg_result(groups[index], by, count, specs, naccs);
+    if (! val) {
+      Py_CLEAR(result);
+      goto done;
+    }
+    PyList_SET_ITEM(result, index, val);
+  }
+
+ done:
+  if (groups)
+    agg_free_groups(groups, ngroups, naccs);
+
+  if (specs) {
+    for (index = 0; index < naccs; index++) {
+      Py_DECREF(specs[index].name);
+    }
+    PyMem_Free(specs);
+  }
+
+  for (op = AGG_SUM; op <= AGG_MEAN; op++) {
+    Py_XDECREF(fields[op]);
+  }
+
+  Py_XDECREF(index_of);
+  Py_XDECREF(iter);
+  Py_DECREF(by);
+
+  return result;
+}
+
+
+/* The end. */
@@ -0,0 +1,288 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values lazy fields
+
+   A keyword of a values may be created lazy, holding a thunk which is
+   only called the first time the keyword is needed. Until then the
+   keywords dict holds a lazy_field in its place. Forcing the field
+   calls the thunk once, remembers the result in the field, and swaps
+   the result into the dict so later lookups never see the field.
+
+   The field remembers its result as well as the dict, because values
+   built by addition share the same fields, and the thunk must still
+   only run once between them.
+
+   Anything which reads the keywords as a whole (hashing, equality,
+   repr, calls, encoding) forces every field first. The values keeps a
+   flag for whether it might still hold any, so that the common case
+   costs a single test.
+
+   A field is forced under its own lock, so that a second thread
+   asking for it waits for the first thread's result rather than
+   running the thunk again. A thunk which asks for its own field
+   raises RecursionError, rather than deadlocking. If the thunk
+   raises, the field stays unforced and will try again next time.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <pythread.h>
+
+
+typedef struct LazyField {
+  PyObject_HEAD
+
+  PyObject *thunk;
+  PyObject *value;
+  PyThread_type_lock lock;
+  unsigned long owner;
+} LazyField;
+
+
+static PyObject *lazy_field_new(PyObject *thunk) {
+  LazyField *f;
+
+  f = PyObject_GC_New(LazyField, &PyValuesLazyFieldType);
+  if (! f)
+    return NULL;
+
+  Py_INCREF(thunk);
+  f->thunk = thunk;
+  f->value = NULL;
+  f->owner = 0;
+  f->lock = PyThread_allocate_lock();
+
+  if (! f->lock) {
+    Py_DECREF(f);
+    return PyErr_NoMemory();
+  }
+
+  PyObject_GC_Track((PyObject *) f);
+  return (PyObject *) f;
+}
+
+
+PyObject *lazy_field_force(PyObject *field) {
+  LazyField *f = (LazyField *) field;
+  unsigned long self = PyThread_get_thread_ident();
+  PyObject *thunk, *value;
+
+  value = __atomic_load_n(&f->value, __ATOMIC_ACQUIRE);
+  if (value) {
+    Py_INCREF(value);
+    return value;
+  }
+
+  if (! PyThread_acquire_lock(f->lock, NOWAIT_LOCK)) {
+    if (__atomic_load_n(&f->owner, __ATOMIC_RELAXED) == self) {
+      PyErr_SetString(PyExc_RecursionError,
+		      "lazy field depends upon itself");
+      return NULL;
+    }
+
+    // somebody else is running the thunk, wait to see how it went
+    Py_BEGIN_ALLOW_THREADS;
+    PyThread_acquire_lock(f->lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS;
+  }
+
+  value = f->value;
+  if (! value) {
+    thunk = f->thunk;
+    Py_INCREF(thunk);
+
+    __atomic_store_n(&f->owner, self, __ATOMIC_RELAXED);
+    value = PyObject_CallNoArgs(thunk);
+    __atomic_store_n(&f->owner, 0, __ATOMIC_RELAXED);
+
+    Py_DECREF(thunk);
+
+    if (value) {
+      __atomic_store_n(&f->value, value, __ATOMIC_RELEASE);
+      Py_CLEAR(f->thunk);
+    }
+  }
+
+  PyThread_release_lock(f->lock);
+
+  Py_XINCREF(value);
+  return value;
+}
+
+
+PyObject *values_kwd_force(PyValues *v, PyObject *key, PyObject *field) {
+  PyObject *value;
+
+  // the field was borrowed from the dict, and swapping the value in
+  // may well drop its last reference while other threads are still
+  // waiting on it
+  Py_INCREF(field);
+
+  value = lazy_field_force(field);
+  if (value && PyDict_SetItem(v->kwds, key, value))
+    Py_CLEAR(value);
+
+  Py_DECREF(field);
+  return value;
+}
+
+
+int values_force(PyValues *v) {
+  PyObject *items, *item, *value;
+  Py_ssize_t index, count;
+
+  if (! v->kwds) {
+    v->lazy = 0;
+    return 0;
+  }
+
+  // the thunks may run any code at all, so work from a snapshot
+  // rather than walking the dict while they do
+  items = PyDict_Items(v->kwds);
+  if (! items)
+    return -1;
+
+  count = PyList_GET_SIZE(items);
+  for (index = 0; index < count; index++) {
+    item = PyList_GET_ITEM(items, index);
+    value = PyTuple_GET_ITEM(item, 1);
+
+    if (PyLazyField_Check(value)) {
+      value = values_kwd_force(v, PyTuple_GET_ITEM(item, 0), value);
+      if (! value) {
+	Py_DECREF(items);
+	return -1;
+      }
+      Py_DECREF(value);
+    }
+  }
+
+  Py_DECREF(items);
+  v->lazy = 0;
+  return 0;
+}
+
+
+PyObject *values_lazy(PyObject *type, PyObject *args, PyObject *kwds) {
+  PyObject *fields, *key, *thunk, *field;
+  PyValues *result;
+  Py_ssize_t pos = 0;
+
+  if (! kwds || ! PyDict_GET_SIZE(kwds))
+    return PyObject_Call(type, args, NULL);
+
+  fields = PyDict_New();
+  if (! fields)
+    return NULL;
+
+  while (PyDict_Next(kwds, &pos, &key, &thunk)) {
+    if (! PyCallable_Check(thunk)) {
+      PyErr_Format(PyExc_TypeError, "lazy field %R requires a callable,"
+		   " not %.200s", key, Py_TYPE(thunk)->tp_name);
+      Py_DECREF(fields);
+      return NULL;
+    }
+
+    field = lazy_field_new(thunk);
+    if (! field || PyDict_SetItem(fields, key, field)) {
+      Py_XDECREF(field);
+      Py_DECREF(fields);
+      return NULL;
+    }
+    Py_DECREF(field);
+  }
+
+  result = (PyValues *) PyObject_Call(type, args, fields);
+  Py_DECREF(fields);
+
+  if (result) {
+    if (! PyValues_Check(result)) {
+      Py_DECREF(result);
+      PyErr_SetString(PyExc_TypeError, "lazy requires a values type");
+      return NULL;
+    }
+    result->lazy = 1;
+  }
+
+  return (PyObject *) result;
+}
+
+
+static void lazy_field_dealloc(PyObject *self) {
+  LazyField *f = (LazyField *) self;
+
+  PyObject_GC_UnTrack(self);
+  Py_XDECREF(f->thunk);
+  Py_XDECREF(f->value);
+
+  if (f->lock)
+    PyThread_free_lock(f->lock);
+
+  PyObject_GC_Del(self);
+}
+
+
+static int lazy_field_traverse(PyObject *self, visitproc visit, void *arg) {
+  LazyField *f = (LazyField *) self;
+  Py_VISIT(f->thunk);
+  Py_VISIT(f->value);
+  return 0;
+}
+
+
+static int lazy_field_clear(PyObject *self) {
+  LazyField *f = (LazyField *) self;
+  Py_CLEAR(f->thunk);
+  Py_CLEAR(f->value);
+  return 0;
+}
+
+
+static PyObject *lazy_field_repr(PyObject *self) {
+  LazyField *f = (LazyField *) self;
+
+  if (f->value)
+    return PyUnicode_FromFormat("<lazy_field %R>", f->value);
+  else if (f->thunk)
+    return PyUnicode_FromFormat("<lazy_field of %R>", f->thunk);
+  else
+    return PyUnicode_FromString("<lazy_field>");
+}
+
+
+PyTypeObject PyValuesLazyFieldType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "lazy_field",
+  sizeof(LazyField),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC,
+  .tp_doc = "A placeholder for a lazily computed keyword of a values",
+  .tp_dealloc = lazy_field_dealloc,
+  .tp_traverse = lazy_field_traverse,
+  .tp_clear = lazy_field_clear,
+  .tp_repr = lazy_field_repr,
+};
+
+
+/* The end. */
@@ -0,0 +1,593 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values memory report and compaction
+
+   tracemalloc sees a values' positional tuple and keyword dict as
+   ordinary tuples and dicts, allocated wherever the values was built.
+   This walks every live values instead, and breaks the bytes they
+   hold down by what holds them (the values itself, its positional
+   tuple, its keyword dict, and its cached repr) and by shape.
+
+   Storage is counted once no matter how many values share it, as
+   values built by addition may share their tuple or dict with their
+   operands. The values' members themselves are not counted, as they
+   belong to whoever else refers to them as much as to the values.
+
+   Those members are often the same few strings and numbers repeated
+   as distinct objects, one per record. compact walks a collection of
+   values, keeping the first of each equal str, bytes, int or float
+   it meets in a temporary table, and swaps the rest for that one in
+   the values' own storage. As only an equal object of the exact same
+   type is swapped in, hashes, equality and reprs are unchanged, and
+   only the identity of the members differs. A values' positional
+   tuple may be shared, even with its caller by values(*t), so it is
+   only rewritten in place when nothing else holds it, and copied
+   otherwise.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+
+
+enum mem_kind {
+  MEM_STRUCT,
+  MEM_ARGS,
+  MEM_KWDS,
+  MEM_REPR,
+  MEM_KINDS,
+};
+
+
+static const char *mem_kind_names[MEM_KINDS] = {
+  "struct", "args", "kwds", "repr",
+};
+
+
+typedef struct mem_walk {
+  PyObject *getsizeof;
+  PyObject *seen;
+  PyObject *shapes;
+  Py_ssize_t count;
+  Py_ssize_t kinds[MEM_KINDS];
+} mem_walk;
+
+
+/* the size of obj as sys.getsizeof has it, or zero if obj has already
+   been counted. -1 with an exception set on failure */
+static Py_ssize_t mem_size_once(mem_walk *walk, PyObject *obj) {
+  PyObject *id, *size;
+  Py_ssize_t result;
+  int found;
+
+  id = PyLong_FromVoidPtr(obj);
+  if (! id)
+    return -1;
+
+  found = PySet_Contains(walk->seen, id);
+  if (found || PySet_Add(walk->seen, id)) {
+    Py_DECREF(id);
+    return found == 1? 0: -1;
+  }
+  Py_DECREF(id);
+
+  size = PyObject_CallOneArg(walk->getsizeof, obj);
+  if (! size)
+    return -1;
+
+  result = PyLong_AsSsize_t(size);
+  Py_DECREF(size);
+  return result;
+}
+
+
+static PyObject *mem_shape(PyValues *v) {
+  PyObject *keys, *shape;
+
+  keys = v->kwds? PyDict_Keys(v->kwds): PyList_New(0);
+  if (! keys)
+    return NULL;
+
+  if (PyList_Sort(keys)) {
+    Py_DECREF(keys);
+    return NULL;
+  }
+
+  shape = Py_BuildValue("(nN)", PyTuple_GET_SIZE(v->args),
+			PyList_AsTuple(keys));
+  Py_DECREF(keys);
+  return shape;
+}
+
+
+static int mem_count(mem_walk *walk, PyValues *v) {
+  Py_ssize_t sizes[MEM_KINDS] = { 0 }, total = 0, count = 0;
+  PyObject *shape, *entry = NULL;
+  int kind;
+
+  sizes[MEM_STRUCT] = mem_size_once(walk, (PyObject *) v);
+
+  // the empty tuple is a singleton, and nobody's storage but its own
+  if (v->args && PyTuple_GET_SIZE(v->args))
+    sizes[MEM_ARGS] = mem_size_once(walk, v->args);
+
+  if (v->kwds)
+    sizes[MEM_KWDS] = mem_size_once(walk, v->kwds);
+
+  if (v->repr)
+    sizes[MEM_REPR] = mem_size_once(walk, v->repr);
+
+  for (kind = 0; kind < MEM_KINDS; kind++) {
+    if (sizes[kind] < 0)
+      return -1;
+    walk->kinds[kind] += sizes[kind];
+    total += sizes[kind];
+  }
+  walk->count++;
+
+  shape = mem_shape(v);
+  if (! shape)
+    return -1;
+
+  // each shape's entry is a list of its count and bytes
+  entry = PyDict_GetItemWithError(walk->shapes, shape);
+  if (entry) {
+    count = PyLong_AsSsize_t(PyList_GET_ITEM(entry, 0)) + 1;
+    total += PyLong_AsSsize_t(PyList_GET_ITEM(entry, 1));
+    Py_INCREF(entry);
+
+  } else if (! PyErr_Occurred()) {
+    count = 1;
+    entry = PyList_New(2);
+    if (entry && PyDict_SetItem(walk->shapes, shape, entry))
+      Py_CLEAR(entry);
+  }
+
+  Py_DECREF(shape);
+  if (! entry)
+    return -1;
+
+  PyList_SetItem(entry, 0, PyLong_FromSsize_t(count));
+  PyList_SetItem(entry, 1, PyLong_FromSsize_t(total));
+  Py_DECREF(entry);
+
+  return PyErr_Occurred()? -1: 0;
+}
+
+
+/* the shapes as (arity, keys, count, bytes), most bytes first, and no
+   more than limit of them */
+static PyObject *mem_shapes(mem_walk *walk, Py_ssize_t limit) {
+  PyObject *shape, *entry, *item, *order, *result = NULL;
+  Py_ssize_t pos = 0, index;
+
+  // sorted as (-bytes, count, arity, keys) and then rearranged
+  order = PyList_New(0);
+  if (! order)
+    return NULL;
+
+  while (PyDict_Next(walk->shapes, &pos, &shape, &entry)) {
+    item = Py_BuildValue("(NOOO)",
+			 PyNumber_Negative(PyList_GET_ITEM(entry, 1)),
+			 PyList_GET_ITEM(entry, 0),
+			 PyTuple_GET_ITEM(shape, 0),
+			 PyTuple_GET_ITEM(shape, 1));
+
+    if (! item || PyList_Append(order, item)) {
+      Py_XDECREF(item);
+      goto done;
+    }
+    Py_DECREF(item);
+  }
+
+  if (PyList_Sort(order))
+    goto done;
+
+  if (limit > PyList_GET_SIZE(order))
+    limit = PyList_GET_SIZE(order);
+
+  result = PyTuple_New(limit);
+  if (! result)
+    goto done;
+
+  for (index = 0; index < limit; index++) {
+    PyObject *sorted = PyList_GET_ITEM(order, index);
+
+    item = Py_BuildValue("(OOON)", PyTuple_GET_ITEM(sorted, 2),
+			 PyTuple_GET_ITEM(sorted, 3),
+			 PyTuple_GET_ITEM(sorted, 1),
+			 PyNumber_Negative(PyTuple_GET_ITEM(sorted, 0)));
+    if (! item) {
+      Py_CLEAR(result);
+      goto done;
+    }
+    PyTuple_SET_ITEM(result, index, item);
+  }
+
+ done:
+  Py_DECREF(order);
+  return result;
+}
+
+
+PyObject *values_memory_report(PyObject *mod, PyObject *args,
+			       PyObject *kwds) {
+
+  static char *kwlist[] = { "limit", NULL };
+
+  PyObject *sys, *gc, *objects = NULL, *obj, *shapes, *report = NULL;
+  PyObject *rkwds = NULL, *empty;
+  Py_ssize_t limit = 10, index, total = 0;
+  mem_walk walk;
+  int kind;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|n:_memory_report",
+				    kwlist, &limit))
+    return NULL;
+
+  memset(&walk, 0, sizeof(walk));
+
+  sys = PyImport_ImportModule("sys");
+  gc = PyImport_ImportModule("gc");
+  if (sys && gc) {
+    walk.getsizeof = PyObject_GetAttrString(sys, "getsizeof");
+    objects = PyObject_CallMethod(gc, "get_objects", NULL);
+  }
+  Py_XDECREF(sys);
+  Py_XDECREF(gc);
+
+  walk.seen = PySet_New(NULL);
+  walk.shapes = PyDict_New();
+
+  if (! (walk.getsizeof && objects && walk.seen && walk.shapes))
+    goto done;
+
+  for (index = 0; index < PyList_GET_SIZE(objects); index++) {
+    obj = PyList_GET_ITEM(objects, index);
+
+    if (PyValues_Check(obj) && mem_count(&walk, (PyValues *) obj))
+      goto done;
+  }
+
+  shapes = mem_shapes(&walk, limit);
+  if (! shapes)
+    goto done;
+
+  for (kind = 0; kind < MEM_KINDS; kind++)
+    total += walk.kinds[kind];
+
+  rkwds = Py_BuildValue("{snsnsnsnsnsnsN}",
+			"count", walk.count,
+			"total", total,
+			mem_kind_names[MEM_STRUCT], walk.kinds[MEM_STRUCT],
+			mem_kind_names[MEM_ARGS], walk.kinds[MEM_ARGS],
+			mem_kind_names[MEM_KWDS], walk.kinds[MEM_KWDS],
+			mem_kind_names[MEM_REPR], walk.kinds[MEM_REPR],
+			"shapes", shapes);
+  if (! rkwds)
+    goto done;
+
+  empty = PyTuple_New(0);
+  if (empty)
+    report = sib_values(empty, rkwds);
+  Py_XDECREF(empty);
+
+ done:
+  Py_XDECREF(rkwds);
+  Py_XDECREF(objects);
+  Py_XDECREF(walk.getsizeof);
+  Py_XDECREF(walk.seen);
+  Py_XDECREF(walk.shapes);
+
+  return report;
+}
+
+
+/* === compact === */
+
+
+enum compact_kind {
+  COMPACT_STR,
+  COMPACT_BYTES,
+  COMPACT_INT,
+  COMPACT_FLOAT,
+  COMPACT_KINDS,
+};
+
+
+typedef struct compact_walk {
+  PyObject *getsizeof;
+  PyObject *tables[COMPACT_KINDS];
+  Py_ssize_t replaced;
+  Py_ssize_t reclaimed;
+} compact_walk;
+
+
+/* the canonical object equal to value, borrowed. This is value itself
+   where it is the first of its kind to be seen, or where it isn't of
+   a kind that is compacted. NULL with an exception set on failure */
+static PyObject *compact_canonical(compact_walk *walk, PyObject *value) {
+  PyObject *table;
+
+  // one table per type, as 1 and 1.0 are equal but not the same
+  if (PyUnicode_CheckExact(value))
+    table = walk->tables[COMPACT_STR];
+  else if (PyLong_CheckExact(value))
+    table = walk->tables[COMPACT_INT];
+  else if (PyBytes_CheckExact(value))
+    table = walk->tables[COMPACT_BYTES];
+  else if (PyFloat_CheckExact(value) && PyFloat_AS_DOUBLE(value) != 0.0)
+    // zeros are left be, as -0.0 is equal to 0.0 but has another repr
+    table = walk->tables[COMPACT_FLOAT];
+  else
+    return value;
+
+  return PyDict_SetDefault(table, value, value);
+}
+
+
+/* the size of obj as sys.getsizeof has it, or -1 with an exception
+   set */
+static Py_ssize_t compact_sizeof(compact_walk *walk, PyObject *obj) {
+  PyObject *size;
+  Py_ssize_t bytes;
+
+  // the common kinds are sized as their __sizeof__ would, without
+  // the call. None of these are tracked, so there's no GC header
+  if (PyFloat_CheckExact(obj))
+    return PyFloat_Type.tp_basicsize;
+
+  if (PyBytes_CheckExact(obj))
+    return PyBytes_Type.tp_basicsize + Py_SIZE(obj);
+
+  if (PyUnicode_CheckExact(obj) && PyUnicode_IS_COMPACT_ASCII(obj))
+    return sizeof(PyASCIIObject) + PyUnicode_GET_LENGTH(obj) + 1;
+
+  size = PyObject_CallOneArg(walk->getsizeof, obj);
+  if (! size)
+    return -1;
+
+  bytes = PyLong_AsSsize_t(size);
+  Py_DECREF(size);
+  return bytes;
+}
+
+
+/* counts old as reclaimed if the slot it is about to be swapped out
+   of is the last thing holding it. Returns 0, or -1 with an exception
+   set */
+static int compact_displace(compact_walk *walk, PyObject *old) {
+  Py_ssize_t bytes;
+
+  walk->replaced++;
+  if (Py_REFCNT(old) != 1)
+    return 0;
+
+  bytes = compact_sizeof(walk, old);
+  if (bytes < 0)
+    return -1;
+
+  walk->reclaimed += bytes;
+  return 0;
+}
+
+
+/* has v hold a positional tuple nothing else does, copying it if it
+   is shared. The copy's bytes are taken from those reclaimed. Returns
+   0, or -1 with an exception set */
+static int compact_own_args(compact_walk *walk, PyValues *v) {
+  Py_ssize_t index, count = PyTuple_GET_SIZE(v->args), bytes;
+  PyObject *copy, *item;
+
+  if (Py_REFCNT(v->args) == 1)
+    return 0;
+
+  copy = PyTuple_New(count);
+  if (! copy)
+    return -1;
+
+  for (index = 0; index < count; index++) {
+    item = PyTuple_GET_ITEM(v->args, index);
+    Py_INCREF(item);
+    PyTuple_SET_ITEM(copy, index, item);
+  }
+
+  bytes = compact_sizeof(walk, copy);
+  if (bytes < 0) {
+    Py_DECREF(copy);
+    return -1;
+  }
+
+  walk->reclaimed -= bytes;
+  Py_SETREF(v->args, copy);
+  return 0;
+}
+
+
+static int compact_arg(compact_walk *walk, PyValues *v, Py_ssize_t index) {
+  PyObject *old = PyTuple_GET_ITEM(v->args, index), *canon;
+
+  canon = compact_canonical(walk, old);
+  if (canon == old)
+    return 0;
+
+  // copied before counting, as a shared tuple still holds old
+  if (! canon || compact_own_args(walk, v) || compact_displace(walk, old))
+    return -1;
+
+  // swapping an equal member leaves the tuple's hash as it was
+  Py_INCREF(canon);
+  PyTuple_SET_ITEM(v->args, index, canon);
+  Py_DECREF(old);
+  return 0;
+}
+
+
+static int compact_kwd(compact_walk *walk, PyObject *kwds, PyObject *key,
+		       PyObject *old) {
+
+  PyObject *canon = compact_canonical(walk, old);
+
+  if (canon == old)
+    return 0;
+  if (! canon || compact_displace(walk, old))
+    return -1;
+
+  // the key is already there, so the dict isn't resized
+  return PyDict_SetItem(kwds, key, canon);
+}
+
+
+/* compacts every member of v, or only its given fields */
+static int compact_values(compact_walk *walk, PyValues *v,
+			  PyObject *fields) {
+
+  Py_ssize_t arity = v->args? PyTuple_GET_SIZE(v->args): 0;
+  Py_ssize_t index, pos = 0;
+  PyObject *key, *value;
+
+  if (! fields) {
+    for (index = 0; index < arity; index++) {
+      if (compact_arg(walk, v, index))
+	return -1;
+    }
+
+    while (v->kwds && PyDict_Next(v->kwds, &pos, &key, &value)) {
+      if (compact_kwd(walk, v->kwds, key, value))
+	return -1;
+    }
+    return 0;
+  }
+
+  // a field the record doesn't have is nothing to compact
+  for (pos = 0; pos < PyTuple_GET_SIZE(fields); pos++) {
+    key = PyTuple_GET_ITEM(fields, pos);
+
+    if (PyLong_Check(key)) {
+      index = PyLong_AsSsize_t(key);
+      if (index == -1 && PyErr_Occurred())
+	return -1;
+      if (index < 0)
+	index += arity;
+      if (index >= 0 && index < arity && compact_arg(walk, v, index))
+	return -1;
+
+    } else if (v->kwds) {
+      value = PyDict_GetItemWithError(v->kwds, key);
+      if (value) {
+	if (compact_kwd(walk, v->kwds, key, value))
+	  return -1;
+      } else if (PyErr_Occurred()) {
+	return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+PyObject *values_compact(PyObject *mod, PyObject *args, PyObject *kwds) {
+
+  static char *kwlist[] = { "records", "fields", NULL };
+
+  PyObject *records, *fields = Py_None, *iter = NULL, *rec;
+  PyObject *sys, *rkwds, *empty, *report = NULL;
+  Py_ssize_t count = 0;
+  compact_walk walk;
+  int kind;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|O:compact", kwlist,
+				    &records, &fields))
+    return NULL;
+
+  memset(&walk, 0, sizeof(walk));
+
+  if (fields == Py_None)
+    fields = NULL;
+  else if (PyUnicode_Check(fields) || PyLong_Check(fields))
+    fields = PyTuple_Pack(1, fields);
+  else
+    fields = PySequence_Tuple(fields);
+
+  if (PyErr_Occurred())
+    goto done;
+
+  sys = PyImport_ImportModule("sys");
+  if (sys) {
+    walk.getsizeof = PyObject_GetAttrString(sys, "getsizeof");
+    Py_DECREF(sys);
+  }
+  if (! walk.getsizeof)
+    goto done;
+
+  for (kind = 0; kind < COMPACT_KINDS; kind++) {
+    walk.tables[kind] = PyDict_New();
+    if (! walk.tables[kind])
+      goto done;
+  }
+
+  iter = PyObject_GetIter(records);
+  if (! iter)
+    goto done;
+
+  while ((rec = PyIter_Next(iter))) {
+    if (! PyValues_Check(rec)) {
+      PyErr_Format(PyExc_TypeError, "compact expects values, not %.100s",
+		   Py_TYPE(rec)->tp_name);
+      Py_DECREF(rec);
+      goto done;
+    }
+
+    count++;
+    if (compact_values(&walk, (PyValues *) rec, fields)) {
+      Py_DECREF(rec);
+      goto done;
+    }
+    Py_DECREF(rec);
+  }
+  if (PyErr_Occurred())
+    goto done;
+
+  rkwds = Py_BuildValue("{snsnsn}", "count", count,
+			"replaced", walk.replaced,
+			"reclaimed", walk.reclaimed);
+  if (! rkwds)
+    goto done;
+
+  empty = PyTuple_New(0);
+  if (empty)
+    report = sib_values(empty, rkwds);
+  Py_XDECREF(empty);
+  Py_DECREF(rkwds);
+
+ done:
+  Py_XDECREF(iter);
+  Py_XDECREF(fields);
+  Py_XDECREF(walk.getsizeof);
+  for (kind = 0; kind < COMPACT_KINDS; kind++)
+    Py_XDECREF(walk.tables[kind]);
+
+  return report;
+}
+
+
+/* The end. */
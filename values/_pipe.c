@@ -0,0 +1,250 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values pipe
+
+   A callable composing a chain of functions, so that pipe(f, g, h)
+   does the work of h(g(f(...))) without a Python frame in between.
+
+   Whenever a values is handed to a stage, whether as the pipe's sole
+   argument or as the result of the stage before, it is splatted into
+   that stage's positional and keyword arguments. Anything else is
+   passed along as the single argument.
+
+   Pipes given as stages are flattened into the new pipe when it is
+   created, so nesting them costs nothing when called.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <stddef.h>
+
+
+typedef struct Pipe {
+  PyObject_HEAD
+
+  PyObject *funcs;
+  vectorcallfunc vectorcall;
+} Pipe;
+
+
+/* Calls func with the splatted contents of v */
+static PyObject *pipe_splat(PyObject *func, PyValues *v) {
+
+  if (VALUES_FORCE(v))
+    return NULL;
+
+  if (v->kwds && PyDict_GET_SIZE(v->kwds))
+    return PyObject_Call(func, v->args, v->kwds);
+
+  // the positionals are already laid out as a vector in the tuple
+  return PyObject_Vectorcall(func, &PyTuple_GET_ITEM(v->args, 0),
+			     PyTuple_GET_SIZE(v->args), NULL);
+}
+
+
+static PyObject *pipe_vectorcall(PyObject *self, PyObject *const *args,
+				 size_t nargsf, PyObject *kwnames) {
+
+  PyObject *funcs = ((Pipe *) self)->funcs;
+  Py_ssize_t nargs = PyVectorcall_NARGS(nargsf);
+  Py_ssize_t index, count = PyTuple_GET_SIZE(funcs);
+  PyObject *func, *result, *next;
+
+  func = PyTuple_GET_ITEM(funcs, 0);
+
+  if (nargs == 1 && ! kwnames && PyValues_Check(args[0])) {
+    result = pipe_splat(func, (PyValues *) args[0]);
+  } else {
+    result = PyObject_Vectorcall(func, args, nargsf, kwnames);
+  }
+
+  for (index = 1; result && index < count; index++) {
+    func = PyTuple_GET_ITEM(funcs, index);
+
+    if (PyValues_Check(result)) {
+      next = pipe_splat(func, (PyValues *) result);
+    } else {
+      next = PyObject_CallOneArg(func, result);
+    }
+
+    Py_DECREF(result);
+    result = next;
+  }
+
+  return result;
+}
+
+
+static PyObject *pipe_new(PyTypeObject *type,
+			  PyObject *args, PyObject *kwds) {
+
+  PyObject *funcs, *func;
+  Py_ssize_t index, count;
+  Pipe *p;
+
+  if (kwds && PyDict_GET_SIZE(kwds)) {
+    PyErr_SetString(PyExc_TypeError, "pipe takes no keyword arguments");
+    return NULL;
+  }
+
+  count = PyTuple_GET_SIZE(args);
+  if (! count) {
+    PyErr_SetString(PyExc_TypeError, "pipe requires at least one function");
+    return NULL;
+  }
+
+  funcs = PyList_New(0);
+  if (! funcs)
+    return NULL;
+
+  for (index = 0; index < count; index++) {
+    func = PyTuple_GET_ITEM(args, index);
+
+    if (Py_TYPE(func) == &PyValuesPipeType) {
+      PyObject *inner = ((Pipe *) func)->funcs;
+      Py_ssize_t stage;
+
+      // take on its stages rather than nesting it
+      for (stage = 0; stage < PyTuple_GET_SIZE(inner); stage++) {
+	if (PyList_Append(funcs, PyTuple_GET_ITEM(inner, stage))) {
+	  Py_DECREF(funcs);
+	  return NULL;
+	}
+      }
+
+    } else if (! PyCallable_Check(func)) {
+      PyErr_Format(PyExc_TypeError, "pipe stages must be callable, not"
+		   " %.200s", Py_TYPE(func)->tp_name);
+      Py_DECREF(funcs);
+      return NULL;
+
+    } else if (PyList_Append(funcs, func)) {
+      Py_DECREF(funcs);
+      return NULL;
+    }
+  }
+
+  p = PyObject_GC_New(Pipe, type);
+  if (! p) {
+    Py_DECREF(funcs);
+    return NULL;
+  }
+
+  p->funcs = PyList_AsTuple(funcs);
+  p->vectorcall = pipe_vectorcall;
+  Py_DECREF(funcs);
+
+  if (! p->funcs) {
+    Py_DECREF(p);
+    return NULL;
+  }
+
+  PyObject_GC_Track((PyObject *) p);
+  return (PyObject *) p;
+}
+
+
+static void pipe_dealloc(PyObject *self) {
+  PyObject_GC_UnTrack(self);
+  Py_CLEAR(((Pipe *) self)->funcs);
+  PyObject_GC_Del(self);
+}
+
+
+static int pipe_traverse(PyObject *self, visitproc visit, void *arg) {
+  Py_VISIT(((Pipe *) self)->funcs);
+  return 0;
+}
+
+
+static int pipe_clear(PyObject *self) {
+  Py_CLEAR(((Pipe *) self)->funcs);
+  return 0;
+}
+
+
+static PyObject *pipe_repr(PyObject *self) {
+  PyObject *funcs = ((Pipe *) self)->funcs;
+  PyObject *inner, *result;
+
+  if (Py_ReprEnter(self))
+    return PyUnicode_FromString("pipe(...)");
+
+  inner = PyObject_Repr(funcs);
+  Py_ReprLeave(self);
+
+  if (! inner)
+    return NULL;
+
+  // a tuple of one has that trailing comma we don't want
+  if (PyTuple_GET_SIZE(funcs) == 1) {
+    result = PyUnicode_FromFormat("pipe(%R)", PyTuple_GET_ITEM(funcs, 0));
+  } else {
+    result = PyUnicode_FromFormat("pipe%U", inner);
+  }
+
+  Py_DECREF(inner);
+  return result;
+}
+
+
+static PyObject *pipe_get_funcs(PyObject *self, void *_closure) {
+  PyObject *funcs = ((Pipe *) self)->funcs;
+  Py_INCREF(funcs);
+  return funcs;
+}
+
+
+static PyGetSetDef pipe_getset[] = {
+  { "funcs", pipe_get_funcs, NULL,
+    "the flattened stages of the pipe, in the order they are applied",
+    NULL },
+  { NULL },
+};
+
+
+PyTypeObject PyValuesPipeType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "pipe",
+  sizeof(Pipe),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC|
+  Py_TPFLAGS_HAVE_VECTORCALL,
+  .tp_doc = "pipe(*funcs)\n"
+  "A callable applying each of funcs in turn, the first to the pipe's\n"
+  "own arguments and each after to the result of the one before. A\n"
+  "values passed along is splatted into the arguments of the stage\n"
+  "receiving it. Pipes among funcs are flattened into this one",
+  .tp_new = pipe_new,
+  .tp_dealloc = pipe_dealloc,
+  .tp_traverse = pipe_traverse,
+  .tp_clear = pipe_clear,
+  .tp_repr = pipe_repr,
+  .tp_call = PyVectorcall_Call,
+  .tp_vectorcall_offset = offsetof(Pipe, vectorcall),
+  .tp_getset = pipe_getset,
+};
+
+
+/* The end. */
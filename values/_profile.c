@@ -0,0 +1,525 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values profile
+
+   A callable wrapping a function and recording the wall clock time of
+   every call to it, in nanoseconds, into a log-linear histogram.
+
+   The histogram is in the style of HdrHistogram. Durations below
+   2 * PROF_SUB are counted exactly. Above that, each power of two is
+   split into PROF_SUB linear buckets, so any duration is known to
+   within 1 / PROF_SUB (about 3%) and the whole 64 bit range fits in a
+   fixed array of counters.
+
+   Recording is a couple of relaxed atomic adds, and needs no lock,
+   so the counts stay whole when calls come from several threads at
+   once (with the GIL released, or without a GIL at all). Snapshots
+   take the counters with an atomic exchange when resetting, so that
+   no call is lost between the read and the reset.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+#define PROF_SUB_BITS 5
+#define PROF_SUB (1 << PROF_SUB_BITS)
+
+/* the bucket of the largest uint64_t, plus one */
+#define PROF_BUCKETS ((64 - PROF_SUB_BITS + 1) * PROF_SUB)
+
+
+typedef struct Profile {
+  PyObject_HEAD
+
+  PyObject *func;
+  vectorcallfunc vectorcall;
+  PyObject *weakrefs;
+
+  /* the count of calls is the sum of the buckets */
+  uint64_t errors;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[PROF_BUCKETS];
+} Profile;
+
+
+/* a copy of the counters of a profile, to work out percentiles from */
+typedef struct prof_snap {
+  uint64_t count;
+  uint64_t errors;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[PROF_BUCKETS];
+} prof_snap;
+
+
+static inline uint64_t prof_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static inline Py_ssize_t prof_bucket(uint64_t ns) {
+  int shift;
+
+  if (ns < 2 * PROF_SUB)
+    return (Py_ssize_t) ns;
+
+  // ns has its top bit at 63 - clz, and keeps PROF_SUB_BITS + 1 bits
+  shift = 63 - __builtin_clzll(ns) - PROF_SUB_BITS;
+  return (Py_ssize_t) shift * PROF_SUB + (Py_ssize_t) (ns >> shift);
+}
+
+
+static uint64_t prof_bucket_low(Py_ssize_t index) {
+  int shift;
+
+  if (index < 2 * PROF_SUB)
+    return (uint64_t) index;
+
+  shift = (int) (index / PROF_SUB) - 1;
+  return (uint64_t) (index - shift * PROF_SUB) << shift;
+}
+
+
+static uint64_t prof_bucket_high(Py_ssize_t index) {
+  int shift;
+
+  if (index < 2 * PROF_SUB)
+    return (uint64_t) index;
+
+  shift = (int) (index / PROF_SUB) - 1;
+  return prof_bucket_low(index) + (((uint64_t) 1 << shift) - 1);
+}
+
+
+static inline void prof_record(Profile *p, uint64_t ns, int failed) {
+  uint64_t seen;
+
+  __atomic_add_fetch(&p->buckets[prof_bucket(ns)], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&p->total, ns, __ATOMIC_RELAXED);
+
+  if (unlikely(failed))
+    __atomic_add_fetch(&p->errors, 1, __ATOMIC_RELAXED);
+
+  seen = __atomic_load_n(&p->min, __ATOMIC_RELAXED);
+  while (ns < seen &&
+	 ! __atomic_compare_exchange_n(&p->min, &seen, ns, 1,
+				       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  seen = __atomic_load_n(&p->max, __ATOMIC_RELAXED);
+  while (ns > seen &&
+	 ! __atomic_compare_exchange_n(&p->max, &seen, ns, 1,
+				       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+static PyObject *prof_vectorcall(PyObject *self, PyObject *const *args,
+				 size_t nargsf, PyObject *kwnames) {
+
+  Profile *p = (Profile *) self;
+  PyObject *result;
+  uint64_t start;
+
+  // cleared by the collector, as part of a cycle
+  if (unlikely(! p->func)) {
+    PyErr_SetString(PyExc_ReferenceError, "profiled callable was cleared");
+    return NULL;
+  }
+
+  start = prof_now();
+  result = PyObject_Vectorcall(p->func, args, nargsf, kwnames);
+  prof_record(p, prof_now() - start, result == NULL);
+
+  return result;
+}
+
+
+/* === snapshots === */
+
+
+static void prof_take(Profile *p, prof_snap *snap, int reset) {
+  Py_ssize_t index;
+
+  if (reset) {
+    snap->errors = __atomic_exchange_n(&p->errors, 0, __ATOMIC_RELAXED);
+    snap->total = __atomic_exchange_n(&p->total, 0, __ATOMIC_RELAXED);
+    snap->min = __atomic_exchange_n(&p->min, UINT64_MAX, __ATOMIC_RELAXED);
+    snap->max = __atomic_exchange_n(&p->max, 0, __ATOMIC_RELAXED);
+
+    for (index = 0; index < PROF_BUCKETS; index++)
+      snap->buckets[index] = __atomic_exchange_n(&p->buckets[index], 0,
+						 __ATOMIC_RELAXED);
+
+  } else {
+    snap->errors = __atomic_load_n(&p->errors, __ATOMIC_RELAXED);
+    snap->total = __atomic_load_n(&p->total, __ATOMIC_RELAXED);
+    snap->min = __atomic_load_n(&p->min, __ATOMIC_RELAXED);
+    snap->max = __atomic_load_n(&p->max, __ATOMIC_RELAXED);
+
+    for (index = 0; index < PROF_BUCKETS; index++)
+      snap->buckets[index] = __atomic_load_n(&p->buckets[index],
+					     __ATOMIC_RELAXED);
+  }
+
+  snap->count = 0;
+  for (index = 0; index < PROF_BUCKETS; index++)
+    snap->count += snap->buckets[index];
+}
+
+
+/* the highest duration equivalent to the one at percentile pct of the
+   snapshot, within the histogram's precision */
+static uint64_t prof_percentile(prof_snap *snap, double pct) {
+  uint64_t rank, seen = 0;
+  Py_ssize_t index;
+
+  if (! snap->count)
+    return 0;
+
+  rank = (uint64_t) (pct / 100.0 * snap->count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > snap->count)
+    rank = snap->count;
+
+  for (index = 0; index < PROF_BUCKETS; index++) {
+    seen += snap->buckets[index];
+    if (seen >= rank) {
+      uint64_t high = prof_bucket_high(index);
+      return high < snap->max? high: snap->max;
+    }
+  }
+
+  return snap->max;
+}
+
+
+static int prof_check_pct(double pct) {
+  if (pct < 0.0 || pct > 100.0) {
+    PyErr_SetString(PyExc_ValueError, "percentile must be from 0 to 100");
+    return -1;
+  }
+  return 0;
+}
+
+
+static PyObject *prof_snap_values(prof_snap *snap) {
+  PyObject *kwds, *buckets, *bucket, *args, *result = NULL;
+  Py_ssize_t index;
+
+  buckets = PyList_New(0);
+  if (! buckets)
+    return NULL;
+
+  for (index = 0; index < PROF_BUCKETS; index++) {
+    if (! snap->buckets[index])
+      continue;
+
+    bucket = Py_BuildValue("(KKK)",
+			   (unsigned long long) prof_bucket_low(index),
+			   (unsigned long long) prof_bucket_high(index),
+			   (unsigned long long) snap->buckets[index]);
+
+    if (! bucket || PyList_Append(buckets, bucket)) {
+      Py_XDECREF(bucket);
+      Py_DECREF(buckets);
+      return NULL;
+    }
+    Py_DECREF(bucket);
+  }
+
+  Py_SETREF(buckets, PyList_AsTuple(buckets));
+  if (! buckets)
+    return NULL;
+
+  kwds = Py_BuildValue("{sKsKsKsKsKsdsKsKsKsKsN}",
+		       "count", (unsigned long long) snap->count,
+		       "errors", (unsigned long long) snap->errors,
+		       "total", (unsigned long long) snap->total,
+		       "min", (unsigned long long)
+		       (snap->count? snap->min: 0),
+		       "max", (unsigned long long) snap->max,
+		       "mean", (snap->count?
+				(double) snap->total / snap->count: 0.0),
+		       "p50", (unsigned long long)
+		       prof_percentile(snap, 50.0),
+		       "p90", (unsigned long long)
+		       prof_percentile(snap, 90.0),
+		       "p99", (unsigned long long)
+		       prof_percentile(snap, 99.0),
+		       "p999", (unsigned long long)
+		       prof_percentile(snap, 99.9),
+		       "buckets", buckets);
+
+  if (! kwds)
+    return NULL;
+
+  args = PyTuple_New(0);
+  if (args)
+    result = sib_values(args, kwds);
+
+  Py_XDECREF(args);
+  Py_DECREF(kwds);
+  return result;
+}
+
+
+static PyObject *prof_snapshot(PyObject *self, PyObject *args,
+			       PyObject *kwds) {
+
+  static char *kwlist[] = { "reset", NULL };
+
+  PyObject *result;
+  prof_snap *snap;
+  int reset = 0;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|p:snapshot", kwlist,
+				    &reset))
+    return NULL;
+
+  snap = PyMem_Malloc(sizeof(prof_snap));
+  if (! snap)
+    return PyErr_NoMemory();
+
+  prof_take((Profile *) self, snap, reset);
+  result = prof_snap_values(snap);
+
+  PyMem_Free(snap);
+  return result;
+}
+
+
+static PyObject *prof_reset(PyObject *self, PyObject *_noargs) {
+  prof_snap *snap;
+
+  snap = PyMem_Malloc(sizeof(prof_snap));
+  if (! snap)
+    return PyErr_NoMemory();
+
+  prof_take((Profile *) self, snap, 1);
+  PyMem_Free(snap);
+
+  Py_RETURN_NONE;
+}
+
+
+static PyObject *prof_get_percentile(PyObject *self, PyObject *args) {
+  prof_snap *snap;
+  uint64_t found;
+  double pct;
+
+  if (! PyArg_ParseTuple(args, "d:percentile", &pct))
+    return NULL;
+
+  if (prof_check_pct(pct))
+    return NULL;
+
+  snap = PyMem_Malloc(sizeof(prof_snap));
+  if (! snap)
+    return PyErr_NoMemory();
+
+  prof_take((Profile *) self, snap, 0);
+  found = prof_percentile(snap, pct);
+  PyMem_Free(snap);
+
+  return PyLong_FromUnsignedLongLong(found);
+}
+
+
+/* === type === */
+
+
+static PyObject *prof_new(PyTypeObject *type, PyObject *args,
+			  PyObject *kwds) {
+
+  static char *kwlist[] = { "func", NULL };
+
+  PyObject *func;
+  Profile *p;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O:profile", kwlist, &func))
+    return NULL;
+
+  if (! PyCallable_Check(func)) {
+    PyErr_Format(PyExc_TypeError, "profile requires a callable, not %.200s",
+		 Py_TYPE(func)->tp_name);
+    return NULL;
+  }
+
+  p = (Profile *) type->tp_alloc(type, 0);
+  if (! p)
+    return NULL;
+
+  Py_INCREF(func);
+  p->func = func;
+  p->vectorcall = prof_vectorcall;
+  p->min = UINT64_MAX;
+
+  return (PyObject *) p;
+}
+
+
+static void prof_dealloc(PyObject *self) {
+  Profile *p = (Profile *) self;
+
+  PyObject_GC_UnTrack(self);
+
+  if (p->weakrefs)
+    PyObject_ClearWeakRefs(self);
+
+  Py_CLEAR(p->func);
+  Py_TYPE(self)->tp_free(self);
+}
+
+
+static int prof_traverse(PyObject *self, visitproc visit, void *arg) {
+  Py_VISIT(((Profile *) self)->func);
+  return 0;
+}
+
+
+static int prof_clear(PyObject *self) {
+  Py_CLEAR(((Profile *) self)->func);
+  return 0;
+}
+
+
+static PyObject *prof_descr_get(PyObject *self, PyObject *obj,
+				PyObject *type) {
+
+  // so that a profiled function in a class body binds as a method
+  if (obj == NULL || obj == Py_None) {
+    Py_INCREF(self);
+    return self;
+  }
+  return PyMethod_New(self, obj);
+}
+
+
+static PyObject *prof_repr(PyObject *self) {
+  Profile *p = (Profile *) self;
+
+  if (! p->func)
+    return PyUnicode_FromString("profile()");
+
+  return PyUnicode_FromFormat("profile(%R)", p->func);
+}
+
+
+static PyObject *prof_get_func(PyObject *self, void *_closure) {
+  PyObject *func = ((Profile *) self)->func;
+
+  if (! func)
+    Py_RETURN_NONE;
+
+  Py_INCREF(func);
+  return func;
+}
+
+
+static PyObject *prof_get_count(PyObject *self, void *_closure) {
+  Profile *p = (Profile *) self;
+  uint64_t count = 0;
+  Py_ssize_t index;
+
+  for (index = 0; index < PROF_BUCKETS; index++)
+    count += __atomic_load_n(&p->buckets[index], __ATOMIC_RELAXED);
+
+  return PyLong_FromUnsignedLongLong(count);
+}
+
+
+static PyObject *prof_get_errors(PyObject *self, void *_closure) {
+  Profile *p = (Profile *) self;
+  return PyLong_FromUnsignedLongLong(__atomic_load_n(&p->errors,
+						     __ATOMIC_RELAXED));
+}
+
+
+static PyMethodDef prof_methods[] = {
+  { "snapshot", (PyCFunction) prof_snapshot, METH_VARARGS|METH_KEYWORDS,
+    "snapshot(reset=False) -> values\n"
+    "The recorded calls as a values of count, errors, total, min, max\n"
+    "and mean, the percentiles p50, p90, p99 and p999, and buckets, a\n"
+    "tuple of (low, high, count) for each bucket holding any calls.\n"
+    "All times are in nanoseconds. With reset=True the counters are\n"
+    "cleared in the same pass, losing no calls in between" },
+
+  { "reset", (PyCFunction) prof_reset, METH_NOARGS,
+    "reset()\n"
+    "Clears the recorded calls" },
+
+  { "percentile", (PyCFunction) prof_get_percentile, METH_VARARGS,
+    "percentile(pct) -> int\n"
+    "The duration in nanoseconds which pct percent of calls took no\n"
+    "longer than, to within the histogram's precision" },
+
+  { NULL, NULL, 0, NULL },
+};
+
+
+static PyGetSetDef prof_getset[] = {
+  { "func", prof_get_func, NULL, "the profiled callable", NULL },
+  { "count", prof_get_count, NULL, "the number of calls recorded", NULL },
+  { "errors", prof_get_errors, NULL,
+    "the number of recorded calls which raised", NULL },
+  { NULL },
+};
+
+
+PyTypeObject PyValuesProfileType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "profile",
+  sizeof(Profile),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC|
+  Py_TPFLAGS_HAVE_VECTORCALL,
+  .tp_doc = "profile(func)\n"
+  "A callable invoking func and recording how long each call took\n"
+  "into a log-linear latency histogram, precise to about 3%. Usable\n"
+  "as a decorator, including on methods",
+  .tp_new = prof_new,
+  .tp_dealloc = prof_dealloc,
+  .tp_traverse = prof_traverse,
+  .tp_clear = prof_clear,
+  .tp_repr = prof_repr,
+  .tp_call = PyVectorcall_Call,
+  .tp_vectorcall_offset = offsetof(Profile, vectorcall),
+  .tp_weaklistoffset = offsetof(Profile, weakrefs),
+  .tp_descr_get = prof_descr_get,
+  .tp_methods = prof_methods,
+  .tp_getset = prof_getset,
+};
+
+
+/* The end. */
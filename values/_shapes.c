@@ -0,0 +1,331 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values shape telemetry
+
+   An opt-in sampler of the shapes of the values being constructed,
+   meant for deciding which layouts are worth specializing. When
+   enabled with _shape_sample(every), one in every constructions is
+   looked at, and its positional arity and its set of keyword names
+   are counted.
+
+   Arities are counted exactly, in a fixed table. Keyword sets may be
+   unbounded, so only the top SHAPE_CAPACITY of them are tracked,
+   using the Space-Saving algorithm. When a new set arrives and the
+   table is full, it takes over the slot of the least counted set and
+   inherits that count as its error. A set's true count is then known
+   to be between count - error and count, and any set occurring more
+   than 1/capacity of the time is certain to be in the table.
+
+   Sets are matched by an order-independent digest of their keys'
+   hashes, and confirmed against the frozenset kept in the slot.
+
+   The counters are plain, as they are only touched with the GIL
+   held. Sampling costs nothing but a single test when disabled.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+
+
+#define SHAPE_ARITIES 64
+#define SHAPE_DEFAULT_CAPACITY 32
+
+
+typedef struct shape_slot {
+  Py_uhash_t digest;
+  Py_ssize_t size;
+  PyObject *keys;
+  unsigned long long count;
+  unsigned long long error;
+} shape_slot;
+
+
+Py_ssize_t shape_every = 0;
+
+static Py_ssize_t shape_countdown = 0;
+static unsigned long long shape_constructed = 0;
+static unsigned long long shape_sampled = 0;
+static unsigned long long shape_arities[SHAPE_ARITIES];
+
+static shape_slot *shape_slots = NULL;
+static Py_ssize_t shape_capacity = 0;
+static Py_ssize_t shape_used = 0;
+
+
+static void shape_reset(void) {
+  Py_ssize_t index;
+
+  for (index = 0; index < shape_used; index++)
+    Py_CLEAR(shape_slots[index].keys);
+
+  shape_used = 0;
+  shape_countdown = shape_every;
+  shape_constructed = 0;
+  shape_sampled = 0;
+  memset(shape_arities, 0, sizeof(shape_arities));
+}
+
+
+static Py_uhash_t shape_digest(PyObject *kwds) {
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+  Py_uhash_t digest = 0, hash;
+
+  // summed, so that the order the keys arrived in doesn't matter
+  while (PyDict_Next(kwds, &pos, &key, &value)) {
+    hash = (Py_uhash_t) PyObject_Hash(key);
+    digest += (hash ^ (hash >> 29)) * (Py_uhash_t) 0x9E3779B97F4A7C15ULL;
+  }
+
+  return digest;
+}
+
+
+static int shape_match(shape_slot *slot, Py_uhash_t digest,
+		       PyObject *kwds, Py_ssize_t size) {
+
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+
+  if (slot->digest != digest || slot->size != size)
+    return 0;
+
+  while (PyDict_Next(kwds, &pos, &key, &value)) {
+    if (PySet_Contains(slot->keys, key) != 1) {
+      PyErr_Clear();
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+static void shape_count_keys(PyObject *kwds) {
+  shape_slot *slot, *least = NULL;
+  Py_ssize_t index, size;
+  Py_uhash_t digest;
+  PyObject *keys;
+
+  size = kwds? PyDict_GET_SIZE(kwds): 0;
+  digest = size? shape_digest(kwds): 0;
+
+  for (index = 0; index < shape_used; index++) {
+    slot = shape_slots + index;
+
+    if (size? shape_match(slot, digest, kwds, size): ! slot->size) {
+      slot->count++;
+      return;
+    }
+
+    if (! least || slot->count < least->count)
+      least = slot;
+  }
+
+  keys = size? PyFrozenSet_New(kwds): PyFrozenSet_New(NULL);
+  if (! keys) {
+    // telemetry must never break construction
+    PyErr_Clear();
+    return;
+  }
+
+  if (shape_used < shape_capacity) {
+    slot = shape_slots + shape_used++;
+    slot->count = 1;
+    slot->error = 0;
+
+  } else {
+    // take over the least counted, and inherit its count as error
+    slot = least;
+    Py_CLEAR(slot->keys);
+    slot->error = slot->count;
+    slot->count++;
+  }
+
+  slot->digest = digest;
+  slot->size = size;
+  slot->keys = keys;
+}
+
+
+void shape_sample(PyValues *v) {
+  Py_ssize_t arity;
+
+  shape_constructed++;
+  if (--shape_countdown > 0)
+    return;
+
+  shape_countdown = shape_every;
+  shape_sampled++;
+
+  arity = PyTuple_GET_SIZE(v->args);
+  shape_arities[arity < SHAPE_ARITIES? arity: SHAPE_ARITIES - 1]++;
+
+  shape_count_keys(v->kwds);
+}
+
+
+PyObject *values_shape_sample(PyObject *mod, PyObject *args,
+			      PyObject *kwds) {
+
+  static char *kwlist[] = { "every", "capacity", NULL };
+
+  Py_ssize_t every, previous = shape_every;
+  Py_ssize_t capacity = SHAPE_DEFAULT_CAPACITY;
+  shape_slot *slots;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "n|n:_shape_sample",
+				    kwlist, &every, &capacity))
+    return NULL;
+
+  if (every < 0 || capacity < 1) {
+    PyErr_SetString(PyExc_ValueError,
+		    "_shape_sample requires every >= 0 and capacity >= 1");
+    return NULL;
+  }
+
+  shape_every = 0;
+  shape_reset();
+
+  if (capacity != shape_capacity) {
+    slots = PyMem_Resize(shape_slots, shape_slot, capacity);
+    if (! slots)
+      return PyErr_NoMemory();
+
+    shape_slots = slots;
+    shape_capacity = capacity;
+  }
+
+  shape_every = every;
+  shape_countdown = every;
+
+  return PyLong_FromSsize_t(previous);
+}
+
+
+static int shape_slot_cmp(const void *a, const void *b) {
+  const shape_slot *left = a, *right = b;
+
+  if (left->count != right->count)
+    return left->count < right->count? 1: -1;
+  return 0;
+}
+
+
+static PyObject *shape_sorted_keys(PyObject *keys) {
+  PyObject *result = PySequence_List(keys);
+
+  if (result && PyList_Sort(result)) {
+    // keys of mixed types, so leave them as they came
+    PyErr_Clear();
+  }
+
+  if (result)
+    Py_SETREF(result, PyList_AsTuple(result));
+
+  return result;
+}
+
+
+PyObject *values_shape_report(PyObject *mod, PyObject *args,
+			      PyObject *kwds) {
+
+  static char *kwlist[] = { "reset", NULL };
+
+  PyObject *arities = NULL, *shapes = NULL, *item, *report, *empty;
+  Py_ssize_t index, every;
+  int reset = 0;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|p:_shape_report",
+				    kwlist, &reset))
+    return NULL;
+
+  arities = PyList_New(0);
+  shapes = PyList_New(0);
+  if (! (arities && shapes))
+    goto error;
+
+  for (index = 0; index < SHAPE_ARITIES; index++) {
+    if (! shape_arities[index])
+      continue;
+
+    item = Py_BuildValue("(nK)", index, shape_arities[index]);
+    if (! item || PyList_Append(arities, item)) {
+      Py_XDECREF(item);
+      goto error;
+    }
+    Py_DECREF(item);
+  }
+
+  // heaviest first
+  qsort(shape_slots, shape_used, sizeof(shape_slot), shape_slot_cmp);
+
+  for (index = 0; index < shape_used; index++) {
+    shape_slot *slot = shape_slots + index;
+
+    item = Py_BuildValue("(NKK)", shape_sorted_keys(slot->keys),
+			 slot->count, slot->error);
+    if (! item || PyList_Append(shapes, item)) {
+      Py_XDECREF(item);
+      goto error;
+    }
+    Py_DECREF(item);
+  }
+
+  Py_SETREF(arities, PyList_AsTuple(arities));
+  Py_SETREF(shapes, PyList_AsTuple(shapes));
+  if (! (arities && shapes))
+    goto error;
+
+  kwds = Py_BuildValue("{snsKsKsNsN}",
+		       "every", shape_every,
+		       "constructed", shape_constructed,
+		       "sampled", shape_sampled,
+		       "arities", arities,
+		       "shapes", shapes);
+  if (! kwds)
+    return NULL;
+
+  // the report shouldn't count itself
+  every = shape_every;
+  shape_every = 0;
+
+  empty = PyTuple_New(0);
+  report = empty? sib_values(empty, kwds): NULL;
+  Py_XDECREF(empty);
+
+  shape_every = every;
+  Py_DECREF(kwds);
+
+  if (report && reset)
+    shape_reset();
+
+  return report;
+
+ error:
+  Py_XDECREF(arities);
+  Py_XDECREF(shapes);
+  return NULL;
+}
+
+
+/* The end. */
@@ -0,0 +1,770 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values shared memo
+
+   A memo table in POSIX shared memory, so that every process on a
+   host (typically the workers of a pre-fork pool) sees the results
+   any of them computed.
+
+   The table is a flat array of fixed-size slots, open-addressed by
+   the XXH64 of the key's canonical encoding, with linear probing over
+   a short window. Each slot holds the encoded key and the pickled
+   result side by side, and is guarded by its own sequence counter.
+   A writer first claims a slot by writing its pid as the slot's owner,
+   then moves the counter from even to odd, and releases it by moving
+   the counter on to the next even number and the owner back to zero.
+   Readers take no lock at all: they copy a slot out and retry should
+   its counter have moved or been odd in the meantime.
+
+   A writer that dies holding a slot would leave it held for good, so
+   a writer kept waiting too long checks whether the owner is still
+   alive, and if not claims the slot in its stead. Whatever the dead
+   writer left half-written is marked so that no key will match it.
+
+   Slots are never emptied except by clear(), so a probe can stop at
+   the first empty slot. When a probe window is full, one of its slots
+   is overwritten.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <string.h>
+
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_SHMEMO 1
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#define SHMEMO_MAGIC 0x6f6d656d73766c76ULL  /* "vlvsmemo" */
+#define SHMEMO_VERSION 2
+#define SHMEMO_PROBE 16
+#define SHMEMO_SPINS 1000
+
+
+typedef struct shmemo_header {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t capacity;
+  uint64_t slot_size;
+} shmemo_header;
+
+
+typedef struct shmemo_slot {
+  uint64_t seq;
+  int64_t owner;
+  uint64_t hash;
+  uint32_t key_len;
+  uint32_t val_len;
+  char data[];
+} shmemo_slot;
+
+
+#define SHMEMO_HEADER_SIZE 64
+
+
+typedef struct SharedMemo {
+  PyObject_HEAD
+
+  PyObject *name;
+  char *base;
+  size_t size;
+  uint64_t capacity;
+  uint64_t slot_size;
+} SharedMemo;
+
+
+static PyObject *pickle_dumps = NULL;
+static PyObject *pickle_loads = NULL;
+
+
+static int shmemo_pickle(void) {
+  PyObject *pickle;
+
+  if (pickle_dumps)
+    return 0;
+
+  pickle = PyImport_ImportModule("pickle");
+  if (! pickle)
+    return -1;
+
+  pickle_dumps = PyObject_GetAttrString(pickle, "dumps");
+  pickle_loads = PyObject_GetAttrString(pickle, "loads");
+  Py_DECREF(pickle);
+
+  if (! (pickle_dumps && pickle_loads)) {
+    Py_CLEAR(pickle_dumps);
+    Py_CLEAR(pickle_loads);
+    return -1;
+  }
+  return 0;
+}
+
+
+static inline shmemo_slot *shmemo_slot_at(SharedMemo *m, uint64_t index) {
+  return (shmemo_slot *) (m->base + SHMEMO_HEADER_SIZE +
+			  (index % m->capacity) * m->slot_size);
+}
+
+
+static int shmemo_check_open(SharedMemo *m) {
+  if (unlikely(! m->base)) {
+    PyErr_SetString(PyExc_ValueError, "SharedMemo is closed");
+    return -1;
+  }
+  return 0;
+}
+
+
+/* The canonical encoding of key, and its hash. Zero marks an empty
+   slot, so no key may hash to it */
+static PyObject *shmemo_key(PyObject *key, uint64_t *hashed) {
+  PyObject *data = canon_bytes(key);
+  xxh64_state state;
+
+  if (! data)
+    return NULL;
+
+  xxh64_reset(&state, 0);
+  xxh64_update(&state, PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+  *hashed = xxh64_digest(&state);
+  if (! *hashed)
+    *hashed = 1;
+
+  return data;
+}
+
+
+/* Copies the value out of the slot holding key, if any. Returns a new
+   bytes object on a hit, Py_None (borrowed) on a miss, or NULL with an
+   exception set */
+static PyObject *shmemo_find(SharedMemo *m, PyObject *key) {
+  const char *kdata;
+  Py_ssize_t klen;
+  uint64_t hashed, index, probe, seq, again;
+  shmemo_slot *slot;
+  PyObject *kbytes, *found = NULL;
+  char *copy = NULL;
+  uint32_t vlen;
+  int spins;
+
+  kbytes = shmemo_key(key, &hashed);
+  if (! kbytes)
+    return NULL;
+
+  kdata = PyBytes_AS_STRING(kbytes);
+  klen = PyBytes_GET_SIZE(kbytes);
+
+  copy = PyMem_Malloc(m->slot_size);
+  if (! copy) {
+    Py_DECREF(kbytes);
+    return PyErr_NoMemory();
+  }
+
+  index = hashed % m->capacity;
+
+  for (probe = 0; probe < SHMEMO_PROBE && probe < m->capacity; probe++) {
+    slot = shmemo_slot_at(m, index + probe);
+
+    for (spins = 0; spins < SHMEMO_SPINS; spins++) {
+      seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+      if (seq & 1) {
+	// a writer has it, wait for them to finish
+	sched_yield();
+	continue;
+      }
+
+      if (slot->hash != hashed || slot->key_len != (uint32_t) klen) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	again = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	if (again != seq)
+	  continue;
+
+	if (slot->hash == 0)
+	  goto miss;  // the end of the chain
+	break;  // someone else's, try the next slot
+      }
+
+      vlen = slot->val_len;
+      if (klen + (uint64_t) vlen > m->slot_size - sizeof(shmemo_slot))
+	continue;  // torn, and the check below would catch it anyway
+
+      memcpy(copy, slot->data, klen + vlen);
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      again = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+      if (again != seq)
+	continue;
+
+      if (memcmp(copy, kdata, klen))
+	break;
+
+      found = PyBytes_FromStringAndSize(copy + klen, vlen);
+      goto done;
+    }
+  }
+
+ miss:
+  found = Py_None;
+
+ done:
+  PyMem_Free(copy);
+  Py_DECREF(kbytes);
+  return found;
+}
+
+
+/* Whether the process owning a slot has gone. A pid we may not signal
+   still belongs to somebody, so only ESRCH counts */
+static int shmemo_dead(int64_t owner) {
+  return kill((pid_t) owner, 0) && errno == ESRCH;
+}
+
+
+/* Takes the slot's write lock, returning the (even) sequence it held,
+   or 1 if the lock could not be had */
+static uint64_t shmemo_lock(shmemo_slot *slot) {
+  int64_t owner, self = (int64_t) getpid();
+  uint64_t seq;
+  int spins;
+
+  for (spins = 0; ; spins++) {
+    owner = 0;
+    if (__atomic_compare_exchange_n(&slot->owner, &owner, self, 0,
+				    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+
+    if (spins >= SHMEMO_SPINS) {
+      // held this long, so see whether its owner is still about
+      if (shmemo_dead(owner) &&
+	  __atomic_compare_exchange_n(&slot->owner, &owner, self, 0,
+				      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	break;
+      return 1;
+    }
+    sched_yield();
+  }
+
+  seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+  if (seq & 1) {
+    // the owner died partway through writing it, and nothing left in
+    // it can be trusted. The hash stays, to keep the probe chain
+    // going, but no key is this long
+    slot->key_len = UINT32_MAX;
+    slot->val_len = 0;
+    return seq - 1;
+  }
+
+  __atomic_fetch_add(&slot->seq, 1, __ATOMIC_ACQUIRE);
+  return seq;
+}
+
+
+static inline void shmemo_unlock(shmemo_slot *slot, uint64_t seq) {
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+}
+
+
+/* Stores the pickled value under key. Returns 1 if stored, 0 if the
+   entry was too big or its slots too contended, -1 on error */
+static int shmemo_store(SharedMemo *m, PyObject *key, PyObject *pickled) {
+  uint64_t hashed, index, probe, seq;
+  Py_ssize_t klen, vlen;
+  shmemo_slot *slot;
+  PyObject *kbytes;
+  int stored = 0;
+
+  kbytes = shmemo_key(key, &hashed);
+  if (! kbytes)
+    return -1;
+
+  klen = PyBytes_GET_SIZE(kbytes);
+  vlen = PyBytes_GET_SIZE(pickled);
+
+  if ((uint64_t) (klen + vlen) > m->slot_size - sizeof(shmemo_slot)) {
+    Py_DECREF(kbytes);
+    return 0;
+  }
+
+  index = hashed % m->capacity;
+
+  for (probe = 0; probe <= SHMEMO_PROBE && ! stored; probe++) {
+    if (probe == SHMEMO_PROBE || probe == m->capacity) {
+      // the whole window is taken by other keys, so evict one of them
+      slot = shmemo_slot_at(m, index + ((hashed >> 32) % probe));
+
+    } else {
+      uint64_t held;
+
+      slot = shmemo_slot_at(m, index + probe);
+      held = __atomic_load_n(&slot->hash, __ATOMIC_RELAXED);
+      if (held && held != hashed)
+	continue;
+    }
+
+    seq = shmemo_lock(slot);
+    if (seq == 1)
+      break;
+
+    if (probe < SHMEMO_PROBE && probe < m->capacity &&
+	slot->hash && slot->hash != hashed) {
+      // somebody else claimed it while we were getting the lock
+      shmemo_unlock(slot, seq);
+      continue;
+    }
+
+    slot->hash = hashed;
+    slot->key_len = (uint32_t) klen;
+    slot->val_len = (uint32_t) vlen;
+    memcpy(slot->data, PyBytes_AS_STRING(kbytes), klen);
+    memcpy(slot->data + klen, PyBytes_AS_STRING(pickled), vlen);
+
+    shmemo_unlock(slot, seq);
+    stored = 1;
+
+    if (probe == m->capacity)
+      break;
+  }
+
+  Py_DECREF(kbytes);
+  return stored;
+}
+
+
+static PyObject *shmemo_get(PyObject *self, PyObject *args) {
+  SharedMemo *m = (SharedMemo *) self;
+  PyObject *key, *dflt = Py_None, *found, *result;
+
+  if (! PyArg_ParseTuple(args, "O|O:get", &key, &dflt))
+    return NULL;
+
+  if (shmemo_check_open(m) || shmemo_pickle())
+    return NULL;
+
+  found = shmemo_find(m, key);
+  if (! found)
+    return NULL;
+
+  if (found == Py_None) {
+    Py_INCREF(dflt);
+    return dflt;
+  }
+
+  result = PyObject_CallFunctionObjArgs(pickle_loads, found, NULL);
+  Py_DECREF(found);
+  return result;
+}
+
+
+static PyObject *shmemo_put(PyObject *self, PyObject *args) {
+  SharedMemo *m = (SharedMemo *) self;
+  PyObject *key, *value, *pickled;
+  int rc;
+
+  if (! PyArg_ParseTuple(args, "OO:put", &key, &value))
+    return NULL;
+
+  if (shmemo_check_open(m) || shmemo_pickle())
+    return NULL;
+
+  pickled = PyObject_CallFunction(pickle_dumps, "Oi", value, -1);
+  if (! pickled)
+    return NULL;
+
+  if (! PyBytes_Check(pickled)) {
+    Py_DECREF(pickled);
+    PyErr_SetString(PyExc_TypeError, "pickle.dumps did not return bytes");
+    return NULL;
+  }
+
+  rc = shmemo_store(m, key, pickled);
+  Py_DECREF(pickled);
+
+  if (rc < 0)
+    return NULL;
+
+  return PyBool_FromLong(rc);
+}
+
+
+static int shmemo_contains(PyObject *self, PyObject *key) {
+  SharedMemo *m = (SharedMemo *) self;
+  PyObject *found;
+
+  if (shmemo_check_open(m))
+    return -1;
+
+  found = shmemo_find(m, key);
+  if (! found)
+    return -1;
+
+  if (found == Py_None)
+    return 0;
+
+  Py_DECREF(found);
+  return 1;
+}
+
+
+static Py_ssize_t shmemo_len(PyObject *self) {
+  SharedMemo *m = (SharedMemo *) self;
+  Py_ssize_t count = 0;
+  uint64_t index;
+
+  if (shmemo_check_open(m))
+    return -1;
+
+  for (index = 0; index < m->capacity; index++) {
+    if (__atomic_load_n(&shmemo_slot_at(m, index)->hash, __ATOMIC_RELAXED))
+      count++;
+  }
+  return count;
+}
+
+
+static PyObject *shmemo_clear(PyObject *self, PyObject *_noargs) {
+  SharedMemo *m = (SharedMemo *) self;
+  shmemo_slot *slot;
+  uint64_t index, seq;
+
+  if (shmemo_check_open(m))
+    return NULL;
+
+  for (index = 0; index < m->capacity; index++) {
+    slot = shmemo_slot_at(m, index);
+    seq = shmemo_lock(slot);
+    if (seq == 1) {
+      PyErr_SetString(PyExc_TimeoutError, "SharedMemo slot is held");
+      return NULL;
+    }
+
+    slot->hash = 0;
+    slot->key_len = 0;
+    slot->val_len = 0;
+    shmemo_unlock(slot, seq);
+  }
+
+  Py_RETURN_NONE;
+}
+
+
+static void shmemo_unmap(SharedMemo *m) {
+#ifdef HAVE_SHMEMO
+  if (m->base) {
+    munmap(m->base, m->size);
+    m->base = NULL;
+  }
+#endif
+}
+
+
+static PyObject *shmemo_close(PyObject *self, PyObject *_noargs) {
+  shmemo_unmap((SharedMemo *) self);
+  Py_RETURN_NONE;
+}
+
+
+static PyObject *shmemo_unlink(PyObject *self, PyObject *_noargs) {
+#ifdef HAVE_SHMEMO
+  SharedMemo *m = (SharedMemo *) self;
+
+  if (shm_unlink(PyUnicode_AsUTF8(m->name)))
+    return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, m->name);
+#endif
+  Py_RETURN_NONE;
+}
+
+
+static PyObject *shmemo_enter(PyObject *self, PyObject *_noargs) {
+  Py_INCREF(self);
+  return self;
+}
+
+
+static PyObject *shmemo_exit(PyObject *self, PyObject *_args) {
+  shmemo_unmap((SharedMemo *) self);
+  Py_RETURN_NONE;
+}
+
+
+static void shmemo_dealloc(PyObject *self) {
+  SharedMemo *m = (SharedMemo *) self;
+
+  shmemo_unmap(m);
+  Py_XDECREF(m->name);
+
+  Py_TYPE(self)->tp_free(self);
+}
+
+
+#ifdef HAVE_SHMEMO
+
+/* Opens (creating if need be) and maps the named segment */
+static int shmemo_map(SharedMemo *m, uint64_t capacity, uint64_t slot_size) {
+  const char *name = PyUnicode_AsUTF8(m->name);
+  volatile shmemo_header *header;
+  struct stat st;
+  int fd, created = 1, spins;
+
+  m->size = SHMEMO_HEADER_SIZE + capacity * slot_size;
+
+  fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    created = 0;
+    fd = shm_open(name, O_RDWR, 0600);
+  }
+  if (fd < 0)
+    goto os_error;
+
+  if (created) {
+    if (ftruncate(fd, (off_t) m->size))
+      goto os_error_fd;
+
+  } else {
+    // somebody else created it, so wait for them to size it
+    for (spins = 0; ; spins++) {
+      if (fstat(fd, &st))
+	goto os_error_fd;
+      if ((size_t) st.st_size >= SHMEMO_HEADER_SIZE)
+	break;
+      if (spins > SHMEMO_SPINS) {
+	close(fd);
+	PyErr_Format(PyExc_TimeoutError, "SharedMemo %U was never"
+		     " initialized", m->name);
+	return -1;
+      }
+      sched_yield();
+    }
+
+    if ((size_t) st.st_size != m->size) {
+      close(fd);
+      PyErr_Format(PyExc_ValueError, "SharedMemo %U exists with a"
+		   " different size", m->name);
+      return -1;
+    }
+  }
+
+  m->base = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (m->base == MAP_FAILED) {
+    m->base = NULL;
+    goto os_error;
+  }
+
+  header = (volatile shmemo_header *) m->base;
+
+  if (created) {
+    header->version = SHMEMO_VERSION;
+    header->capacity = capacity;
+    header->slot_size = slot_size;
+    __atomic_store_n(&header->magic, SHMEMO_MAGIC, __ATOMIC_RELEASE);
+
+  } else {
+    for (spins = 0; __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) !=
+	   SHMEMO_MAGIC; spins++) {
+      if (spins > SHMEMO_SPINS) {
+	PyErr_Format(PyExc_TimeoutError, "SharedMemo %U was never"
+		     " initialized", m->name);
+	return -1;
+      }
+      sched_yield();
+    }
+
+    if (header->version != SHMEMO_VERSION ||
+	header->capacity != capacity || header->slot_size != slot_size) {
+      PyErr_Format(PyExc_ValueError, "SharedMemo %U exists with a"
+		   " different layout", m->name);
+      return -1;
+    }
+  }
+
+  return 0;
+
+ os_error_fd:
+  close(fd);
+ os_error:
+  PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, m->name);
+  return -1;
+}
+
+#endif
+
+
+static PyObject *shmemo_new(PyTypeObject *type,
+			    PyObject *args, PyObject *kwds) {
+
+  static char *kwlist[] = { "name", "capacity", "slot_size", NULL };
+
+  PyObject *name;
+  unsigned long long capacity, slot_size = 1024;
+  SharedMemo *m;
+
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "UK|K:SharedMemo", kwlist,
+				    &name, &capacity, &slot_size))
+    return NULL;
+
+  if (capacity < 1) {
+    PyErr_SetString(PyExc_ValueError, "SharedMemo capacity must be >= 1");
+    return NULL;
+  }
+
+  // whole cache lines, big enough for at least a small entry
+  slot_size = (slot_size + 63) & ~63ULL;
+  if (slot_size < 128 || slot_size > UINT32_MAX) {
+    PyErr_SetString(PyExc_ValueError, "SharedMemo slot_size must be"
+		    " between 128 and 2**32");
+    return NULL;
+  }
+
+  if (capacity > (PY_SSIZE_T_MAX - SHMEMO_HEADER_SIZE) / slot_size) {
+    PyErr_SetString(PyExc_OverflowError, "SharedMemo is too large");
+    return NULL;
+  }
+
+  m = (SharedMemo *) type->tp_alloc(type, 0);
+  if (! m)
+    return NULL;
+
+  m->base = NULL;
+  m->capacity = capacity;
+  m->slot_size = slot_size;
+
+  // POSIX wants the names to look like a root path
+  if (PyUnicode_GET_LENGTH(name) && PyUnicode_READ_CHAR(name, 0) == '/') {
+    Py_INCREF(name);
+    m->name = name;
+  } else {
+    m->name = PyUnicode_FromFormat("/%U", name);
+    if (! m->name) {
+      Py_DECREF(m);
+      return NULL;
+    }
+  }
+
+#ifdef HAVE_SHMEMO
+  if (shmemo_map(m, capacity, slot_size)) {
+    Py_DECREF(m);
+    return NULL;
+  }
+#else
+  PyErr_SetString(PyExc_OSError, "SharedMemo needs POSIX shared memory");
+  Py_DECREF(m);
+  return NULL;
+#endif
+
+  return (PyObject *) m;
+}
+
+
+static PyObject *shmemo_get_name(PyObject *self, void *_closure) {
+  SharedMemo *m = (SharedMemo *) self;
+  Py_INCREF(m->name);
+  return m->name;
+}
+
+
+static PyObject *shmemo_get_capacity(PyObject *self, void *_closure) {
+  return PyLong_FromUnsignedLongLong(((SharedMemo *) self)->capacity);
+}
+
+
+static PyObject *shmemo_get_slot_size(PyObject *self, void *_closure) {
+  return PyLong_FromUnsignedLongLong(((SharedMemo *) self)->slot_size);
+}
+
+
+static PyGetSetDef shmemo_getset[] = {
+  { "name", shmemo_get_name, NULL,
+    "the name of the shared memory segment", NULL },
+  { "capacity", shmemo_get_capacity, NULL,
+    "the number of slots in the table", NULL },
+  { "slot_size", shmemo_get_slot_size, NULL,
+    "the bytes available to each slot, key and result together", NULL },
+  { NULL },
+};
+
+
+static PyMethodDef shmemo_methods[] = {
+  { "get", (PyCFunction) shmemo_get, METH_VARARGS,
+    "M.get(key, default=None)\n"
+    "The result stored under key, or default" },
+
+  { "put", (PyCFunction) shmemo_put, METH_VARARGS,
+    "M.put(key, result) -> bool\n"
+    "Stores a pickled copy of result under key. False if it is too big\n"
+    "for a slot, or the slots were too contended to take" },
+
+  { "clear", (PyCFunction) shmemo_clear, METH_NOARGS,
+    "M.clear()\n"
+    "Empties the table for every process sharing it" },
+
+  { "close", (PyCFunction) shmemo_close, METH_NOARGS,
+    "M.close()\n"
+    "Unmaps the table from this process" },
+
+  { "unlink", (PyCFunction) shmemo_unlink, METH_NOARGS,
+    "M.unlink()\n"
+    "Removes the named segment, once every process has closed it" },
+
+  { "__enter__", (PyCFunction) shmemo_enter, METH_NOARGS, NULL },
+  { "__exit__", (PyCFunction) shmemo_exit, METH_VARARGS, NULL },
+
+  { NULL, NULL, 0, NULL },
+};
+
+
+static PySequenceMethods shmemo_as_sequence = {
+  .sq_length = shmemo_len,
+  .sq_contains = shmemo_contains,
+};
+
+
+PyTypeObject PyValuesSharedMemoType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "SharedMemo",
+  sizeof(SharedMemo),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+  .tp_doc = "SharedMemo(name, capacity, slot_size=1024)\n"
+  "A memo table in named POSIX shared memory, shared by every process\n"
+  "which opens the same name with the same layout. Keys are anything\n"
+  "with a canonical encoding, results are anything picklable",
+  .tp_new = shmemo_new,
+  .tp_dealloc = shmemo_dealloc,
+  .tp_methods = shmemo_methods,
+  .tp_getset = shmemo_getset,
+  .tp_as_sequence = &shmemo_as_sequence,
+};
+
+
+/* The end. */
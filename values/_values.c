@@ -25,7 +25,7 @@
  */
 
 
-#include <py3-values.h>
+#include "_values.h"
 
 
 #define DOCSTR "Native Sibilant core types and functions"
@@ -36,16 +36,6 @@
 #endif
 
 
-#if (defined(__GNUC__) &&					\
-     (__GNUC__ > 2 || (__GNUC__ == 2 && (__GNUC_MINOR__ > 95))))
-  #define likely(x)   __builtin_expect(!!(x), 1)
-  #define unlikely(x) __builtin_expect(!!(x), 0)
-#else
-  #define likely(x)   (x)
-  #define unlikely(x) (x)
-#endif
-
-
 #if 1
 #define DEBUGMSG(msg, obj) {                                    \
     printf("** " msg " ");                                      \
@@ -79,24 +69,101 @@ static PyObject *quoted(PyObject *u) {
 }
 
 
+/* raises the KeyError that V[key] would for a missing keyword */
+static void key_error(PyObject *key) {
+  PyObject *message;
+
+  if (! PyUnicode_Check(key)) {
+    PyErr_SetObject(PyExc_KeyError, key);
+    return;
+  }
+
+  message = quoted(key);
+  if (message) {
+    PyErr_SetObject(PyExc_KeyError, message);
+    Py_DECREF(message);
+  }
+}
+
+
 /* === ValuesType === */
 
 
+static PyObject *values_alloc(PyTypeObject *type,
+			      PyObject *args, PyObject *kwds) {
+  PyValues *self = NULL;
+
+  if (! args) {
+    PyErr_SetString(PyExc_TypeError, "values require arguments");
+    return NULL;
+  }
+
+  if (likely(type == &PyValuesType)) {
+    self = PyObject_GC_New(PyValues, &PyValuesType);
+    if (unlikely(! self))
+      return NULL;
+
+  } else {
+    // subclasses may carry __slots__ or a __dict__ beyond our own
+    // layout, so let the type allocate (and zero, and track) itself
+    self = (PyValues *) type->tp_alloc(type, 0);
+    if (unlikely(! self))
+      return NULL;
+  }
+
+  Py_INCREF(args);
+  self->args = args;
+  self->kwds = kwds? PyDict_Copy(kwds): NULL;
+  self->weakrefs = NULL;
+  self->hashed = 0;
+  self->lazy = 0;
+  self->repr = NULL;
+
+  if (likely(type == &PyValuesType))
+    PyObject_GC_Track((PyObject *) self);
+
+  return (PyObject *) self;
+}
+
+
 static PyObject *values_new(PyTypeObject *type,
 			    PyObject *args, PyObject *kwds) {
 
-  return sib_values(args, kwds);
+  PyObject *result = values_alloc(type, args, kwds);
+  SHAPE_SAMPLE(result);
+  return result;
+}
+
+
+/* as values_alloc, but takes over the reference to kwds. The shape is
+   sampled only once the keywords are in place */
+static PyObject *values_alloc_take(PyTypeObject *type,
+				   PyObject *args, PyObject *kwds) {
+
+  PyValues *result = (PyValues *) values_alloc(type, args, NULL);
+
+  if (result) {
+    result->kwds = kwds;  // just to avoid another copy
+    SHAPE_SAMPLE(result);
+  } else {
+    Py_XDECREF(kwds);
+  }
+
+  return (PyObject *) result;
 }
 
 
 static void values_dealloc(PyObject *self) {
   PyValues *s = (PyValues *) self;
 
+  PyObject_GC_UnTrack(self);
+
   if (s->weakrefs != NULL)
     PyObject_ClearWeakRefs(self);
 
   Py_XDECREF(s->args);
   Py_XDECREF(s->kwds);
+  Py_XDECREF(s->repr);
 
   Py_TYPE(self)->tp_free(self);
 }
@@ -116,6 +183,7 @@ static int values_clear(PyObject *self) {
   Py_CLEAR(s->args);
   if (s->kwds)
     Py_CLEAR(s->kwds);
+  Py_CLEAR(s->repr);
   return 0;
 }
 
@@ -157,6 +225,9 @@ static PyObject *values_kwds_getitem(PyObject *self, PyObject *key) {
     }
 
     if (result) {
+      if (unlikely(PyLazyField_Check(result)))
+	return values_kwd_force(s, key, result);
+
       Py_INCREF(result);
 
     } else {
@@ -164,7 +235,7 @@ static PyObject *values_kwds_getitem(PyObject *self, PyObject *key) {
       // either because there was a NULL keyword dict, or because of
       // an actual NULL result from GetItem. in either of those cases,
       // we want to emit the same KeyError
-      PyErr_SetObject(PyExc_KeyError, quoted(key));
+      key_error(key);
     }
 
     return result;
@@ -187,6 +258,9 @@ static PyObject *values_call(PyObject *self,
 
   work = PyTuple_GET_ITEM(args, 0);
 
+  if (VALUES_FORCE(s))
+    return NULL;
+
   if (PyTuple_GET_SIZE(args) > 1) {
     // if we have more positionals beyond just the callable work item,
     // we'll need to add those the invocation of work
@@ -246,18 +320,93 @@ static PyObject *values_call(PyObject *self,
 }
 
 
+/* the longest repr which will be kept on a values, or zero to keep
+   none at all. Set by repr_cache */
+static Py_ssize_t repr_cache_limit = 0;
+
+
+/* whether the repr of obj can never change, so that a repr including
+   it is safe to keep */
+static int repr_stable(PyObject *obj) {
+  PyTypeObject *type = Py_TYPE(obj);
+  Py_ssize_t index;
+
+  if (obj == Py_None || type == &PyBool_Type || type == &PyLong_Type ||
+      type == &PyFloat_Type || type == &PyUnicode_Type ||
+      type == &PyBytes_Type || type == &PyComplex_Type)
+    return 1;
+
+  if (type == &PyTuple_Type) {
+    for (index = PyTuple_GET_SIZE(obj); index--; ) {
+      if (! repr_stable(PyTuple_GET_ITEM(obj, index)))
+	return 0;
+    }
+    return 1;
+  }
+
+  // a nested values only qualified if its own repr was kept
+  return type == &PyValuesType && ((PyValues *) obj)->repr;
+}
+
+
+static int values_repr_stable(PyValues *s) {
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+
+  if (! repr_stable(s->args))
+    return 0;
+
+  if (s->kwds) {
+    while (PyDict_Next(s->kwds, &pos, &key, &value)) {
+      if (! repr_stable(value))
+	return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+static PyObject *values_repr_cache(PyObject *mod, PyObject *args) {
+  Py_ssize_t limit, previous = repr_cache_limit;
+
+  if (! PyArg_ParseTuple(args, "n:repr_cache", &limit))
+    return NULL;
+
+  if (limit < 0) {
+    PyErr_SetString(PyExc_ValueError, "repr_cache limit must be >= 0");
+    return NULL;
+  }
+
+  repr_cache_limit = limit;
+  return PyLong_FromSsize_t(previous);
+}
+
+
 static PyObject *values_repr(PyObject *self) {
   PyValues *s = (PyValues *) self;
-  PyObject *col = PyList_New(0);
+  PyObject *col;
   PyObject *tmp = NULL;
   Py_ssize_t count = 0, limit = 0;
   PyObject *key = NULL, *value = NULL;
 
+  if (s->repr) {
+    Py_INCREF(s->repr);
+    return s->repr;
+  }
+
+  col = PyList_New(0);
+
   // "values()"
   // "values(1, 2, 3)"
   // "values(foo=4, bar=5)"
   // "values(1, 2, 3, foo=4, bar=5)"
 
+  if (VALUES_FORCE(s)) {
+    Py_DECREF(col);
+    return NULL;
+  }
+
   PyList_Append(col, _str_values_paren);
 
   limit = PyTuple_GET_SIZE(s->args);
@@ -293,6 +442,14 @@ static PyObject *values_repr(PyObject *self) {
   tmp = PyUnicode_Join(_str_empty, col);
   Py_DECREF(col);
 
+  if (tmp && repr_cache_limit &&
+      PyUnicode_GET_LENGTH(tmp) <= repr_cache_limit &&
+      values_repr_stable(s)) {
+
+    Py_INCREF(tmp);
+    s->repr = tmp;
+  }
+
   return tmp;
 }
 
@@ -303,6 +460,9 @@ static Py_hash_t values_hash(PyObject *self) {
   PyObject *tmp, *frozen;
 
   if (result == 0) {
+    if (VALUES_FORCE(s))
+      return -1;
+
     result = PyObject_Hash(s->args);
     if (result == (Py_uhash_t) -1)
       return -1;
@@ -344,9 +504,12 @@ static long values_eq(PyObject *self, PyObject *other) {
     // identity is equality, yes
     answer = 1;
 
-  } else if (PyValues_CheckExact(other)) {
+  } else if (PyValues_Check(other)) {
     PyValues *o = (PyValues *) other;
 
+    if (VALUES_FORCE(s) || VALUES_FORCE(o))
+      return -1;
+
     // when comparing two values against each other, we'll just
     // compare their positionals and keywords. We'll actually do the
     // keywords check first, because it has a quick NULL-check
@@ -371,6 +534,9 @@ static long values_eq(PyObject *self, PyObject *other) {
     // comparing against a dict is fine, so long as positionals is
     // empty.
 
+    if (VALUES_FORCE(s))
+      return -1;
+
     if (s->kwds) {
       answer = (! PyTuple_GET_SIZE(s->args)) &&			\
 	PyObject_RichCompareBool(s->kwds, other, Py_EQ);
@@ -387,11 +553,15 @@ static long values_eq(PyObject *self, PyObject *other) {
 
 
 static PyObject *values_richcomp(PyObject *self, PyObject *other, int op) {
-  if (op == Py_EQ) {
-    return PyBool_FromLong(values_eq(self, other));
+  long answer;
+
+  if (op == Py_EQ || op == Py_NE) {
+    // forcing a lazy field is the one way for this to fail
+    answer = values_eq(self, other);
+    if (unlikely(answer < 0))
+      return NULL;
 
-  } else if (op == Py_NE) {
-    return PyBool_FromLong(! values_eq(self, other));
+    return PyBool_FromLong((op == Py_EQ)? answer: ! answer);
 
   } else {
     PyErr_SetString(PyExc_TypeError, "unsupported values comparison");
@@ -409,12 +579,17 @@ static int values_bool(PyObject *self) {
 
 static PyObject *values_add(PyObject *left, PyObject *right) {
   PyValues *result = NULL;
+  PyTypeObject *type = NULL;
   PyObject *args = NULL, *kwds = NULL, *tmp;
 
-  if (PyValues_CheckExact(left)) {
+  if (PyValues_Check(left)) {
     PyValues *s = (PyValues *) left;
 
-    if (PyValues_CheckExact(right)) {
+    // the left-hand values decides the type of the result, so that
+    // subclasses survive concatenation
+    type = Py_TYPE(left);
+
+    if (PyValues_Check(right)) {
       PyValues *o = (PyValues *) right;
 
       args = PySequence_Concat(s->args, o->args);
@@ -451,9 +626,11 @@ static PyObject *values_add(PyObject *left, PyObject *right) {
       Py_XINCREF(kwds);
     }
 
-  } else if (PyValues_CheckExact(right)) {
+  } else if (PyValues_Check(right)) {
     PyValues *s = (PyValues *) right;
 
+    type = Py_TYPE(right);
+
     if(PyDict_Check(left)) {
       args = s->args;
       Py_INCREF(args);
@@ -486,9 +663,12 @@ static PyObject *values_add(PyObject *left, PyObject *right) {
     return NULL;
   }
 
-  result = (PyValues *) sib_values(args, NULL);
-  if (result)
-    result->kwds = kwds;  // just to avoid another copy
+  result = (PyValues *) values_alloc_take(type, args, kwds);
+  if (result) {
+    // any unforced lazy fields came along with the keywords
+    result->lazy = (PyValues_Check(left) && ((PyValues *) left)->lazy) ||
+      (PyValues_Check(right) && ((PyValues *) right)->lazy);
+  }
   Py_DECREF(args);
 
   return (PyObject *) result;
@@ -515,10 +695,214 @@ static PyObject *values_keys(PyObject *self, PyObject *_noargs) {
 }
 
 
+/* a values of the same type and positionals as s, taking over kwds as
+   its keywords. Lazy fields are carried along unforced */
+static PyObject *values_project(PyValues *s, PyObject *kwds) {
+  PyValues *result;
+
+  if (kwds && ! PyDict_GET_SIZE(kwds)) {
+    // no keywords at all is NULL, so that equality and hashing agree
+    Py_CLEAR(kwds);
+  }
+
+  result = (PyValues *) values_alloc(Py_TYPE(s), s->args, NULL);
+  if (! result) {
+    Py_XDECREF(kwds);
+    return NULL;
+  }
+
+  result->kwds = kwds;
+  result->lazy = kwds && s->lazy;
+
+  return (PyObject *) result;
+}
+
+
+/* whether key is among keys, which are expected to be few */
+static int key_among(PyObject *keys, PyObject *key) {
+  Py_ssize_t index;
+  int found;
+
+  for (index = PyTuple_GET_SIZE(keys); index--; ) {
+    // interned names will usually match on identity alone
+    found = PyObject_RichCompareBool(PyTuple_GET_ITEM(keys, index), key,
+				     Py_EQ);
+    if (found)
+      return found;
+  }
+
+  return 0;
+}
+
+
+static PyObject *values_select(PyObject *self, PyObject *keys) {
+  PyValues *s = (PyValues *) self;
+  PyObject *kwds, *key, *value;
+  Py_ssize_t index, count = PyTuple_GET_SIZE(keys);
+
+  kwds = _PyDict_NewPresized(count);
+  if (! kwds)
+    return NULL;
+
+  for (index = 0; index < count; index++) {
+    key = PyTuple_GET_ITEM(keys, index);
+
+    value = s->kwds? PyDict_GetItemWithError(s->kwds, key): NULL;
+    if (! value) {
+      if (! PyErr_Occurred())
+	key_error(key);
+      Py_DECREF(kwds);
+      return NULL;
+    }
+
+    if (PyDict_SetItem(kwds, key, value)) {
+      Py_DECREF(kwds);
+      return NULL;
+    }
+  }
+
+  return values_project(s, kwds);
+}
+
+
+static PyObject *values_without(PyObject *self, PyObject *keys) {
+  PyValues *s = (PyValues *) self;
+  PyObject *kwds, *key, *value;
+  Py_ssize_t pos = 0;
+  int found;
+
+  if (! s->kwds || ! PyTuple_GET_SIZE(keys)) {
+    // nothing to take away, and we're immutable
+    Py_INCREF(self);
+    return self;
+  }
+
+  kwds = _PyDict_NewPresized(PyDict_GET_SIZE(s->kwds));
+  if (! kwds)
+    return NULL;
+
+  while (PyDict_Next(s->kwds, &pos, &key, &value)) {
+    found = key_among(keys, key);
+    if (found < 0 || (! found && PyDict_SetItem(kwds, key, value))) {
+      Py_DECREF(kwds);
+      return NULL;
+    }
+  }
+
+  return values_project(s, kwds);
+}
+
+
+static PyObject *values_rename(PyObject *self, PyObject *args,
+			       PyObject *names) {
+
+  PyValues *s = (PyValues *) self;
+  PyObject *kwds, *key, *value, *name;
+  Py_ssize_t pos = 0;
+  int taken;
+
+  if (PyTuple_GET_SIZE(args)) {
+    PyErr_SetString(PyExc_TypeError,
+		    "rename() takes only keyword arguments");
+    return NULL;
+  }
+
+  if (! names || ! PyDict_GET_SIZE(names)) {
+    Py_INCREF(self);
+    return self;
+  }
+
+  while (PyDict_Next(names, &pos, &key, &name)) {
+    if (! PyUnicode_Check(name)) {
+      PyErr_Format(PyExc_TypeError, "rename() new name for %R must be a"
+		   " str, not %.200s", key, Py_TYPE(name)->tp_name);
+      return NULL;
+    }
+
+    taken = s->kwds? PyDict_Contains(s->kwds, key): 0;
+    if (taken < 1) {
+      if (! taken)
+	key_error(key);
+      return NULL;
+    }
+  }
+
+  kwds = _PyDict_NewPresized(PyDict_GET_SIZE(s->kwds));
+  if (! kwds)
+    return NULL;
+
+  pos = 0;
+  while (PyDict_Next(s->kwds, &pos, &key, &value)) {
+    name = PyDict_GetItemWithError(names, key);
+    if (! name) {
+      if (PyErr_Occurred())
+	goto error;
+      name = key;
+    }
+
+    // each keyword keeps its place, under its new name
+    taken = PyDict_Contains(kwds, name);
+    if (taken) {
+      if (taken > 0)
+	PyErr_Format(PyExc_ValueError, "rename() would overwrite keyword"
+		     " %R", name);
+      goto error;
+    }
+
+    if (PyDict_SetItem(kwds, name, value))
+      goto error;
+  }
+
+  return values_project(s, kwds);
+
+ error:
+  Py_DECREF(kwds);
+  return NULL;
+}
+
+
 static PyMethodDef values_methods[] = {
   { "keys", (PyCFunction) values_keys, METH_NOARGS,
     "V.keys()" },
 
+  { "select", (PyCFunction) values_select, METH_VARARGS,
+    "V.select(*keys) -> values\n"
+    "A values with V's positionals and only the named keywords, in\n"
+    "the order named. Raises KeyError for a name V doesn't have" },
+
+  { "without", (PyCFunction) values_without, METH_VARARGS,
+    "V.without(*keys) -> values\n"
+    "A values with V's positionals and all of its keywords but the\n"
+    "named ones. Names V doesn't have are ignored" },
+
+  { "rename", (PyCFunction) values_rename, METH_VARARGS|METH_KEYWORDS,
+    "V.rename(**names) -> values\n"
+    "A values with V's positionals and keywords, where each keyword\n"
+    "given as old=\"new\" is renamed in place. Raises KeyError for an\n"
+    "old name V doesn't have, and ValueError if a new name would\n"
+    "overwrite another keyword" },
+
+  { "lazy", (PyCFunction) values_lazy,
+    METH_VARARGS|METH_KEYWORDS|METH_CLASS,
+    "values.lazy(*args, **thunks)\n"
+    "A values whose keywords are each computed by calling their thunk\n"
+    "with no arguments, once, the first time the keyword is needed" },
+
+  { "stable_hash", (PyCFunction) values_stable_hash,
+    METH_VARARGS|METH_KEYWORDS,
+    "V.stable_hash(seed=0) -> int\n"
+    "A 64-bit hash of the canonical encoding of V, which is the same\n"
+    "across processes and hosts, and ignores the order of keywords" },
+
+  { "canonical_bytes", (PyCFunction) values_canonical_bytes, METH_NOARGS,
+    "V.canonical_bytes() -> bytes\n"
+    "A deterministic, type-tagged encoding of V with sorted keywords" },
+
+  { "digest", (PyCFunction) values_digest, METH_VARARGS|METH_KEYWORDS,
+    "V.digest(algorithm=\"blake2b\") -> bytes\n"
+    "The hashlib digest of V.canonical_bytes(), computed by streaming\n"
+    "the encoding rather than building it in full" },
+
   { NULL, NULL, 0, NULL },
 };
 
@@ -547,7 +931,7 @@ PyTypeObject PyValuesType = {
   sizeof(PyValues),
   0,
 
-  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC,
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC,
   .tp_methods = values_methods,
   .tp_new = values_new,
   .tp_dealloc = values_dealloc,
@@ -568,26 +952,116 @@ PyTypeObject PyValuesType = {
 
 
 PyObject *sib_values(PyObject *args, PyObject *kwds) {
-  PyValues *self = NULL;
+  PyObject *result = values_alloc(&PyValuesType, args, kwds);
+  SHAPE_SAMPLE(result);
+  return result;
+}
 
-  if (! args) {
-    PyErr_SetString(PyExc_TypeError, "values require arguments");
-    return NULL;
-  }
 
-  self = PyObject_GC_New(PyValues, &PyValuesType);
-  if (unlikely(! self))
-    return NULL;
+PyObject *sib_values_take(PyObject *args, PyObject *kwds) {
+  return values_alloc_take(&PyValuesType, args, kwds);
+}
 
-  Py_INCREF(args);
-  self->args = args;
-  self->kwds = kwds? PyDict_Copy(kwds): NULL;
-  self->weakrefs = NULL;
-  self->hashed = 0;
 
-  PyObject_GC_Track((PyObject *) self);
-  return (PyObject *) self;
-}
+static PyMethodDef module_methods[] = {
+  { "stable_hash_many", (PyCFunction) values_stable_hash_many,
+    METH_VARARGS|METH_KEYWORDS,
+    "stable_hash_many(seq, seed=0) -> array('Q')\n"
+    "The stable_hash of each item of seq" },
+
+  { "from_canonical", (PyCFunction) values_from_canonical, METH_O,
+    "from_canonical(data) -> object\n"
+    "Decodes the canonical encoding in data, as produced by\n"
+    "canonical_bytes, back into values, tuples and scalars" },
+
+  { "repr_cache", (PyCFunction) values_repr_cache, METH_VARARGS,
+    "repr_cache(limit) -> int\n"
+    "Sets the length of the longest repr a values will keep for\n"
+    "reuse, returning the previous limit. Zero, the default, keeps\n"
+    "none. Only reprs made entirely of None, bools, numbers, strs,\n"
+    "bytes, and tuples or values of those are kept" },
+
+  { "_shape_sample", (PyCFunction) values_shape_sample,
+    METH_VARARGS|METH_KEYWORDS,
+    "_shape_sample(every, capacity=32) -> int\n"
+    "Samples one in every constructed values, counting its positional\n"
+    "arity and its set of keyword names, and keeping the top capacity\n"
+    "keyword sets. Zero stops sampling. The counts are cleared, and\n"
+    "the previous every is returned" },
+
+  { "_shape_report", (PyCFunction) values_shape_report,
+    METH_VARARGS|METH_KEYWORDS,
+    "_shape_report(reset=False) -> values\n"
+    "The sampled shapes, as a values of every, constructed, sampled,\n"
+    "arities as (arity, count) pairs, and shapes as (keys, count,\n"
+    "error) heaviest first, where a keyword set's true count is\n"
+    "between count - error and count. Arities of 63 and over are\n"
+    "counted together as 63" },
+
+  { "_memory_report", (PyCFunction) values_memory_report,
+    METH_VARARGS|METH_KEYWORDS,
+    "_memory_report(limit=10) -> values\n"
+    "The bytes held by every live values, as count and total, broken\n"
+    "down as struct, args, kwds and repr, and as shapes, the limit\n"
+    "heaviest (arity, keys, count, bytes). Storage shared between\n"
+    "values is counted once. Members of the values are not counted" },
+
+  { "compact", (PyCFunction) values_compact,
+    METH_VARARGS|METH_KEYWORDS,
+    "compact(records, fields=None) -> values\n"
+    "Has the values in records share one object for each equal str,\n"
+    "bytes, int or float member, swapping out the duplicates in place.\n"
+    "Only the given fields are compacted, where there are any. Reports\n"
+    "count of records, how many members were replaced, and the bytes\n"
+    "reclaimed by duplicates nothing else was holding, less those of\n"
+    "any positional tuples copied because something else shared them" },
+
+  { "partition", (PyCFunction) values_partition,
+    METH_VARARGS|METH_KEYWORDS,
+    "partition(seq, n, key=None, stable=False) -> list of n lists\n"
+    "Splits seq into n lists by hash(item) % n, or by the hash of\n"
+    "key(item) if key is given. With stable=True the stable_hash is\n"
+    "used instead, so the split agrees across processes" },
+
+  { "groupby", (PyCFunction) values_groupby, METH_VARARGS,
+    "groupby(records, *keys) -> dict\n"
+    "Groups records into lists by their fields. With a single key the\n"
+    "field value is the group key, otherwise a tuple of the fields" },
+
+  { "sort_by", (PyCFunction) values_sort_by, METH_VARARGS|METH_KEYWORDS,
+    "sort_by(records, *keys, reverse=False) -> list\n"
+    "Stable sort of records by their fields, in the same order as\n"
+    "sorted(records, key=itemgetter(*keys)). Fields holding only ints\n"
+    "or only floats are compared without calling back into Python" },
+
+  { "join", (PyCFunction) values_join, METH_VARARGS|METH_KEYWORDS,
+    "join(left, right, on, how=\"inner\") -> list\n"
+    "Joins two collections of records on the given field or fields,\n"
+    "producing left + right for every pair whose fields are equal, in\n"
+    "the order of left and then of right. With how=\"left\", records\n"
+    "of left matching nothing are included as they are" },
+
+  { "aggregate", (PyCFunction) values_aggregate,
+    METH_VARARGS|METH_KEYWORDS,
+    "aggregate(records, by=(), count=True, sum=(), min=(), max=(),\n"
+    "          mean=()) -> list of values\n"
+    "Aggregates records in a single pass, producing one values per\n"
+    "group of the by fields, in the order the groups were first seen.\n"
+    "Each result carries the by fields, the count, and fields named\n"
+    "like sum_bytes or max_latency for the requested aggregates" },
+
+  { "csv_reader", (PyCFunction) values_csv_reader,
+    METH_VARARGS|METH_KEYWORDS,
+    "csv_reader(fileobj, header=True, types=None, delimiter=\",\",\n"
+    "           quotechar='\"') -> iterator of values\n"
+    "Parses CSV lines from fileobj into one values per row. With a\n"
+    "header (True to read it from the first row, or a list of names)\n"
+    "rows are keyword values, otherwise positional. types is a dict\n"
+    "of name or column to converter, or a sequence of converters by\n"
+    "column; int and float are applied natively" },
+
+  { NULL, NULL, 0, NULL },
+};
 
 
 static struct PyModuleDef cvalues = {
@@ -595,7 +1069,7 @@ static struct PyModuleDef cvalues = {
   .m_name = "values._values",
   .m_doc = DOCSTR,
   .m_size = -1,
-  .m_methods = NULL,
+  .m_methods = module_methods,
   .m_slots = NULL,
   .m_traverse = NULL,
   .m_clear = NULL,
@@ -616,6 +1090,33 @@ PyMODINIT_FUNC PyInit__values(void) {
   if (PyType_Ready(&PyValuesType) < 0)
     return NULL;
 
+  if (PyType_Ready(&PyValuesCsvReaderType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&PyValuesSharedMemoType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&PyValuesChannelType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&PyValuesPipeType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&PyValuesLazyFieldType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&PyValuesFormatterType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&PyValuesProfileType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&PyValuesIndexType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&PyValuesWhereType) < 0)
+    return NULL;
+
   STR_CONST(_str_close_paren, ")");
   STR_CONST(_str_comma_space, ", ");
   STR_CONST(_str_empty, "");
@@ -624,12 +1125,24 @@ PyMODINIT_FUNC PyInit__values(void) {
   STR_CONST(_str_quote, "\"");
   STR_CONST(_str_values_paren, "values(");
 
+  if (canon_register_shareable())
+    return NULL;
+
   mod = PyModule_Create(&cvalues);
   if (! mod)
     return NULL;
 
   dict = PyModule_GetDict(mod);
   PyDict_SetItemString(dict, "cvalues", (PyObject *) &PyValuesType);
+  PyDict_SetItemString(dict, "SharedMemo",
+		       (PyObject *) &PyValuesSharedMemoType);
+  PyDict_SetItemString(dict, "Channel", (PyObject *) &PyValuesChannelType);
+  PyDict_SetItemString(dict, "pipe", (PyObject *) &PyValuesPipeType);
+  PyDict_SetItemString(dict, "formatter",
+		       (PyObject *) &PyValuesFormatterType);
+  PyDict_SetItemString(dict, "profile", (PyObject *) &PyValuesProfileType);
+  PyDict_SetItemString(dict, "Index", (PyObject *) &PyValuesIndexType);
+  PyDict_SetItemString(dict, "where", (PyObject *) &PyValuesWhereType);
 
   return mod;
 }
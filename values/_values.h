@@ -0,0 +1,247 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   Declarations shared between the translation units of the
+   values._values extension. Nothing in here is installed; the public
+   API lives in py3-values.h
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#ifndef VALUES_PRIVATE_H
+#define VALUES_PRIVATE_H
+
+
+#include <py3-values.h>
+#include <stdint.h>
+
+
+#if (defined(__GNUC__) &&					\
+     (__GNUC__ > 2 || (__GNUC__ == 2 && (__GNUC_MINOR__ > 95))))
+  #define likely(x)   __builtin_expect(!!(x), 1)
+  #define unlikely(x) __builtin_expect(!!(x), 0)
+#else
+  #define likely(x)   (x)
+  #define unlikely(x) (x)
+#endif
+
+
+/* === values type (_values.c) === */
+
+/* as sib_values, but taking over the caller's reference to kwds (which
+   may be NULL) rather than copying it. The reference is released if
+   construction fails */
+PyObject *sib_values_take(PyObject *args, PyObject *kwds);
+
+
+
+/* === canonical encoding (_canonical.c) === */
+
+#define CANON_BUFSIZE 512
+
+
+/* A buffered writer for the canonical encoding. Output collects in
+   the inline buffer, and is handed to flush whenever the buffer
+   fills, and once more by canon_finish. flush returns 0 on success,
+   or -1 with an exception set. */
+typedef struct canon_writer {
+  int (*flush)(struct canon_writer *w, const char *data, Py_ssize_t len);
+  void *ctx;
+  Py_ssize_t used;
+  char buffer[CANON_BUFSIZE];
+} canon_writer;
+
+
+int canon_encode(canon_writer *w, PyObject *obj);
+
+int canon_finish(canon_writer *w);
+
+
+/* streaming XXH64 */
+
+typedef struct xxh64_state {
+  uint64_t total_len;
+  uint64_t v[4];
+  unsigned char mem[32];
+  unsigned int memsize;
+  uint64_t seed;
+} xxh64_state;
+
+
+void xxh64_reset(xxh64_state *state, uint64_t seed);
+
+void xxh64_update(xxh64_state *state, const void *data, size_t len);
+
+uint64_t xxh64_digest(const xxh64_state *state);
+
+
+/* the stable hash of any canonically encodable object. Returns 0 on
+   success, or -1 with an exception set */
+int canon_stable_hash(PyObject *obj, uint64_t seed, uint64_t *result);
+
+
+/* the canonical encoding of obj as a new bytes object */
+PyObject *canon_bytes(PyObject *obj);
+
+
+PyObject *values_stable_hash(PyObject *self, PyObject *args, PyObject *kwds);
+
+PyObject *values_canonical_bytes(PyObject *self, PyObject *_noargs);
+
+PyObject *values_digest(PyObject *self, PyObject *args, PyObject *kwds);
+
+PyObject *values_stable_hash_many(PyObject *mod,
+				  PyObject *args, PyObject *kwds);
+
+
+/* decodes a canonical encoding into a new object, raising ValueError
+   if it is malformed */
+PyObject *canon_from_bytes(const char *data, Py_ssize_t len);
+
+PyObject *values_from_canonical(PyObject *mod, PyObject *data);
+
+
+/* registers values with the cross-interpreter data hooks, on 3.11
+   alone. Returns 0 on success, or -1 with an exception set */
+int canon_register_shareable(void);
+
+
+
+/* === kernels over record collections (_kernels.c) === */
+
+/* Fetches a field from a record, as a new reference. Records which
+   are values have their positionals (for an int key) or keywords read
+   directly, anything else is subscripted as normal. */
+PyObject *record_field(PyObject *rec, PyObject *key);
+
+PyObject *values_partition(PyObject *mod, PyObject *args, PyObject *kwds);
+
+PyObject *values_groupby(PyObject *mod, PyObject *args);
+
+PyObject *values_sort_by(PyObject *mod, PyObject *args, PyObject *kwds);
+
+PyObject *values_aggregate(PyObject *mod, PyObject *args, PyObject *kwds);
+
+
+
+/* === csv reader (_csv.c) === */
+
+extern PyTypeObject PyValuesCsvReaderType;
+
+PyObject *values_csv_reader(PyObject *mod, PyObject *args, PyObject *kwds);
+
+
+
+/* === shared memo (_shmemo.c) === */
+
+extern PyTypeObject PyValuesSharedMemoType;
+
+
+
+/* === channel (_channel.c) === */
+
+extern PyTypeObject PyValuesChannelType;
+
+
+
+/* === pipe (_pipe.c) === */
+
+extern PyTypeObject PyValuesPipeType;
+
+
+
+/* === lazy fields (_lazy.c) === */
+
+extern PyTypeObject PyValuesLazyFieldType;
+
+#define PyLazyField_Check(obj) (Py_TYPE(obj) == &PyValuesLazyFieldType)
+
+
+/* the value of a lazy field as a new reference, running its thunk if
+   it hasn't been already */
+PyObject *lazy_field_force(PyObject *field);
+
+/* forces the lazy field found under key in v's keywords, replacing it
+   there with its value, which is returned as a new reference */
+PyObject *values_kwd_force(PyValues *v, PyObject *key, PyObject *field);
+
+/* forces every lazy field of v. Returns 0 on success, or -1 with an
+   exception set */
+int values_force(PyValues *v);
+
+/* 0 if v holds no lazy fields or they could all be forced, otherwise
+   -1 with an exception set */
+#define VALUES_FORCE(v) (unlikely((v)->lazy) && values_force(v))
+
+PyObject *values_lazy(PyObject *type, PyObject *args, PyObject *kwds);
+
+
+
+/* === formatter (_format.c) === */
+
+extern PyTypeObject PyValuesFormatterType;
+
+
+
+/* === profile (_profile.c) === */
+
+extern PyTypeObject PyValuesProfileType;
+
+
+
+/* === shape telemetry (_shapes.c) === */
+
+/* sample one in every this many constructions, or none when zero */
+extern Py_ssize_t shape_every;
+
+void shape_sample(PyValues *v);
+
+#define SHAPE_SAMPLE(v)						\
+  { if (unlikely(shape_every) && (v)) shape_sample((PyValues *) (v)); }
+
+PyObject *values_shape_sample(PyObject *mod, PyObject *args, PyObject *kwds);
+PyObject *values_shape_report(PyObject *mod, PyObject *args, PyObject *kwds);
+
+
+
+/* === memory report (_memory.c) === */
+
+PyObject *values_memory_report(PyObject *mod, PyObject *args, PyObject *kwds);
+PyObject *values_compact(PyObject *mod, PyObject *args, PyObject *kwds);
+
+
+
+/* === record index (_index.c) === */
+
+extern PyTypeObject PyValuesIndexType;
+
+PyObject *values_join(PyObject *mod, PyObject *args, PyObject *kwds);
+
+
+
+/* === record predicates (_where.c) === */
+
+extern PyTypeObject PyValuesWhereType;
+
+
+#endif
+
+
+/* The end. */
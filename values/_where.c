@@ -0,0 +1,501 @@
+/*
+  This library is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 3 of the
+  License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   values._values where
+
+   A predicate over records, compiled once from keyword conditions
+   such as where(status=200, bytes__gt=1024). A plain field name tests
+   for equality, and a field name suffixed with __ne, __lt, __le,
+   __gt, __ge or __in tests with that operator instead. All of the
+   conditions must hold, and they are tested in the order given.
+
+   Each condition keeps its operand unboxed where it is an int that
+   fits in a long long, a float, or a str. A field holding the same
+   kind is then compared directly, and anything else goes through the
+   usual rich comparison, with the same result as the Python
+   expression would have. filter and count run the whole loop over
+   their records without returning to the interpreter.
+
+   author: Christopher O'Brien <obriencj@gmail.com>
+   license: LGPL v.3
+ */
+
+
+#include "_values.h"
+#include <string.h>
+
+
+#define WHERE_IN (Py_GE + 1)
+
+
+enum where_kind { WHERE_OBJECT, WHERE_INT, WHERE_FLOAT, WHERE_STR };
+
+
+typedef struct where_cond {
+  PyObject *field;
+  PyObject *operand;
+  PyObject *members;  // the operand of an __in as a frozenset, if any
+  int op;
+  enum where_kind kind;
+  long long ival;
+  double fval;
+} where_cond;
+
+
+typedef struct Where {
+  PyObject_HEAD
+
+  PyObject *conditions;
+  Py_ssize_t count;
+  where_cond *conds;
+} Where;
+
+
+static const struct {
+  const char *suffix;
+  int op;
+} where_suffixes[] = {
+  { "__ne", Py_NE },
+  { "__lt", Py_LT },
+  { "__le", Py_LE },
+  { "__gt", Py_GT },
+  { "__ge", Py_GE },
+  { "__in", WHERE_IN },
+  { NULL, 0 },
+};
+
+
+/* === compiling === */
+
+
+/* fills in cond from a single keyword condition. Returns 0 on success,
+   or -1 with an exception set */
+static int where_compile(where_cond *cond, PyObject *name,
+			 PyObject *operand) {
+
+  Py_ssize_t length = PyUnicode_GET_LENGTH(name), index;
+  PyObject *field = NULL, *suffix;
+  int overflow;
+
+  cond->op = Py_EQ;
+
+  // every suffix is four characters, and there must be a field left
+  suffix = length > 4? PyUnicode_Substring(name, length - 4, length): NULL;
+  if (suffix) {
+    for (index = 0; where_suffixes[index].suffix; index++) {
+      if (! PyUnicode_CompareWithASCIIString(suffix,
+					     where_suffixes[index].suffix)) {
+	cond->op = where_suffixes[index].op;
+	field = PyUnicode_Substring(name, 0, length - 4);
+	break;
+      }
+    }
+
+    Py_DECREF(suffix);
+    if (cond->op != Py_EQ && ! field)
+      return -1;
+
+  } else if (PyErr_Occurred()) {
+    return -1;
+  }
+
+  if (! field) {
+    Py_INCREF(name);
+    field = name;
+  }
+
+  // record keywords are usually interned, so this one should be too
+  PyUnicode_InternInPlace(&field);
+  cond->field = field;
+
+  Py_INCREF(operand);
+  cond->operand = operand;
+
+  if (cond->op == WHERE_IN) {
+    // membership is tested by hash where the operand allows it
+    if (PyList_Check(operand) || PyTuple_Check(operand)) {
+      cond->members = PyFrozenSet_New(operand);
+      if (! cond->members) {
+	if (! PyErr_ExceptionMatches(PyExc_TypeError))
+	  return -1;
+	PyErr_Clear();
+      }
+    }
+
+    cond->kind = WHERE_OBJECT;
+    return 0;
+  }
+
+  if (PyLong_CheckExact(operand)) {
+    cond->ival = PyLong_AsLongLongAndOverflow(operand, &overflow);
+    cond->kind = overflow? WHERE_OBJECT: WHERE_INT;
+
+  } else if (PyFloat_CheckExact(operand)) {
+    cond->fval = PyFloat_AS_DOUBLE(operand);
+    cond->kind = WHERE_FLOAT;
+
+  } else if (PyUnicode_CheckExact(operand)) {
+    cond->kind = WHERE_STR;
+
+  } else {
+    cond->kind = WHERE_OBJECT;
+  }
+
+  return 0;
+}
+
+
+/* === testing === */
+
+
+#define WHERE_CMP(left, right, op)			\
+  ((op) == Py_EQ? (left) == (right):			\
+   (op) == Py_NE? (left) != (right):			\
+   (op) == Py_LT? (left) < (right):			\
+   (op) == Py_LE? (left) <= (right):			\
+   (op) == Py_GT? (left) > (right): (left) >= (right))
+
+
+static int where_str_eq(PyObject *left, PyObject *right) {
+  Py_ssize_t length;
+
+  if (left == right)
+    return 1;
+
+  length = PyUnicode_GET_LENGTH(left);
+  if (length != PyUnicode_GET_LENGTH(right) ||
+      PyUnicode_KIND(left) != PyUnicode_KIND(right))
+    return 0;
+
+  return ! memcmp(PyUnicode_DATA(left), PyUnicode_DATA(right),
+		  length * PyUnicode_KIND(left));
+}
+
+
+/* whether value satisfies cond, or -1 with an exception set */
+static int where_test(where_cond *cond, PyObject *value) {
+  PyObject *result;
+  long long ival;
+  int overflow, found;
+
+  switch (cond->kind) {
+  case WHERE_INT:
+    if (PyLong_CheckExact(value)) {
+      ival = PyLong_AsLongLongAndOverflow(value, &overflow);
+      if (! overflow)
+	return WHERE_CMP(ival, cond->ival, cond->op);
+    }
+    break;
+
+  case WHERE_FLOAT:
+    if (PyFloat_CheckExact(value))
+      return WHERE_CMP(PyFloat_AS_DOUBLE(value), cond->fval, cond->op);
+    break;
+
+  case WHERE_STR:
+    if (PyUnicode_CheckExact(value)) {
+      if (cond->op == Py_EQ)
+	return where_str_eq(value, cond->operand);
+      if (cond->op == Py_NE)
+	return ! where_str_eq(value, cond->operand);
+    }
+    break;
+
+  default:
+    if (cond->op != WHERE_IN)
+      break;
+
+    if (cond->members) {
+      found = PySet_Contains(cond->members, value);
+      if (found >= 0 || ! PyErr_ExceptionMatches(PyExc_TypeError))
+	return found;
+
+      // an unhashable value may still be equal to one of them
+      PyErr_Clear();
+    }
+    return PySequence_Contains(cond->operand, value);
+  }
+
+  // not PyObject_RichCompareBool, whose identity shortcut would have
+  // a NaN equal to itself where the Python expression wouldn't
+  result = PyObject_RichCompare(value, cond->operand, cond->op);
+  if (! result)
+    return -1;
+
+  found = PyObject_IsTrue(result);
+  Py_DECREF(result);
+  return found;
+}
+
+
+/* whether rec satisfies every condition, or -1 with an exception set */
+static int where_match(Where *w, PyObject *rec) {
+  Py_ssize_t index;
+  PyObject *value;
+  int found = 1;
+
+  for (index = 0; found == 1 && index < w->count; index++) {
+    where_cond *cond = w->conds + index;
+
+    value = record_field(rec, cond->field);
+    if (! value)
+      return -1;
+
+    found = where_test(cond, value);
+    Py_DECREF(value);
+  }
+
+  return found;
+}
+
+
+/* Tests each record from iterable, appending those matching to into
+   if it isn't NULL. Returns how many matched, or -1 with an exception
+   set. */
+static Py_ssize_t where_loop(Where *w, PyObject *iterable, PyObject *into) {
+  PyObject *iter, *rec;
+  Py_ssize_t count = 0;
+  int found;
+
+  iter = PyObject_GetIter(iterable);
+  if (! iter)
+    return -1;
+
+  while ((rec = PyIter_Next(iter))) {
+    found = where_match(w, rec);
+
+    if (found > 0) {
+      count++;
+      if (into && PyList_Append(into, rec))
+	found = -1;
+    }
+
+    Py_DECREF(rec);
+    if (found < 0) {
+      Py_DECREF(iter);
+      return -1;
+    }
+  }
+
+  Py_DECREF(iter);
+  return PyErr_Occurred()? -1: count;
+}
+
+
+/* === methods === */
+
+
+static PyObject *where_filter(PyObject *self, PyObject *iterable) {
+  PyObject *result = PyList_New(0);
+
+  if (result && where_loop((Where *) self, iterable, result) < 0)
+    Py_CLEAR(result);
+
+  return result;
+}
+
+
+static PyObject *where_count(PyObject *self, PyObject *iterable) {
+  Py_ssize_t count = where_loop((Where *) self, iterable, NULL);
+  return count < 0? NULL: PyLong_FromSsize_t(count);
+}
+
+
+static PyObject *where_call(PyObject *self, PyObject *args, PyObject *kwds) {
+  PyObject *rec;
+  int found;
+
+  if (kwds && PyDict_GET_SIZE(kwds)) {
+    PyErr_SetString(PyExc_TypeError, "where takes a single record");
+    return NULL;
+  }
+
+  if (! PyArg_UnpackTuple(args, "where", 1, 1, &rec))
+    return NULL;
+
+  found = where_match((Where *) self, rec);
+  if (found < 0)
+    return NULL;
+
+  return PyBool_FromLong(found);
+}
+
+
+/* === type === */
+
+
+static void where_release(Where *w) {
+  where_cond *conds = w->conds;
+  Py_ssize_t index, count = w->count;
+
+  w->conds = NULL;
+  w->count = 0;
+
+  for (index = 0; index < count; index++) {
+    Py_XDECREF(conds[index].field);
+    Py_XDECREF(conds[index].operand);
+    Py_XDECREF(conds[index].members);
+  }
+  PyMem_Free(conds);
+
+  Py_CLEAR(w->conditions);
+}
+
+
+static PyObject *where_new(PyTypeObject *type, PyObject *args,
+			   PyObject *kwds) {
+
+  PyObject *name, *operand;
+  Py_ssize_t pos = 0, index = 0, count;
+  Where *w;
+
+  if (PyTuple_GET_SIZE(args)) {
+    PyErr_SetString(PyExc_TypeError,
+		    "where takes only keyword conditions");
+    return NULL;
+  }
+
+  count = kwds? PyDict_GET_SIZE(kwds): 0;
+
+  w = (Where *) type->tp_alloc(type, 0);
+  if (! w)
+    return NULL;
+
+  w->conditions = count? PyDict_Copy(kwds): PyDict_New();
+  w->conds = PyMem_Calloc(count? count: 1, sizeof(where_cond));
+  if (! (w->conditions && w->conds)) {
+    if (w->conditions)
+      PyErr_NoMemory();
+    goto error;
+  }
+
+  while (count && PyDict_Next(kwds, &pos, &name, &operand)) {
+    w->count = index + 1;
+    if (where_compile(w->conds + index, name, operand))
+      goto error;
+    index++;
+  }
+
+  return (PyObject *) w;
+
+ error:
+  Py_DECREF(w);
+  return NULL;
+}
+
+
+static void where_dealloc(PyObject *self) {
+  PyObject_GC_UnTrack(self);
+  where_release((Where *) self);
+  Py_TYPE(self)->tp_free(self);
+}
+
+
+static int where_traverse(PyObject *self, visitproc visit, void *arg) {
+  Where *w = (Where *) self;
+  Py_ssize_t index;
+
+  for (index = 0; index < w->count; index++) {
+    Py_VISIT(w->conds[index].operand);
+    Py_VISIT(w->conds[index].members);
+  }
+
+  Py_VISIT(w->conditions);
+  return 0;
+}
+
+
+static int where_clear(PyObject *self) {
+  where_release((Where *) self);
+  return 0;
+}
+
+
+static PyObject *where_repr(PyObject *self) {
+  PyObject *conditions = ((Where *) self)->conditions;
+  PyObject *parts, *name, *operand, *part, *sep, *joined, *result = NULL;
+  Py_ssize_t pos = 0;
+
+  if (! conditions)
+    return PyUnicode_FromString("where()");
+
+  parts = PyList_New(0);
+  if (! parts)
+    return NULL;
+
+  while (PyDict_Next(conditions, &pos, &name, &operand)) {
+    part = PyUnicode_FromFormat("%U=%R", name, operand);
+    if (! part || PyList_Append(parts, part)) {
+      Py_XDECREF(part);
+      goto done;
+    }
+    Py_DECREF(part);
+  }
+
+  sep = PyUnicode_FromString(", ");
+  joined = sep? PyUnicode_Join(sep, parts): NULL;
+  Py_XDECREF(sep);
+
+  if (joined) {
+    result = PyUnicode_FromFormat("where(%U)", joined);
+    Py_DECREF(joined);
+  }
+
+ done:
+  Py_DECREF(parts);
+  return result;
+}
+
+
+static PyMethodDef where_methods[] = {
+  { "filter", (PyCFunction) where_filter, METH_O,
+    "W.filter(records) -> list\n"
+    "The records matching every condition, in order" },
+
+  { "count", (PyCFunction) where_count, METH_O,
+    "W.count(records) -> int\n"
+    "How many of the records match every condition" },
+
+  { NULL, NULL, 0, NULL },
+};
+
+
+PyTypeObject PyValuesWhereType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+
+  "where",
+  sizeof(Where),
+  0,
+
+  .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC,
+  .tp_doc = "where(**conditions)\n"
+  "A predicate over records, true of a record when every condition\n"
+  "holds. field=value tests for equality, and field__ne, __lt, __le,\n"
+  "__gt, __ge or __in for that operator. Call it with a record, or\n"
+  "use filter or count over many",
+  .tp_new = where_new,
+  .tp_dealloc = where_dealloc,
+  .tp_traverse = where_traverse,
+  .tp_clear = where_clear,
+  .tp_repr = where_repr,
+  .tp_call = where_call,
+  .tp_methods = where_methods,
+};
+
+
+/* The end. */
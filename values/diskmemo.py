@@ -0,0 +1,513 @@
+# This library is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of the
+# License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see
+# <http://www.gnu.org/licenses/>.
+
+
+"""
+values.diskmemo
+
+A persistent memo of function results, kept in a directory holding an
+append-only log of pickled results and an mmap'd open-addressing index
+over it. Entries are keyed by a 16 byte digest of the canonical
+encoding of a values, so a lookup compares digests in the index and
+never has to decode a stored key.
+
+The log is the source of truth. The index records how much of the log
+it covers, and anything past that (say, after a crash) is re-indexed
+when the memo is opened. Compaction rewrites the log with only the live
+entries, newest first up to an optional byte limit, which is also how
+size-bounded eviction happens.
+
+Operations take an flock on the directory's lock file, shared for
+reads and exclusive for writes. An flock doesn't keep apart threads
+sharing the one memo, so they also take its mutex for the length of
+any operation. Rebuilding the index or compacting
+replaces the files, and bumps the generation in the old index so that
+other processes holding it know to reopen. Reopening may repair the
+index, so a reader finding its index stale takes the lock exclusively
+for long enough to reopen.
+
+author: Christopher O'Brien <obriencj@gmail.com>
+license: LGPL v.3
+"""
+
+
+import os
+import pickle
+
+from fcntl import flock, LOCK_EX, LOCK_SH, LOCK_UN
+from functools import wraps
+from mmap import mmap
+from struct import Struct
+from threading import RLock
+
+
+__ALL__ = ("DiskMemo", "diskmemo", )
+
+
+_INDEX_MAGIC = b"VLDMIDX1"
+_LOG_MAGIC = b"VLDM"
+
+# magic, generation, capacity, count, log_end
+_index_header = Struct("<8sQQQQ")
+_INDEX_HEADER_SIZE = 64
+
+# digest, offset + 1 (zero being empty), length
+_slot = Struct("<16sQI4x")
+
+# magic, digest, length
+_record = Struct("<4s16sI")
+
+_EMPTY_DIGEST = bytes(16)
+
+
+def key_digest(key):
+    """
+    The 16 byte digest a values is stored under
+    """
+
+    return key.digest()[:16]
+
+
+class _Lock(object):
+
+    def __init__(self, memo, mode=LOCK_EX):
+        self.memo = memo
+        self.mode = mode
+
+
+    def __enter__(self):
+        self.memo._mutex.acquire()
+        try:
+            self._flock()
+        except BaseException:
+            self.memo._mutex.release()
+            raise
+
+
+    def __exit__(self, *exc):
+        try:
+            flock(self.memo._lock_fd, LOCK_UN)
+        finally:
+            self.memo._mutex.release()
+
+
+    def _flock(self):
+        flock(self.memo._lock_fd, self.mode)
+
+
+class _ReadLock(_Lock):
+
+    def __init__(self, memo):
+        super().__init__(memo, LOCK_SH)
+
+
+    def _flock(self):
+        fd = self.memo._lock_fd
+        flock(fd, LOCK_SH)
+        if not self.memo._stale():
+            return
+
+        # other readers may be using the files that reopening would
+        # rewrite, so that waits for them to finish
+        try:
+            flock(fd, LOCK_EX)
+            self.memo._check_current()
+            flock(fd, LOCK_SH)
+        except BaseException:
+            flock(fd, LOCK_UN)
+            raise
+
+
+class DiskMemo(object):
+    """
+    DiskMemo(path, capacity=1024, max_bytes=None)
+
+    A persistent memo stored in the directory at path. capacity is the
+    initial number of index slots, which doubles as needed. When
+    max_bytes is given, the log is compacted down to half of it
+    whenever it grows past it, dropping the oldest entries.
+    """
+
+    def __init__(self, path, capacity=1024, max_bytes=None):
+        if capacity < 1:
+            raise ValueError("DiskMemo capacity must be >= 1")
+
+        os.makedirs(path, exist_ok=True)
+
+        self.path = path
+        self.max_bytes = max_bytes
+
+        self._log_path = os.path.join(path, "data.log")
+        self._index_path = os.path.join(path, "data.idx")
+
+        self._lock_fd = os.open(os.path.join(path, "lock"),
+                                os.O_RDWR | os.O_CREAT, 0o644)
+        self._log_fd = None
+        self._index_fd = None
+        self._index = None
+        self._mutex = RLock()
+
+        with _Lock(self):
+            self._open(capacity)
+
+
+    # === files ===
+
+
+    def _open(self, capacity=1024):
+        self._close_files()
+
+        self._log_fd = os.open(self._log_path,
+                               os.O_RDWR | os.O_CREAT | os.O_APPEND, 0o644)
+
+        if not os.path.exists(self._index_path):
+            self._write_index(self._index_path, capacity, ())
+
+        self._index_fd = os.open(self._index_path, os.O_RDWR)
+        self._index = mmap(self._index_fd, 0)
+
+        magic, gen, cap, count, log_end = \
+            _index_header.unpack_from(self._index, 0)
+
+        if magic != _INDEX_MAGIC or \
+           len(self._index) != _INDEX_HEADER_SIZE + cap * _slot.size:
+            # unusable, so start over from the log alone
+            self._rebuild(capacity, 0)
+            return
+
+        self._generation = gen
+        self._capacity = cap
+
+        if log_end < os.fstat(self._log_fd).st_size:
+            # the log has entries the index never heard of
+            self._catch_up(log_end)
+
+
+    def _close_files(self):
+        if self._index is not None:
+            self._index.close()
+            self._index = None
+        if self._index_fd is not None:
+            os.close(self._index_fd)
+            self._index_fd = None
+        if self._log_fd is not None:
+            os.close(self._log_fd)
+            self._log_fd = None
+
+
+    def _write_index(self, path, capacity, entries):
+        """
+        writes a complete index file over entries, a sequence of
+        (digest, offset, length), atomically replacing path
+        """
+
+        data = bytearray(_INDEX_HEADER_SIZE + capacity * _slot.size)
+
+        count = 0
+        log_end = 0
+        for digest, offset, length in entries:
+            if self._insert_into(data, capacity, digest, offset, length):
+                count += 1
+            log_end = max(log_end, offset + _record.size + length)
+
+        _index_header.pack_into(data, 0, _INDEX_MAGIC, 0, capacity,
+                                count, log_end)
+
+        tmp = path + ".tmp"
+        with open(tmp, "wb") as out:
+            out.write(data)
+        os.replace(tmp, path)
+
+
+    def _invalidate(self):
+        # tells anyone else mapping the current index to reopen
+        if self._index is not None:
+            _, gen, _, _, _ = _index_header.unpack_from(self._index, 0)
+            _index_header.pack_into(self._index, 0, b"VLDMSTAL", gen + 1,
+                                    0, 0, 0)
+            self._index.flush()
+
+
+    def _scan(self, start=0):
+        """
+        yields (digest, offset, length) for each complete record of
+        the log from start, and truncates any torn record at its end
+        """
+
+        size = os.fstat(self._log_fd).st_size
+        offset = start
+
+        while offset + _record.size <= size:
+            head = os.pread(self._log_fd, _record.size, offset)
+            magic, digest, length = _record.unpack(head)
+            if magic != _LOG_MAGIC or offset + _record.size + length > size:
+                break
+            yield digest, offset, length
+            offset += _record.size + length
+
+        if offset < size:
+            os.truncate(self._log_path, offset)
+
+
+    def _rebuild(self, capacity, start):
+        entries = list(self._scan(start))
+        while len(entries) * 10 > capacity * 7:
+            capacity *= 2
+
+        self._invalidate()
+        self._write_index(self._index_path, capacity, entries)
+        self._open(capacity)
+
+
+    def _catch_up(self, start):
+        for digest, offset, length in self._scan(start):
+            self._index_put(digest, offset, length)
+
+
+    # === index ===
+
+
+    @staticmethod
+    def _insert_into(data, capacity, digest, offset, length):
+        """
+        returns True if this added a new slot, False if it replaced
+        the slot of the same digest
+        """
+
+        home = int.from_bytes(digest[:8], "little") % capacity
+        for probe in range(capacity):
+            pos = _INDEX_HEADER_SIZE + ((home + probe) % capacity) * _slot.size
+            held = data[pos:pos + 16]
+            if held == digest or held == _EMPTY_DIGEST:
+                _slot.pack_into(data, pos, digest, offset + 1, length)
+                return held != digest
+
+        raise OverflowError("DiskMemo index is full")
+
+
+    def _index_find(self, digest):
+        index = self._index
+        capacity = self._capacity
+        home = int.from_bytes(digest[:8], "little") % capacity
+
+        for probe in range(capacity):
+            pos = _INDEX_HEADER_SIZE + ((home + probe) % capacity) * _slot.size
+            held = index[pos:pos + 16]
+            if held == digest:
+                _, offset, length = _slot.unpack_from(index, pos)
+                return offset - 1, length
+            elif held == _EMPTY_DIGEST:
+                break
+
+        return None
+
+
+    def _index_put(self, digest, offset, length):
+        magic, gen, cap, count, log_end = \
+            _index_header.unpack_from(self._index, 0)
+
+        if (count + 1) * 10 > cap * 7:
+            # too full, so rebuild it bigger. The log has everything
+            # the index does, plus this new record
+            self._rebuild(cap * 2, 0)
+            return
+
+        if self._insert_into(self._index, cap, digest, offset, length):
+            count += 1
+
+        log_end = max(log_end, offset + _record.size + length)
+        _index_header.pack_into(self._index, 0, magic, gen, cap,
+                                count, log_end)
+
+
+    def _stale(self):
+        # has somebody else replaced the files out from under us?
+        return self._index[:8] != _INDEX_MAGIC
+
+
+    def _check_current(self):
+        # only while holding the lock exclusively
+        if self._stale():
+            self._open(self._capacity)
+
+
+    # === the memo ===
+
+
+    def get(self, key, default=None):
+        digest = key_digest(key)
+
+        with _ReadLock(self):
+            found = self._index_find(digest)
+            if found is None:
+                return default
+
+            offset, length = found
+            data = os.pread(self._log_fd, _record.size + length, offset)
+
+        # the index may point somewhere the log no longer agrees with,
+        # and that is only a miss
+        if len(data) != _record.size + length or \
+           _record.unpack_from(data) != (_LOG_MAGIC, digest, length):
+            return default
+
+        return pickle.loads(data[_record.size:])
+
+
+    def put(self, key, value):
+        digest = key_digest(key)
+        data = pickle.dumps(value, pickle.HIGHEST_PROTOCOL)
+
+        with _Lock(self):
+            self._check_current()
+
+            offset = os.fstat(self._log_fd).st_size
+            os.write(self._log_fd, _record.pack(_LOG_MAGIC, digest,
+                                                len(data)) + data)
+            self._index_put(digest, offset, len(data))
+
+            if self.max_bytes and \
+               offset + _record.size + len(data) > self.max_bytes:
+                self._compact(self.max_bytes // 2)
+
+
+    def __contains__(self, key):
+        digest = key_digest(key)
+
+        with _ReadLock(self):
+            return self._index_find(digest) is not None
+
+
+    def __len__(self):
+        with _ReadLock(self):
+            return _index_header.unpack_from(self._index, 0)[3]
+
+
+    def size(self):
+        """
+        the current size of the log in bytes
+        """
+
+        with _ReadLock(self):
+            return os.fstat(self._log_fd).st_size
+
+
+    def compact(self, max_bytes=None):
+        """
+        rewrites the log with only its live entries. With max_bytes,
+        only as many of the newest entries as fit are kept
+        """
+
+        with _Lock(self):
+            self._check_current()
+            self._compact(max_bytes)
+
+
+    def _compact(self, max_bytes):
+        index = self._index
+        live = []
+        for slot in range(self._capacity):
+            pos = _INDEX_HEADER_SIZE + slot * _slot.size
+            digest, offset, length = _slot.unpack_from(index, pos)
+            if offset:
+                live.append((offset - 1, digest, length))
+
+        # newest first, so that eviction drops the oldest
+        live.sort(reverse=True)
+
+        kept = []
+        total = 0
+        for offset, digest, length in live:
+            total += _record.size + length
+            if max_bytes is not None and total > max_bytes:
+                break
+            kept.append((offset, digest, length))
+        kept.reverse()
+
+        entries = []
+        tmp = self._log_path + ".tmp"
+        with open(tmp, "wb") as out:
+            for offset, digest, length in kept:
+                entries.append((digest, out.tell(), length))
+                data = os.pread(self._log_fd, _record.size + length, offset)
+                out.write(data)
+
+        capacity = self._capacity
+        while capacity > 16 and len(entries) * 10 < capacity * 2:
+            capacity //= 2
+
+        self._invalidate()
+        os.replace(tmp, self._log_path)
+        self._write_index(self._index_path, capacity, entries)
+        self._open(capacity)
+
+
+    def clear(self):
+        with _Lock(self):
+            self._check_current()
+            self._invalidate()
+            os.truncate(self._log_path, 0)
+            self._write_index(self._index_path, self._capacity, ())
+            self._open(self._capacity)
+
+
+    def close(self):
+        with self._mutex:
+            self._close_files()
+            if self._lock_fd is not None:
+                os.close(self._lock_fd)
+                self._lock_fd = None
+
+
+    def __enter__(self):
+        return self
+
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def diskmemo(path, capacity=1024, max_bytes=None):
+    """
+    A decorator keeping the results of a deterministic function in a
+    DiskMemo at path, so that they survive process restarts. Calls are
+    keyed by the function's qualified name and its argument values.
+    The DiskMemo is available as the memo attribute of the result.
+    """
+
+    from . import values
+
+    memo = DiskMemo(path, capacity=capacity, max_bytes=max_bytes)
+
+    def decorator(function):
+        name = "%s.%s" % (function.__module__, function.__qualname__)
+        missing = object()
+
+        @wraps(function)
+        def memoized(*args, **kwds):
+            key = values(name, *args, **kwds)
+            found = memo.get(key, missing)
+            if found is missing:
+                found = function(*args, **kwds)
+                memo.put(key, found)
+            return found
+
+        memoized.memo = memo
+        return memoized
+
+    return decorator
+
+
+#
+# The end.